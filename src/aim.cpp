@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "aim.h"
+
+#include <math.h>
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kDegrees = 180 / kPi;
+
+// atan2, in degrees, to within about 0.001 of a degree, which is far
+// finer than a step.  It has no branches or library calls, so a loop of
+// them vectorises.
+inline double atan2Degrees(double y, double x) {
+  double ax = fabs(x);
+  double ay = fabs(y);
+  double high = ax > ay ? ax : ay;
+  double low = ax > ay ? ay : ax;
+  double a = low / (high > 0 ? high : 1);
+  double s = a * a;
+  double r = a * (0.99997726 + s * (-0.33262347 + s * (0.19354346 +
+    s * (-0.11643287 + s * (0.05265332 + s * -0.01172120)))));
+  r = ay > ax ? kPi / 2 - r : r;
+  r = x < 0 ? kPi - r : r;
+  r = y < 0 ? -r : r;
+  return r * kDegrees;
+}
+
+}
+
+// Clang doesn't keep errno or floating point traps for maths, so this
+// loop vectorises as it is.  GCC needs -fno-math-errno and
+// -fno-trapping-math for it to.
+void aimAt(const Placement& placement, const double* x, const double* y,
+           const double* z, size_t count, int* pan, int* tilt) {
+  // A copy, so the compiler knows the outputs can't change it.
+  const Placement p = placement;
+  for (size_t i = 0; i < count; i++) {
+    double dx = x[i] - p.x;
+    double dy = y[i] - p.y;
+    double dz = z[i] - p.z;
+    double panDegrees = atan2Degrees(dy, dx) - p.yaw;
+    panDegrees -= 360 * floor((panDegrees + 180) / 360);
+    double tiltDegrees = atan2Degrees(dz, sqrt(dx * dx + dy * dy)) - p.pitch;
+    pan[i] = static_cast<int>(floor(panDegrees / p.panDegreesPerStep + 0.5));
+    tilt[i] =
+      static_cast<int>(floor(tiltDegrees / p.tiltDegreesPerStep + 0.5));
+  }
+}
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+#include "position.h"
+
+// Works out where a placed camera should point to look at points in
+// the room.  A tracker can hand over every point from a frame at once,
+// with the coordinates in separate arrays, and they're solved in one
+// pass the compiler can vectorise.
+
+// Sets pan[i] and tilt[i] to the position, in steps, which points the
+// camera at (x[i], y[i], z[i]).  Pan is the shorter way round, so it
+// can be past the end stops, which planning will catch.
+void aimAt(const Placement& placement, const double* x, const double* y,
+           const double* z, size_t count, int* pan, int* tilt);
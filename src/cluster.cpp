@@ -0,0 +1,250 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "cluster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sstream>
+#include <stdexcept>
+
+#include "topology.h"
+
+namespace {
+
+ControlReply ackReply(const WireFrame& ack) {
+  ControlReply reply{ack.status == kWireOk, "", 0, 0, false, -1, 0};
+  switch (ack.status) {
+  case kWireOk:
+    decodeWireAck(ack, &reply.pan, &reply.tilt, &reply.homed);
+    break;
+  case kWireBusy:
+    reply.error = "too busy";
+    break;
+  case kWireUnknownCamera:
+    reply.error = "unknown camera";
+    break;
+  case kWireBadFrame:
+    reply.error = "not understood";
+    break;
+  }
+  return reply;
+}
+
+ControlReply lostReply() {
+  return ControlReply{false, "agent lost", 0, 0, false, -1, 0};
+}
+
+}
+
+Cluster::Cluster(const std::vector<std::string>& agents)
+  : names_(agents)
+{
+  for (const std::string& name : agents) {
+    std::string host = name;
+    uint16_t port = kWirePort;
+    size_t colon = name.rfind(':');
+    if (colon != std::string::npos) {
+      host = name.substr(0, colon);
+      port = static_cast<uint16_t>(atoi(name.c_str() + colon + 1));
+    }
+    std::unique_ptr<Agent> agent(new Agent);
+    agent->client.reset(new WireClient(host, port));
+    agents_.push_back(std::move(agent));
+  }
+
+  // Every agent is asked before any answer is read, so they look up
+  // their cameras at the same time.
+  WireFrame inventory = wireInventory(0);
+  for (std::unique_ptr<Agent>& agent : agents_) {
+    agent->client->send(&inventory, 1);
+  }
+  for (size_t i = 0; i < agents_.size(); i++) {
+    bool more = true;
+    while (more) {
+      WireFrame acks[64];
+      size_t count = agents_[i]->client->receive(acks, 64);
+      for (size_t j = 0; j < count; j++) {
+        if (acks[j].status == kWireOk) {
+          cameras_.push_back(ClusterCamera{i, acks[j].camera});
+        }
+        more = acks[j].data[0];
+      }
+    }
+  }
+
+  for (std::unique_ptr<Agent>& agent : agents_) {
+    Agent* a = agent.get();
+    agent->reader = std::thread([this, a]() { read(*a); });
+  }
+}
+
+Cluster::~Cluster() {
+  for (std::unique_ptr<Agent>& agent : agents_) {
+    agent->client->shutdown();
+    agent->reader.join();
+  }
+}
+
+bool Cluster::select(const std::string& names,
+                     std::vector<size_t>* cameras) const {
+  std::istringstream in(names);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    if (name == "all") {
+      for (size_t i = 0; i < cameras_.size(); i++) {
+        cameras->push_back(i);
+      }
+      continue;
+    }
+
+    size_t agent = agents_.size();
+    size_t slash = name.find('/');
+    if (slash != std::string::npos) {
+      agent = atoi(name.c_str()) - 1;
+      if (agent >= agents_.size()) {
+        return false;
+      }
+      name = name.substr(slash + 1);
+    }
+    uint32_t locationId;
+    if (!parseLocation(name, &locationId)) {
+      return false;
+    }
+    size_t found = cameras_.size();
+    for (size_t i = 0; i < cameras_.size(); i++) {
+      if (cameras_[i].locationId == locationId &&
+          (agent == agents_.size() || cameras_[i].agent == agent)) {
+        // A bare location has to be unambiguous.
+        if (found != cameras_.size()) {
+          return false;
+        }
+        found = i;
+      }
+    }
+    if (found == cameras_.size()) {
+      return false;
+    }
+    cameras->push_back(found);
+  }
+  return !cameras->empty();
+}
+
+std::string Cluster::name(const ClusterCamera& camera) const {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d/0x%08x", static_cast<int>(camera.agent + 1),
+           camera.locationId);
+  return buf;
+}
+
+bool Cluster::submit(const std::vector<size_t>& cameras,
+                     const ControlCommand& command, ClusterCallback done) {
+  WireFrame frame;
+  if (!encodeWireFrame(command, 0, &frame)) {
+    return false;
+  }
+
+  std::vector<std::vector<size_t>> byAgent(agents_.size());
+  for (size_t camera : cameras) {
+    byAgent[cameras_[camera].agent].push_back(camera);
+  }
+  std::vector<size_t> lost;
+  for (size_t i = 0; i < agents_.size(); i++) {
+    if (byAgent[i].empty()) {
+      continue;
+    }
+    Agent& agent = *agents_[i];
+    std::lock_guard<std::mutex> sending(agent.sending);
+    std::vector<WireFrame> frames;
+    {
+      std::lock_guard<std::mutex> lock(agent.mutex);
+      if (!agent.connected) {
+        lost.insert(lost.end(), byAgent[i].begin(), byAgent[i].end());
+        continue;
+      }
+      for (size_t camera : byAgent[i]) {
+        ControlCommand c = command;
+        c.locationId = cameras_[camera].locationId;
+        uint32_t sequence = agent.nextSequence++;
+        encodeWireFrame(c, sequence, &frame);
+        frames.push_back(frame);
+        // Registered before sending, since the reply can beat the
+        // send's return.
+        agent.pending[sequence] = std::make_pair(camera, done);
+      }
+    }
+    try {
+      agent.client->send(frames.data(), frames.size());
+    } catch (const std::exception&) {
+      // The reader will notice too, and fail what was pending.
+    }
+  }
+  for (size_t camera : lost) {
+    done(cameras_[camera], lostReply());
+  }
+  return true;
+}
+
+void Cluster::read(Agent& agent) {
+  struct Ready {
+    size_t ack;
+    size_t camera;
+    ClusterCallback done;
+  };
+
+  WireFrame acks[256];
+  std::vector<Ready> ready;
+  try {
+    for (;;) {
+      size_t count = agent.client->receive(acks, 256);
+      {
+        std::lock_guard<std::mutex> lock(agent.mutex);
+        for (size_t i = 0; i < count; i++) {
+          auto it = agent.pending.find(acks[i].sequence);
+          if (it != agent.pending.end()) {
+            ready.push_back(Ready{i, it->second.first, it->second.second});
+            agent.pending.erase(it);
+          }
+        }
+      }
+      // Called without the lock, so a callback can submit more.
+      for (Ready& r : ready) {
+        r.done(cameras_[r.camera], ackReply(acks[r.ack]));
+      }
+      ready.clear();
+    }
+  } catch (const std::exception&) {
+    // The agent went away, or the cluster is being destroyed.
+  }
+
+  std::map<uint32_t, std::pair<size_t, ClusterCallback>> pending;
+  {
+    std::lock_guard<std::mutex> lock(agent.mutex);
+    agent.connected = false;
+    pending.swap(agent.pending);
+  }
+  for (auto& p : pending) {
+    p.second.second(cameras_[p.second.first], lostReply());
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "controller.h"
+#include "wire.h"
+
+// Drives the cameras on many hosts, each running `orbitctl agent`, as
+// if they were on one.  Each agent gets one connection, and a command
+// goes straight to the agent with the camera, using the same frames
+// as a local client.  Many commands can be outstanding at once, and
+// replies are matched up by sequence number as they arrive.
+
+struct ClusterCamera {
+  // Which agent it's on, counting from 0 in the order given.
+  size_t agent;
+  uint32_t locationId;
+};
+
+using ClusterCallback =
+  std::function<void(const ClusterCamera&, const ControlReply&)>;
+
+class Cluster {
+public:
+  // Connects to each agent, given as host or host:port, and asks what
+  // cameras it has.  Throws if any can't be reached.
+  explicit Cluster(const std::vector<std::string>& agents);
+  ~Cluster();
+
+  Cluster(const Cluster&) = delete;
+  Cluster& operator=(const Cluster&) = delete;
+
+  const std::vector<std::string>& agents() const { return names_; }
+  const std::vector<ClusterCamera>& cameras() const { return cameras_; }
+
+  // Picks out cameras by name, which is "all", a location like
+  // 0xfa120000 which only one agent has, or one on a particular agent,
+  // like 2/0xfa120000 for the second, or a list of those separated by
+  // commas.  Returns false if any name doesn't match.
+  bool select(const std::string& names, std::vector<size_t>* cameras) const;
+  // The name which picks out just that camera.
+  std::string name(const ClusterCamera& camera) const;
+
+  // Sends the command to each of the cameras, with each agent's share
+  // in one write, so every agent works on it at once.  done is called
+  // on each camera's reply, from the thread reading its agent, or
+  // straight away if its agent is gone.  Returns false, without
+  // sending anything, if the protocol can't carry the command.
+  bool submit(const std::vector<size_t>& cameras,
+              const ControlCommand& command, ClusterCallback done);
+
+private:
+  struct Agent {
+    std::unique_ptr<WireClient> client;
+    std::thread reader;
+    // Held while sending, so frames go out in sequence.  The reader
+    // doesn't need it, so a send blocked on a full socket can't stop
+    // the acks being read.
+    std::mutex sending;
+    // Guards the rest.
+    std::mutex mutex;
+    bool connected = true;
+    uint32_t nextSequence = 1;
+    std::map<uint32_t, std::pair<size_t, ClusterCallback>> pending;
+  };
+
+  void read(Agent& agent);
+
+  std::vector<std::string> names_;
+  std::vector<std::unique_ptr<Agent>> agents_;
+  std::vector<ClusterCamera> cameras_;
+};
@@ -0,0 +1,931 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "controller.h"
+
+#include <pthread.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "request.h"
+#include "topology.h"
+#include "uvc.h"
+
+namespace {
+
+// Move times are generous guesses anyway, so a move can go a little
+// late, to share a wakeup with moves for other cameras.
+constexpr int64_t kMoveSlackUsec = 2000;
+// A synchronised start is this long after the last shard is ready, so
+// every worker is awake and waiting for it.  They sleep until shortly
+// before, and spin the rest of the way.
+constexpr int64_t kSyncLeadUsec = 2000;
+constexpr int64_t kSyncSpinUsec = 500;
+
+ControlReply makeReply(const PositionState& state, bool ok,
+                       const std::string& error) {
+  return ControlReply{ok, error, state.pan.position, state.tilt.position,
+                      state.homed(), state.ledMode, 0};
+}
+
+void send(ControlledCamera& camera, Request& req) {
+  req.send(*camera.transport, camera.motorUnit, camera.hwControlUnit);
+}
+
+}
+
+void pinToCore(size_t core) {
+#if defined(__APPLE__)
+  // macOS won't pin threads, but threads with different affinity tags
+  // are kept apart.
+  thread_affinity_policy_data_t policy = {static_cast<integer_t>(core + 1)};
+  thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                    THREAD_AFFINITY_POLICY,
+                    reinterpret_cast<thread_policy_t>(&policy),
+                    THREAD_AFFINITY_POLICY_COUNT);
+#elif defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+  (void) core;
+#endif
+}
+
+Controller::Controller(std::vector<ControlledCamera> cameras, size_t shards,
+                       const std::vector<CameraSnapshot>& resume)
+  : hubMotors_(hubMotorBudget())
+{
+  size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::sort(cameras.begin(), cameras.end(),
+            [](const ControlledCamera& a, const ControlledCamera& b) {
+              return a.locationId < b.locationId;
+            });
+
+  // Transfers to cameras on one controller share a bus anyway, so by
+  // default they might as well share a thread.  Given more threads,
+  // a hub's cameras still share one, which also keeps the hub motor
+  // budget without locking.
+  std::vector<uint32_t> locations;
+  for (const ControlledCamera& camera : cameras) {
+    locations.push_back(camera.locationId);
+  }
+  std::vector<size_t> owners = assignWorkers(locations, &shards, cores);
+
+  for (size_t i = 0; i < shards; i++) {
+    shards_.emplace_back(new Shard);
+  }
+  for (size_t i = 0; i < cameras.size(); i++) {
+    uint32_t locationId = cameras[i].locationId;
+    size_t owner = owners[i];
+    Shard& shard = *shards_[owner];
+    owner_[locationId] = owner;
+    shard.index[locationId] = shard.cameras.size();
+    shard.cameras.emplace_back();
+    CameraState& state = shard.cameras.back();
+    state.camera = std::move(cameras[i]);
+    state.hub = usbHub(locationId);
+    state.statePath = statePath(locationId);
+    state.state = loadCameraState(locationId);
+    for (const CameraSnapshot& snapshot : resume) {
+      if (snapshot.locationId == locationId) {
+        state.state = snapshot.state;
+        for (const Move& move : snapshot.moves) {
+          state.moves.emplace_back(move, ReplyCallback());
+        }
+        state.nextMoveUsec = snapshot.nextMoveUsec;
+      }
+    }
+  }
+  for (std::unique_ptr<Shard>& shard : shards_) {
+    for (CameraState& camera : shard->cameras) {
+      schedule(*shard, camera);
+    }
+  }
+
+  for (size_t i = 0; i < shards; i++) {
+    shards_[i]->thread = std::thread([this, i]() { run(i); });
+  }
+}
+
+Controller::~Controller() {
+  stopping_ = true;
+  for (std::unique_ptr<Shard>& shard : shards_) {
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->sleeping = false;
+    }
+    shard->wake.notify_one();
+  }
+  for (std::unique_ptr<Shard>& shard : shards_) {
+    if (shard->thread.joinable()) {
+      shard->thread.join();
+    }
+  }
+}
+
+std::vector<CameraSnapshot> Controller::detach() {
+  detaching_ = true;
+  stopping_ = true;
+  for (std::unique_ptr<Shard>& shard : shards_) {
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->sleeping = false;
+    }
+    shard->wake.notify_one();
+  }
+  // Workers waiting on a synchronised move which won't be released.
+  {
+    std::lock_guard<std::mutex> lock(syncsMutex_);
+    for (const std::weak_ptr<SyncMove>& weak : syncs_) {
+      if (std::shared_ptr<SyncMove> sync = weak.lock()) {
+        std::lock_guard<std::mutex> syncLock(sync->mutex);
+        sync->released.notify_all();
+      }
+    }
+  }
+
+  // With the workers gone, their cameras can be used from here.
+  std::vector<CameraSnapshot> snapshots;
+  for (std::unique_ptr<Shard>& shard : shards_) {
+    shard->thread.join();
+    Pending pending;
+    while (shard->queue.pop(&pending)) {
+      execute(*shard, pending);
+    }
+    for (CameraState& camera : shard->cameras) {
+      // Slots don't matter once detaching, so these all go now.
+      std::deque<Pending> deferred;
+      deferred.swap(camera.deferred);
+      for (Pending& held : deferred) {
+        execute(*shard, held);
+      }
+      CameraSnapshot snapshot{camera.camera.locationId, camera.state, {},
+                              camera.nextMoveUsec};
+      for (auto& move : camera.moves) {
+        snapshot.moves.push_back(move.first);
+        if (move.second) {
+          move.second(makeReply(camera.state, true, ""));
+        }
+      }
+      camera.moves.clear();
+      snapshots.push_back(snapshot);
+    }
+  }
+  return snapshots;
+}
+
+size_t Controller::shardOf(uint32_t locationId) const {
+  auto it = owner_.find(locationId);
+  if (it == owner_.end()) {
+    throw std::runtime_error("unknown camera");
+  }
+  return it->second;
+}
+
+std::vector<uint32_t> Controller::locations() const {
+  std::vector<uint32_t> locations;
+  for (const auto& owner : owner_) {
+    locations.push_back(owner.first);
+  }
+  return locations;
+}
+
+bool Controller::submit(const ControlCommand& command, ReplyCallback done) {
+  auto it = owner_.find(command.locationId);
+  if (it == owner_.end() || stopping_) {
+    return false;
+  }
+  Shard& shard = *shards_[it->second];
+  if (!shard.queue.push(Pending{command, std::move(done), nullptr, {}})) {
+    return false;
+  }
+  wake(shard);
+  return true;
+}
+
+bool Controller::submit(const std::vector<ControlCommand>& commands,
+                        ReplyCallback done) {
+  if (commands.empty() || stopping_) {
+    return false;
+  }
+  uint32_t locationId = commands.front().locationId;
+  for (const ControlCommand& command : commands) {
+    if (command.locationId != locationId) {
+      return false;
+    }
+  }
+  auto it = owner_.find(locationId);
+  if (it == owner_.end()) {
+    return false;
+  }
+  Shard& shard = *shards_[it->second];
+  if (!shard.queue.push(Pending{commands.front(), std::move(done), nullptr,
+                                commands})) {
+    return false;
+  }
+  wake(shard);
+  return true;
+}
+
+bool Controller::synchronize(const std::vector<SyncTarget>& targets,
+                             SyncCallback done) {
+  if (targets.empty() || stopping_) {
+    return false;
+  }
+  std::vector<bool> involved(shards_.size());
+  std::map<uint32_t, bool> seen;
+  for (const SyncTarget& target : targets) {
+    auto it = owner_.find(target.locationId);
+    if (it == owner_.end() || seen[target.locationId]) {
+      return false;
+    }
+    seen[target.locationId] = true;
+    involved[it->second] = true;
+  }
+
+  auto sync = std::make_shared<SyncMove>();
+  sync->targets = targets;
+  sync->done = std::move(done);
+  sync->replies.assign(targets.size(),
+                       ControlReply{false, "too busy", 0, 0, false, -1, 0});
+  sync->sentUsec.assign(targets.size(), 0);
+  {
+    std::lock_guard<std::mutex> lock(syncsMutex_);
+    syncs_.erase(std::remove_if(syncs_.begin(), syncs_.end(),
+                                [](const std::weak_ptr<SyncMove>& s) {
+                                  return s.expired();
+                                }),
+                 syncs_.end());
+    syncs_.push_back(sync);
+  }
+  size_t parts = 0;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    if (involved[i] &&
+        shards_[i]->queue.push(Pending{ControlCommand(), ReplyCallback(),
+                                       sync, {}})) {
+      wake(*shards_[i]);
+      parts++;
+    }
+  }
+  if (parts == 0) {
+    sync->done(SyncReply{0, sync->replies});
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(sync->mutex);
+  sync->parts = parts;
+  sync->unfinished = parts;
+  sync->sealed = true;
+  release(*sync);
+  return true;
+}
+
+void Controller::wake(Shard& shard) {
+  if (shard.sleeping.exchange(false)) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.wake.notify_one();
+  }
+}
+
+void Controller::run(size_t index) {
+  pinToCore(index % std::max(1u, std::thread::hardware_concurrency()));
+  Shard& shard = *shards_[index];
+  for (;;) {
+    if (detaching_) {
+      return;
+    }
+    Pending pending;
+    while (shard.queue.pop(&pending)) {
+      execute(shard, pending);
+    }
+
+    shard.timers.expire(wallClockUsec());
+    int64_t next = shard.timers.nextWakeUsec();
+    if (next == INT64_MAX && stopping_) {
+      // Anything submitted before stopping has been popped, since
+      // submit checks first.
+      if (!shard.queue.pop(&pending)) {
+        return;
+      }
+      execute(shard, pending);
+      continue;
+    }
+
+    // Sleep until the next timer, or something is submitted.
+    shard.sleeping = true;
+    if (shard.queue.pop(&pending)) {
+      shard.sleeping = false;
+      execute(shard, pending);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto woken = [&shard]() { return !shard.sleeping; };
+    if (next == INT64_MAX) {
+      shard.wake.wait(lock, woken);
+    } else {
+      int64_t sleepUsec = std::max<int64_t>(0, next - wallClockUsec());
+      shard.wake.wait_for(lock, std::chrono::microseconds(sleepUsec), woken);
+    }
+    shard.sleeping = false;
+  }
+}
+
+void Controller::plan(Shard& shard, CameraState& camera,
+                      const std::vector<Move>& moves, ReplyCallback done) {
+  if (moves.empty()) {
+    ControlReply reply = makeReply(camera.state, true, "");
+    reply.settledUsec = camera.nextMoveUsec;
+    done(reply);
+    return;
+  }
+  for (size_t i = 0; i < moves.size(); i++) {
+    camera.moves.emplace_back(
+      moves[i], i + 1 == moves.size() ? done : ReplyCallback());
+  }
+  if (camera.timer == 0) {
+    schedule(shard, camera);
+  }
+}
+
+// After a failure the position can't be trusted, and anything still
+// planned is abandoned.
+void Controller::fail(Shard& shard, CameraState& camera,
+                      const std::string& error) {
+  camera.state.pan.homed = false;
+  camera.state.tilt.homed = false;
+  abandon(shard, camera, error);
+}
+
+void Controller::abandon(Shard& shard, CameraState& camera,
+                         const std::string& error) {
+  for (auto& move : camera.moves) {
+    if (move.second) {
+      move.second(makeReply(camera.state, false, error));
+    }
+  }
+  camera.moves.clear();
+  idleMotor(shard, camera);
+  shard.timers.cancel(camera.timer);
+  camera.timer = 0;
+}
+
+void Controller::synchronize(Shard& shard, SyncMove& sync) {
+  struct Start {
+    size_t target;
+    CameraState* camera;
+    Move move;
+    Request req;
+  };
+
+  // Everything that can be done ahead of time is, so all that's left
+  // at the start is the transfers.
+  std::vector<Start> starts;
+  int64_t readyUsec = 0;
+  for (size_t i = 0; i < sync.targets.size(); i++) {
+    const SyncTarget& target = sync.targets[i];
+    auto index = shard.index.find(target.locationId);
+    if (index == shard.index.end()) {
+      continue;
+    }
+    CameraState& camera = shard.cameras[index->second];
+    PositionState& state = camera.state;
+    if (!camera.moves.empty()) {
+      sync.replies[i] = makeReply(state, false, "still moving");
+      continue;
+    }
+    if (!acquireMotor(shard, camera, false)) {
+      sync.replies[i] = makeReply(state, false, "hub motor budget in use");
+      continue;
+    }
+    // This worker is busy until the moves are sent, so the slot can't
+    // go before then.
+    idleMotor(shard, camera);
+    std::vector<Move> moves;
+    try {
+      moves = planAbsolute(state, target.pan, target.tilt);
+    } catch (const std::exception& ex) {
+      sync.replies[i] = makeReply(state, false, ex.what());
+      continue;
+    }
+    save(camera);
+    sync.replies[i] = makeReply(state, true, "");
+    if (moves.empty()) {
+      continue;
+    }
+    starts.push_back(Start{i, &camera, moves[0], Request()});
+    starts.back().req.panTiltRelative(moves[0].left, moves[0].up);
+    for (size_t j = 1; j < moves.size(); j++) {
+      camera.moves.emplace_back(moves[j], ReplyCallback());
+    }
+    readyUsec = std::max(readyUsec, camera.nextMoveUsec);
+    if (moves[0].left != 0) {
+      readyUsec = std::max(readyUsec, state.pan.resetUntilUsec);
+    }
+    if (moves[0].up != 0) {
+      readyUsec = std::max(readyUsec, state.tilt.resetUntilUsec);
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(sync.mutex);
+  sync.arrived++;
+  sync.startUsec = std::max(sync.startUsec, readyUsec);
+  release(sync);
+  // Detaching stops the other workers, so this can't wait for them.
+  sync.released.wait(lock, [this, &sync]() {
+    return sync.go || detaching_;
+  });
+  int64_t startUsec = sync.go ? sync.startUsec : 0;
+  lock.unlock();
+
+  int64_t sleepUsec = startUsec - kSyncSpinUsec - wallClockUsec();
+  if (sleepUsec > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(sleepUsec));
+  }
+  while (wallClockUsec() < startUsec) {
+  }
+  for (Start& start : starts) {
+    try {
+      send(start.camera->camera, start.req);
+      sync.sentUsec[start.target] = wallClockUsec();
+    } catch (const std::exception& ex) {
+      sync.replies[start.target] =
+        makeReply(start.camera->state, false, ex.what());
+    }
+  }
+
+  for (Start& start : starts) {
+    CameraState& camera = *start.camera;
+    if (sync.sentUsec[start.target] == 0) {
+      fail(shard, camera, sync.replies[start.target].error);
+      save(camera);
+      continue;
+    }
+    camera.nextMoveUsec = sync.sentUsec[start.target] +
+      moveTimeUsec(start.move);
+    schedule(shard, camera);
+    idleMotor(shard, camera);
+  }
+
+  if (--sync.unfinished == 0) {
+    int64_t first = INT64_MAX;
+    int64_t last = 0;
+    for (int64_t sent : sync.sentUsec) {
+      if (sent != 0) {
+        first = std::min(first, sent);
+        last = std::max(last, sent);
+      }
+    }
+    sync.done(SyncReply{last > 0 ? last - first : 0, sync.replies});
+  }
+}
+
+void Controller::release(SyncMove& sync) {
+  if (sync.sealed && sync.arrived == sync.parts && !sync.go) {
+    sync.startUsec =
+      std::max(sync.startUsec, wallClockUsec() + kSyncLeadUsec);
+    sync.go = true;
+    sync.released.notify_all();
+  }
+}
+
+void Controller::save(CameraState& camera) {
+  try {
+    savePositionState(camera.statePath, camera.state);
+  } catch (const std::exception&) {
+    // The state is still right in memory.
+  }
+}
+
+int64_t Controller::motorStopUsec(const CameraState& camera) {
+  return std::max(camera.nextMoveUsec,
+                  std::max(camera.state.pan.resetUntilUsec,
+                           camera.state.tilt.resetUntilUsec));
+}
+
+bool Controller::acquireMotor(Shard& shard, CameraState& camera,
+                              bool queue) {
+  if (hubMotors_ == 0 || camera.powered) {
+    return true;
+  }
+  Hub& hub = shard.hubs[camera.hub];
+  // Detaching has to finish what it was given.
+  if (hub.moving >= hubMotors_ && !detaching_) {
+    if (queue && !camera.waiting) {
+      hub.waiting.push_back(&camera);
+      camera.waiting = true;
+    }
+    return false;
+  }
+  hub.moving++;
+  camera.powered = true;
+  return true;
+}
+
+void Controller::idleMotor(Shard& shard, CameraState& camera) {
+  if (!camera.powered) {
+    return;
+  }
+  if (camera.motorTimer != 0) {
+    shard.timers.cancel(camera.motorTimer);
+  }
+  int64_t stopUsec = motorStopUsec(camera);
+  Shard* s = &shard;
+  CameraState* c = &camera;
+  camera.motorTimer = shard.timers.add(stopUsec, kMoveSlackUsec,
+                                       [this, s, c]() {
+    c->motorTimer = 0;
+    releaseMotor(*s, *c);
+  });
+}
+
+void Controller::releaseMotor(Shard& shard, CameraState& camera) {
+  // The next move goes as this one stops, and gives the slot up after.
+  if (!camera.powered || !camera.moves.empty()) {
+    return;
+  }
+  Hub& hub = shard.hubs[camera.hub];
+  camera.powered = false;
+  hub.moving--;
+
+  // What a waiting camera has left to do, as far as its motors go.
+  auto work = [](const CameraState* c) {
+    int64_t usec = 0;
+    for (const auto& move : c->moves) {
+      usec += moveTimeUsec(move.first);
+    }
+    if (!c->deferred.empty()) {
+      usec += resetTimeUsec(true, true);
+    }
+    return usec;
+  };
+  while (!hub.waiting.empty() && hub.moving < hubMotors_) {
+    auto next = std::max_element(
+      hub.waiting.begin(), hub.waiting.end(),
+      [&work](const CameraState* a, const CameraState* b) {
+        return work(a) < work(b);
+      });
+    CameraState& ready = **next;
+    hub.waiting.erase(next);
+    ready.waiting = false;
+    acquireMotor(shard, ready, false);
+    std::deque<Pending> deferred;
+    deferred.swap(ready.deferred);
+    for (Pending& held : deferred) {
+      execute(shard, held);
+    }
+    if (ready.timer == 0) {
+      schedule(shard, ready);
+    }
+    // In case there's nothing left to do after all.
+    idleMotor(shard, ready);
+  }
+}
+
+void Controller::execute(Shard& shard, Pending& pending) {
+  if (pending.sync) {
+    synchronize(shard, *pending.sync);
+    return;
+  }
+  if (!pending.batch.empty()) {
+    std::vector<ControlCommand> batch;
+    batch.swap(pending.batch);
+    for (const ControlCommand& command : batch) {
+      Pending one{command, pending.done, nullptr, {}};
+      execute(shard, one);
+    }
+    return;
+  }
+  CameraState& camera = shard.cameras[shard.index[pending.command.locationId]];
+  if (!camera.deferred.empty()) {
+    // Behind a reset waiting for a motor slot.
+    camera.deferred.push_back(std::move(pending));
+    return;
+  }
+  PositionState& state = camera.state;
+  const ControlCommand& command = pending.command;
+  bool changed = true;
+  try {
+    switch (command.kind) {
+    case ControlCommand::kMove:
+      plan(shard, camera, planRelative(state, command.a, command.b),
+           pending.done);
+      break;
+    case ControlCommand::kGoto:
+      plan(shard, camera, planAbsolute(state, command.a, command.b),
+           pending.done);
+      break;
+    case ControlCommand::kReset: {
+      bool pan = command.a & LXU_MOTOR_PANTILT_RESET_CONTROL_PAN;
+      bool tilt = command.a & LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+      if (command.a == 0) {
+        resetNeeded(state, &pan, &tilt);
+      }
+      if ((pan || tilt) && !acquireMotor(shard, camera, true)) {
+        camera.deferred.push_back(std::move(pending));
+        return;
+      }
+      if (pan || tilt) {
+        // The camera ignores moves on a resetting axis, so anything
+        // still planned would go wrong.  The position of an axis which
+        // isn't reset is still right, unless it had planned moves left,
+        // since those are already counted in it.
+        for (const auto& move : camera.moves) {
+          if (!pan && move.first.left != 0) {
+            state.pan.homed = false;
+          }
+          if (!tilt && move.first.up != 0) {
+            state.tilt.homed = false;
+          }
+        }
+        abandon(shard, camera, "interrupted by a reset");
+        Request req;
+        req.panTiltReset(pan, tilt);
+        send(camera.camera, req);
+        state.reset(pan, tilt, wallClockUsec());
+        idleMotor(shard, camera);
+      }
+      pending.done(makeReply(state, true, ""));
+      break; }
+    case ControlCommand::kLed: {
+      Request req;
+      req.ledControl(command.a, command.b);
+      send(camera.camera, req);
+      state.ledMode = command.a;
+      state.ledFrequency = command.b;
+      pending.done(makeReply(state, true, ""));
+      break; }
+    case ControlCommand::kProbe: {
+      Request req;
+      req.probe();
+      send(camera.camera, req);
+      changed = false;
+      pending.done(makeReply(state, req.length() == 1, ""));
+      break; }
+    case ControlCommand::kPosition:
+      changed = false;
+      pending.done(makeReply(state, true, ""));
+      break;
+    case ControlCommand::kSavePreset:
+      if (!state.homed()) {
+        throw std::runtime_error("position is unknown, reset first");
+      }
+      state.presets[command.a] =
+        std::make_pair(state.pan.position, state.tilt.position);
+      pending.done(makeReply(state, true, ""));
+      break;
+    case ControlCommand::kRecallPreset: {
+      auto preset = state.presets.find(command.a);
+      if (preset == state.presets.end()) {
+        changed = false;
+        pending.done(makeReply(state, false, "no such preset"));
+        break;
+      }
+      plan(shard, camera, planAbsolute(state, preset->second.first,
+                                       preset->second.second),
+           pending.done);
+      break; }
+    case ControlCommand::kClearPreset:
+      state.presets.erase(command.a);
+      pending.done(makeReply(state, true, ""));
+      break;
+    case ControlCommand::kTour: {
+      auto tour = state.tours.find(command.a);
+      if (tour == state.tours.end()) {
+        changed = false;
+        pending.done(makeReply(state, false, "no such tour"));
+        break;
+      }
+      bool missing = std::any_of(
+        tour->second.begin(), tour->second.end(),
+        [&state](int number) { return !state.presets.count(number); });
+      if (missing) {
+        changed = false;
+        pending.done(makeReply(state, false, "no such preset"));
+        break;
+      }
+      // One plan for the lap, so it's replied to at the end.
+      std::vector<Move> moves;
+      for (int number : tour->second) {
+        const std::pair<int, int>& preset = state.presets[number];
+        std::vector<Move> leg =
+          planAbsolute(state, preset.first, preset.second);
+        moves.insert(moves.end(), leg.begin(), leg.end());
+      }
+      plan(shard, camera, moves, pending.done);
+      break; }
+    }
+  } catch (const std::exception& ex) {
+    // Only a motor command that fails after sending something leaves the
+    // position in doubt.  Planning errors happen before anything is sent,
+    // and an LED or probe failure doesn't move anything.
+    bool motor = command.kind == ControlCommand::kMove ||
+                 command.kind == ControlCommand::kGoto ||
+                 command.kind == ControlCommand::kReset ||
+                 command.kind == ControlCommand::kRecallPreset ||
+                 command.kind == ControlCommand::kTour;
+    bool planning = (command.kind == ControlCommand::kGoto ||
+                     command.kind == ControlCommand::kRecallPreset ||
+                     command.kind == ControlCommand::kTour) &&
+                    !state.homed();
+    if (motor && !planning) {
+      fail(shard, camera, ex.what());
+    } else {
+      changed = false;
+    }
+    pending.done(makeReply(state, false, ex.what()));
+  }
+
+  if (changed) {
+    save(camera);
+  }
+}
+
+void Controller::schedule(Shard& shard, CameraState& camera) {
+  if (camera.moves.empty()) {
+    return;
+  }
+  Move move = camera.moves.front().first;
+  int64_t due = camera.nextMoveUsec;
+  if (move.left != 0) {
+    due = std::max(due, camera.state.pan.resetUntilUsec);
+  }
+  if (move.up != 0) {
+    due = std::max(due, camera.state.tilt.resetUntilUsec);
+  }
+  Shard* s = &shard;
+  CameraState* c = &camera;
+  camera.timer = shard.timers.add(due, kMoveSlackUsec, [this, s, c]() {
+    c->timer = 0;
+    sendNext(*s, *c);
+  });
+}
+
+void Controller::sendNext(Shard& shard, CameraState& camera) {
+  if (camera.moves.empty() || !acquireMotor(shard, camera, true)) {
+    return;
+  }
+  Move move = camera.moves.front().first;
+  ReplyCallback done = std::move(camera.moves.front().second);
+  camera.moves.pop_front();
+  try {
+    Request req;
+    req.panTiltRelative(move.left, move.up);
+    send(camera.camera, req);
+  } catch (const std::exception& ex) {
+    fail(shard, camera, ex.what());
+    if (done) {
+      done(makeReply(camera.state, false, ex.what()));
+    }
+    save(camera);
+    return;
+  }
+  camera.nextMoveUsec = wallClockUsec() + moveTimeUsec(move);
+  if (done) {
+    ControlReply reply = makeReply(camera.state, true, "");
+    reply.settledUsec = camera.nextMoveUsec;
+    done(reply);
+  }
+  schedule(shard, camera);
+  idleMotor(shard, camera);
+}
+
+bool parseControlCommand(const std::string& line, ControlCommand* command) {
+  std::istringstream in(line);
+  std::string location, action;
+  if (!(in >> location) || !std::getline(in, action)) {
+    return false;
+  }
+  return parseLocation(location, &command->locationId) &&
+    parseControlAction(action, command);
+}
+
+bool parseControlAction(const std::string& text, ControlCommand* command) {
+  std::istringstream in(text);
+  std::string kind, arg;
+  if (!(in >> kind)) {
+    return false;
+  }
+  command->a = 0;
+  command->b = 0;
+
+  if (kind == "move" || kind == "goto") {
+    command->kind =
+      kind == "move" ? ControlCommand::kMove : ControlCommand::kGoto;
+    if (!(in >> command->a >> command->b)) {
+      return false;
+    }
+  } else if (kind == "reset") {
+    command->kind = ControlCommand::kReset;
+    std::string axes = "both";
+    in >> axes;
+    if (axes == "pan") {
+      command->a = LXU_MOTOR_PANTILT_RESET_CONTROL_PAN;
+    } else if (axes == "tilt") {
+      command->a = LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+    } else if (axes == "both") {
+      command->a = LXU_MOTOR_PANTILT_RESET_CONTROL_PAN |
+        LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+    } else if (axes != "auto") {
+      return false;
+    }
+  } else if (kind == "led") {
+    command->kind = ControlCommand::kLed;
+    if (!(in >> arg)) {
+      return false;
+    }
+    if (arg == "on") {
+      command->a = LXU_HW_CONTROL_LED1_MODE_ON;
+    } else if (arg == "off") {
+      command->a = LXU_HW_CONTROL_LED1_MODE_OFF;
+    } else if (arg == "auto") {
+      command->a = LXU_HW_CONTROL_LED1_MODE_AUTO;
+    } else {
+      return false;
+    }
+  } else if (kind == "preset") {
+    if (!(in >> arg >> command->a)) {
+      return false;
+    }
+    if (arg == "save") {
+      command->kind = ControlCommand::kSavePreset;
+    } else if (arg == "recall") {
+      command->kind = ControlCommand::kRecallPreset;
+    } else if (arg == "clear") {
+      command->kind = ControlCommand::kClearPreset;
+    } else {
+      return false;
+    }
+  } else if (kind == "tour") {
+    command->kind = ControlCommand::kTour;
+    if (!(in >> command->a)) {
+      return false;
+    }
+  } else if (kind == "probe") {
+    command->kind = ControlCommand::kProbe;
+  } else if (kind == "position") {
+    command->kind = ControlCommand::kPosition;
+  } else {
+    return false;
+  }
+  return !(in >> arg);
+}
+
+bool parseSyncCommand(const std::string& line,
+                      std::vector<SyncTarget>* targets) {
+  std::istringstream in(line);
+  std::string kind, location;
+  if (!(in >> kind) || kind != "sync") {
+    return false;
+  }
+  targets->clear();
+  while (in >> location) {
+    SyncTarget target{0, 0, 0};
+    if (!parseLocation(location, &target.locationId) ||
+        !(in >> target.pan >> target.tilt)) {
+      return false;
+    }
+    targets->push_back(target);
+  }
+  return !targets->empty();
+}
+
+std::string formatControlReply(uint32_t locationId, const ControlReply& reply) {
+  char buf[64];
+  if (!reply.ok) {
+    snprintf(buf, sizeof(buf), "0x%08x error ", locationId);
+    return buf + (reply.error.empty() ? "not responding" : reply.error);
+  }
+  snprintf(buf, sizeof(buf), "0x%08x ok %d %d%s", locationId, reply.pan,
+           reply.tilt, reply.homed ? "" : " unhomed");
+  return buf;
+}
@@ -0,0 +1,313 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "position.h"
+#include "queue.h"
+#include "timer.h"
+#include "transport.h"
+
+// A long running controller for many cameras.  The cameras are split
+// among a few worker threads, each pinned to its own core, and each
+// camera belongs to exactly one of them, so nothing about a camera is
+// shared between threads.  Clients hand commands to the owning worker
+// through a lock free queue, and get the reply on a callback which runs
+// on that worker.  A worker never sleeps in the middle of a plan, so
+// one slow camera doesn't hold up the others on its thread, and an
+// idle worker doesn't wake up at all until it's given something.
+//
+// Too many motors running at once on one hub brown it out, so with a
+// hub motor budget, only that many of a hub's cameras move or reset at
+// a time.  The others wait their turn, and the one with the most left
+// to do goes first, which keeps the time for them all down.
+
+struct ControlledCamera {
+  uint32_t locationId;
+  std::unique_ptr<Transport> transport;
+  uint8_t motorUnit;
+  uint8_t hwControlUnit;
+};
+
+struct ControlCommand {
+  enum Kind {
+    // Moves by left and up steps.
+    kMove,
+    // Moves to pan, tilt.
+    kGoto,
+    // The axes are a reset bitmask, or 0 to reset whichever need it.
+    kReset,
+    kLed,
+    kProbe,
+    kPosition,
+    // The preset number is a.  Recalling moves to it.
+    kSavePreset,
+    kRecallPreset,
+    kClearPreset,
+    // Goes once round tour a, stopping at each of its presets.
+    kTour,
+  };
+
+  Kind kind;
+  uint32_t locationId;
+  // What these mean depends on the kind: steps, a position, the reset
+  // axes, the LED mode and frequency, or a preset.
+  int a;
+  int b;
+};
+
+struct ControlReply {
+  bool ok;
+  std::string error;
+  // Where the camera is, or will be once the plan is done.
+  int pan;
+  int tilt;
+  bool homed;
+  // The last LED mode set, or -1.
+  int ledMode;
+  // When the last move sent will be done, in wall clock microseconds,
+  // or 0 if there wasn't one.
+  int64_t settledUsec;
+};
+
+using ReplyCallback = std::function<void(const ControlReply&)>;
+
+// Where one camera in a synchronised move goes.
+struct SyncTarget {
+  uint32_t locationId;
+  int pan;
+  int tilt;
+};
+
+struct SyncReply {
+  // How far apart the cameras got their first moves, from the first to
+  // the last.
+  int64_t skewUsec;
+  // Each camera's reply, in the order of the targets.
+  std::vector<ControlReply> cameras;
+};
+
+using SyncCallback = std::function<void(const SyncReply&)>;
+
+// What a controller knows about a camera beyond its state file, so
+// another controller can carry on where it left off.
+struct CameraSnapshot {
+  uint32_t locationId;
+  PositionState state;
+  // Moves planned but not yet sent, and when the next one can go.
+  std::vector<Move> moves;
+  int64_t nextMoveUsec;
+};
+
+class Controller {
+public:
+  // With 0 shards, there is one per USB controller, up to the number
+  // of cores.  Either way, a hub's cameras always share a shard, so
+  // there's only one transfer to a hub at a time, and the motor budget
+  // is kept without locking.  Each camera's state is loaded from its
+  // state file, and saved after every command which changes it.
+  // Cameras with a snapshot in resume start from it instead.
+  Controller(std::vector<ControlledCamera> cameras, size_t shards,
+             const std::vector<CameraSnapshot>& resume =
+               std::vector<CameraSnapshot>());
+  // Waits for the workers to finish what they've been given.
+  ~Controller();
+
+  // Stops the workers without waiting for plans to finish, and returns
+  // where every camera is.  Commands already submitted are carried
+  // out, and plans are replied to as if they'd finished, since the
+  // moves left are in the snapshots.  Nothing more can be submitted.
+  std::vector<CameraSnapshot> detach();
+
+  // Returns false if the camera isn't known, or its worker is too
+  // far behind to take any more.
+  bool submit(const ControlCommand& command, ReplyCallback done);
+  // Submits commands for one camera as a single queue entry, to be
+  // carried out in order.  done is called with each one's reply.
+  // Returns false, doing nothing, if they aren't all for one camera.
+  bool submit(const std::vector<ControlCommand>& commands,
+              ReplyCallback done);
+
+  // Moves the cameras to their targets, starting them all at once.
+  // Each shard's worker plans its cameras' moves and encodes their
+  // first requests, then they wait for each other, and send at the
+  // same moment, once every camera can start.  Cameras sharing a shard
+  // go one after another, so the start is tightest with each on its
+  // own USB controller.  A camera still working through a plan, or
+  // whose hub is at its motor budget, is left where it is.  done is
+  // called once every first move is sent.
+  // Returns false, doing nothing, for an unknown or repeated camera.
+  bool synchronize(const std::vector<SyncTarget>& targets,
+                   SyncCallback done);
+
+  bool owns(uint32_t locationId) const { return owner_.count(locationId); }
+  // Every camera's location, in order.
+  std::vector<uint32_t> locations() const;
+  size_t shards() const { return shards_.size(); }
+  size_t shardOf(uint32_t locationId) const;
+
+private:
+  // A synchronised move, shared by the shards taking part.
+  struct SyncMove {
+    std::vector<SyncTarget> targets;
+    SyncCallback done;
+    std::mutex mutex;
+    std::condition_variable released;
+    // How many shards take part, once they've all been given it.
+    size_t parts = 0;
+    bool sealed = false;
+    size_t arrived = 0;
+    // When everything sends, once every part has arrived.
+    int64_t startUsec = 0;
+    bool go = false;
+    std::atomic<size_t> unfinished{0};
+    std::vector<ControlReply> replies;
+    // When each camera's first move was sent, or 0.
+    std::vector<int64_t> sentUsec;
+  };
+
+  struct Pending {
+    ControlCommand command;
+    ReplyCallback done;
+    // For a shard's part of a synchronised move, instead of command.
+    std::shared_ptr<SyncMove> sync;
+    // For a batch of commands to one camera, instead of command.
+    std::vector<ControlCommand> batch;
+  };
+
+  struct CameraState {
+    ControlledCamera camera;
+    PositionState state;
+    std::string statePath;
+    // Moves still to send, and when the next one can go.  The last
+    // move of each plan carries the plan's reply.
+    std::deque<std::pair<Move, ReplyCallback>> moves;
+    int64_t nextMoveUsec = 0;
+    // The timer for the next move, or 0.
+    uint64_t timer = 0;
+    uint32_t hub = 0;
+    // Set while the camera has one of its hub's motor slots, or is
+    // queued for one.
+    bool powered = false;
+    bool waiting = false;
+    // The timer for giving the slot up, or 0.
+    uint64_t motorTimer = 0;
+    // Commands held back until a reset gets a slot, in order.
+    std::deque<Pending> deferred;
+  };
+
+  struct Hub {
+    size_t moving = 0;
+    std::vector<CameraState*> waiting;
+  };
+
+  struct Shard {
+    Shard() : queue(1024), timers(wallClockUsec()) {}
+
+    BoundedQueue<Pending> queue;
+    std::vector<CameraState> cameras;
+    std::map<uint32_t, size_t> index;
+    std::map<uint32_t, Hub> hubs;
+    TimerWheel timers;
+    std::thread thread;
+    // The worker only takes the lock to sleep, and submitters only
+    // take it to wake a sleeping worker.
+    std::atomic<bool> sleeping{false};
+    std::mutex mutex;
+    std::condition_variable wake;
+  };
+
+  void run(size_t shard);
+  void execute(Shard& shard, Pending& pending);
+  // Sets a timer for the camera's next move, if it has one.
+  void schedule(Shard& shard, CameraState& camera);
+  // Sends the camera's next move, if it's due.
+  void sendNext(Shard& shard, CameraState& camera);
+  void plan(Shard& shard, CameraState& camera, const std::vector<Move>& moves,
+            ReplyCallback done);
+  void fail(Shard& shard, CameraState& camera, const std::string& error);
+  // Replies to the plan with the error, and drops its moves.
+  void abandon(Shard& shard, CameraState& camera, const std::string& error);
+  void synchronize(Shard& shard, SyncMove& sync);
+  // With sync's lock held, lets every part go once they've all been
+  // given out and arrived.
+  void release(SyncMove& sync);
+  void wake(Shard& shard);
+  void save(CameraState& camera);
+  // Gives the camera one of its hub's motor slots, if it hasn't one.
+  // Returns false if they're all taken, queueing the camera for one if
+  // queue is set.
+  bool acquireMotor(Shard& shard, CameraState& camera, bool queue);
+  // Gives the slot up once the camera's motors stop.
+  void idleMotor(Shard& shard, CameraState& camera);
+  static int64_t motorStopUsec(const CameraState& camera);
+  // Gives the slot up now, unless the camera has more moves to make,
+  // and lets the hub's waiting cameras have what's free.
+  void releaseMotor(Shard& shard, CameraState& camera);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // Motors which can run at once on one hub, or 0 for no limit.
+  size_t hubMotors_;
+  // This never changes once the workers start, so it can be read
+  // without locking.
+  std::map<uint32_t, size_t> owner_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> detaching_{false};
+  // Synchronised moves which may have workers waiting, for detach() to
+  // wake.
+  std::mutex syncsMutex_;
+  std::vector<std::weak_ptr<SyncMove>> syncs_;
+};
+
+// A line based form of commands, for driving the controller by hand:
+// "location move left up", "location goto pan tilt", "location reset
+// [pan | tilt | both | auto]", "location led on | off | auto",
+// "location preset save | recall | clear number", "location tour
+// number", "location probe" or "location position", with the location
+// in hex.
+bool parseControlCommand(const std::string& line, ControlCommand* command);
+// The same without the location, like "goto 10 -5", which is left
+// alone.
+bool parseControlAction(const std::string& text, ControlCommand* command);
+std::string formatControlReply(uint32_t locationId, const ControlReply& reply);
+// "sync location pan tilt [location pan tilt ...]", for a
+// synchronised move.
+bool parseSyncCommand(const std::string& line,
+                      std::vector<SyncTarget>* targets);
+
+// Asks the scheduler to keep the calling thread on one core.  It's
+// only a hint on some systems.
+void pinToCore(size_t core);
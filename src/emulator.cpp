@@ -0,0 +1,312 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "emulator.h"
+
+#include <stdexcept>
+
+#include "request.h"
+#include "uvc.h"
+
+namespace {
+
+// GET_INFO bits: supports GET and SET.
+constexpr uint8_t kInfoGetSet = 0x03;
+constexpr uint8_t kInfoSet = 0x02;
+
+void stall() {
+  throw std::runtime_error("ControlRequest failed: pipe stalled");
+}
+
+class DescriptorBuilder {
+public:
+  void begin(uint8_t type, uint8_t subtype) {
+    start_ = bytes_.size();
+    u8(0);
+    u8(type);
+    u8(subtype);
+  }
+
+  void end() {
+    bytes_[start_] = static_cast<uint8_t>(bytes_.size() - start_);
+  }
+
+  void u8(uint8_t v) {
+    bytes_.push_back(v);
+  }
+
+  void u16(uint16_t v) {
+    u8(v & 0xff);
+    u8(v >> 8);
+  }
+
+  void u32(uint32_t v) {
+    u16(v & 0xffff);
+    u16(v >> 16);
+  }
+
+  void guid(const uint8_t* g) {
+    bytes_.insert(bytes_.end(), g, g + 16);
+  }
+
+  // Standard descriptors don't have a subtype.
+  void endpoint(uint8_t address, uint8_t attributes, uint16_t maxPacket,
+                uint8_t interval) {
+    start_ = bytes_.size();
+    u8(0);
+    u8(USB_ENDPOINT_DESCRIPTOR);
+    u8(address);
+    u8(attributes);
+    u16(maxPacket);
+    u8(interval);
+    end();
+  }
+
+  void logitechExtensionUnit(uint8_t unitId, const uint8_t* g,
+                             uint8_t numControls, uint8_t source,
+                             uint8_t controls) {
+    begin(VS_LOGITECH_TYPE, VS_LOGITECH_EXTENSION_UNIT);
+    u8(unitId);
+    guid(g);
+    u8(numControls);
+    u8(1);
+    u8(source);
+    u8(1);
+    u8(controls);
+    u8(0);
+    end();
+  }
+
+  std::vector<uint8_t> bytes() const {
+    return bytes_;
+  }
+
+private:
+  size_t start_ = 0;
+  std::vector<uint8_t> bytes_;
+};
+
+std::vector<uint8_t> buildDescriptors() {
+  constexpr uint8_t kCameraTerminal = 1;
+  constexpr uint8_t kProcessingUnit = 2;
+  constexpr uint8_t kOutputTerminal = 3;
+
+  DescriptorBuilder b;
+
+  b.begin(CS_INTERFACE, VC_HEADER);
+  b.u16(0x0100);
+  size_t totalLength = b.bytes().size();
+  b.u16(0);
+  b.u32(48000000);
+  b.u8(1);
+  b.u8(1);
+  b.end();
+
+  b.begin(CS_INTERFACE, VC_INPUT_TERMINAL);
+  b.u8(kCameraTerminal);
+  b.u16(ITT_CAMERA);
+  b.u8(0);
+  b.u8(0);
+  b.u16(0);
+  b.u16(0);
+  b.u16(0);
+  b.u8(3);
+  b.u8(0x2a);
+  b.u8(0x00);
+  b.u8(0x00);
+  b.end();
+
+  b.begin(CS_INTERFACE, VC_PROCESSING_UNIT);
+  b.u8(kProcessingUnit);
+  b.u8(kCameraTerminal);
+  b.u16(16384);
+  b.u8(2);
+  b.u8(0x5b);
+  b.u8(0x17);
+  b.u8(0);
+  b.end();
+
+  b.logitechExtensionUnit(OrbitEmulator::kMotorUnit, LXU_MOTOR_GUID, 3,
+                          kProcessingUnit, 0x07);
+  b.logitechExtensionUnit(OrbitEmulator::kHwControlUnit, LXU_HW_CONTROL_GUID,
+                          1, kProcessingUnit, 0x01);
+
+  b.begin(CS_INTERFACE, VC_OUTPUT_TERMINAL);
+  b.u8(kOutputTerminal);
+  b.u16(0x0101);
+  b.u8(0);
+  b.u8(kProcessingUnit);
+  b.u8(0);
+  b.end();
+
+  std::vector<uint8_t> bytes = b.bytes();
+  // wTotalLength covers the class specific interface descriptors.
+  bytes[totalLength] = bytes.size() & 0xff;
+  bytes[totalLength + 1] = bytes.size() >> 8;
+
+  // The status interrupt endpoint.
+  DescriptorBuilder endpoint;
+  endpoint.endpoint(0x87, 0x03, 16, 8);
+  endpoint.begin(CS_ENDPOINT, 0x03);
+  endpoint.u16(16);
+  endpoint.end();
+  std::vector<uint8_t> tail = endpoint.bytes();
+  bytes.insert(bytes.end(), tail.begin(), tail.end());
+  return bytes;
+}
+
+}
+
+constexpr uint8_t OrbitEmulator::kMotorUnit;
+constexpr uint8_t OrbitEmulator::kHwControlUnit;
+uint32_t OrbitEmulator::location(size_t index) {
+  if (index / 225 >= 0xfe) {
+    throw std::runtime_error("too many emulated cameras");
+  }
+  uint32_t controller = 0xfe - index / 225;
+  uint32_t hub = index % 15 + 1;
+  uint32_t port = index % 225 / 15 + 1;
+  return controller << 24 | hub << 20 | port << 16;
+}
+
+const std::vector<uint8_t>& OrbitEmulator::descriptors() {
+  static const std::vector<uint8_t> descriptors = buildDescriptors();
+  return descriptors;
+}
+
+OrbitEmulator::OrbitEmulator(const MechanismModel& model,
+                             std::function<int64_t()> clock)
+  : clock_(clock)
+  , mechanism_(model)
+{}
+
+uint32_t OrbitEmulator::controlRequest(uint8_t request,
+                                       uint8_t unitId,
+                                       uint8_t selector,
+                                       uint8_t* data,
+                                       uint16_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  status_.requests++;
+  try {
+    switch (unitId) {
+    case kMotorUnit:
+      return motorRequest(request, selector, data, length);
+    case kHwControlUnit:
+      return hwControlRequest(request, selector, data, length);
+    default:
+      stall();
+    }
+  } catch (const std::exception&) {
+    status_.stalls++;
+    throw;
+  }
+  return 0;
+}
+
+uint32_t OrbitEmulator::motorRequest(uint8_t request, uint8_t selector,
+                                     uint8_t* data, uint16_t length) {
+  switch (selector) {
+  case LXU_MOTOR_PANTILT_RELATIVE_CONTROL:
+    if (request == UVC_GET_INFO && length == 1) {
+      data[0] = kInfoSet;
+      return 1;
+    }
+    if (request == UVC_SET_CUR && length == sizeof(LogitechMotorRequest)) {
+      Move move;
+      decodePanTiltRelative(data, &move.left, &move.up);
+      status_.panSteps += move.left;
+      status_.tiltSteps += move.up;
+      status_.moves++;
+      mechanism_.move(move, clock_());
+      return length;
+    }
+    break;
+  case LXU_MOTOR_PANTILT_RESET_CONTROL:
+    if (request == UVC_GET_INFO && length == 1) {
+      data[0] = kInfoSet;
+      return 1;
+    }
+    if (request == UVC_SET_CUR && length == 1) {
+      bool pan = data[0] & LXU_MOTOR_PANTILT_RESET_CONTROL_PAN;
+      bool tilt = data[0] & LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+      if (pan) {
+        status_.panSteps = 0;
+      }
+      if (tilt) {
+        status_.tiltSteps = 0;
+      }
+      status_.resets++;
+      mechanism_.reset(pan, tilt, clock_());
+      return length;
+    }
+    break;
+  }
+  stall();
+  return 0;
+}
+
+uint32_t OrbitEmulator::hwControlRequest(uint8_t request, uint8_t selector,
+                                         uint8_t* data, uint16_t length) {
+  if (selector != LXU_HW_CONTROL_LED1 || length == 0) {
+    stall();
+  }
+  switch (request) {
+  case UVC_GET_INFO:
+    if (length == 1) {
+      data[0] = kInfoGetSet;
+      return 1;
+    }
+    break;
+  case UVC_GET_CUR:
+    if (length == sizeof(LogitechLedRequest)) {
+      data[0] = status_.ledMode;
+      data[1] = status_.ledFrequency >> 8;
+      data[2] = status_.ledFrequency & 0xff;
+      return length;
+    }
+    break;
+  case UVC_SET_CUR:
+    if (length == sizeof(LogitechLedRequest)) {
+      // The frequency is big endian.
+      status_.ledMode = data[0];
+      status_.ledFrequency = static_cast<uint16_t>((data[1] << 8) | data[2]);
+      return length;
+    }
+    break;
+  }
+  stall();
+  return 0;
+}
+
+OrbitEmulator::Status OrbitEmulator::status() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Status status = status_;
+  int64_t now = clock_();
+  // A copy, so buffered moves can be started without changing the
+  // mechanism.
+  Mechanism mechanism(mechanism_);
+  mechanism.advance(now);
+  status.pan = mechanism.pan(now);
+  status.tilt = mechanism.tilt(now);
+  status.dropped = mechanism.dropped();
+  return status;
+}
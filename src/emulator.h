@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "mechanism.h"
+#include "transport.h"
+
+// An emulated Orbit AF, for exercising everything above the USB
+// transfers without a camera.  It has the same kinds of video control
+// descriptors as the camera, including the Logitech vendor extension
+// units, and handles the requests orbitctl sends.  Requests the
+// camera wouldn't accept fail the way a stalled pipe does.  Moves and
+// resets drive a Mechanism, on whatever clock the emulator is given.
+
+class OrbitEmulator : public Transport {
+public:
+  static constexpr uint8_t kMotorUnit = 9;
+  static constexpr uint8_t kHwControlUnit = 10;
+  // Where the index'th emulated camera is, counting from 0.  Each
+  // controller, from 0xfe down, has 15 hubs with 15 cameras each, and
+  // cameras go round the hubs in turn, so they spread out like real
+  // ones would.  Throws past the last controller.
+  static uint32_t location(size_t index);
+
+  // The class specific descriptors associated with the video control
+  // interface, as FindNextAssociatedDescriptor would return them.
+  static const std::vector<uint8_t>& descriptors();
+
+  explicit OrbitEmulator(
+    const MechanismModel& model = MechanismModel(),
+    std::function<int64_t()> clock = wallClockUsec);
+
+  uint32_t controlRequest(uint8_t request,
+                          uint8_t unitId,
+                          uint8_t selector,
+                          uint8_t* data,
+                          uint16_t length) override;
+
+  // What the camera has been told to do.
+  struct Status {
+    uint64_t requests = 0;
+    uint64_t stalls = 0;
+    uint64_t moves = 0;
+    uint64_t resets = 0;
+    // Net steps commanded since the last reset of each axis.
+    int panSteps = 0;
+    int tiltSteps = 0;
+    uint8_t ledMode = 0;
+    uint16_t ledFrequency = 0;
+    // Where the mechanism really is, and moves the firmware dropped.
+    double pan = 0;
+    double tilt = 0;
+    uint64_t dropped = 0;
+  };
+
+  Status status() const;
+
+private:
+  uint32_t motorRequest(uint8_t request, uint8_t selector, uint8_t* data,
+                        uint16_t length);
+  uint32_t hwControlRequest(uint8_t request, uint8_t selector, uint8_t* data,
+                            uint16_t length);
+
+  // The camera handles one control request at a time.
+  mutable std::mutex mutex_;
+  Status status_;
+  std::function<int64_t()> clock_;
+  Mechanism mechanism_;
+};
@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "eptz.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Weights are 8 bit fixed point.
+constexpr int kWeightBits = 8;
+constexpr int kWeightOne = 1 << kWeightBits;
+
+// Where each output pixel along one axis comes from: the lower of the
+// two source pixels, and the weight of the upper one.
+void samplePositions(double start, double scale, int count, int size,
+                     std::vector<int>& index, std::vector<uint32_t>& weight) {
+  index.resize(count);
+  weight.resize(count);
+  for (int i = 0; i < count; i++) {
+    double s = std::max(0.0, std::min<double>(size - 1, start + i * scale));
+    int lower = std::min(static_cast<int>(s), size - 2);
+    index[i] = lower;
+    weight[i] = static_cast<uint32_t>(lround((s - lower) * kWeightOne));
+  }
+}
+
+double clamp(double v, double limit) {
+  return std::max(-limit, std::min(limit, v));
+}
+
+int steps(double v) {
+  if (fabs(v) < 1) {
+    return 0;
+  }
+  return static_cast<int>(lround(clamp(v, kMaxStepsPerMove)));
+}
+
+}
+
+Image resample(const Image& src, double x, double y, double scale,
+               int outWidth, int outHeight) {
+  if (src.width < 2 || src.height < 2) {
+    throw std::runtime_error("image is too small to resample");
+  }
+
+  std::vector<int> cols, rows;
+  std::vector<uint32_t> colWeights, rowWeights;
+  samplePositions(x, scale, outWidth, src.width, cols, colWeights);
+  samplePositions(y, scale, outHeight, src.height, rows, rowWeights);
+
+  Image out;
+  out.width = outWidth;
+  out.height = outHeight;
+  out.luma.resize(outWidth * outHeight);
+
+  // Each output row blends two source rows.  Resampling those
+  // horizontally first leaves a vertical blend of two contiguous
+  // arrays, which the compiler can vectorize.
+  std::vector<uint32_t> top(outWidth), bottom(outWidth);
+  auto horizontal = [&](int row, std::vector<uint32_t>& dest) {
+    const uint8_t* p = &src.luma[row * src.width];
+    for (int i = 0; i < outWidth; i++) {
+      uint32_t w = colWeights[i];
+      dest[i] = p[cols[i]] * (kWeightOne - w) + p[cols[i] + 1] * w;
+    }
+  };
+
+  int topRow = -1;
+  for (int j = 0; j < outHeight; j++) {
+    if (rows[j] != topRow) {
+      if (topRow >= 0 && rows[j] == topRow + 1) {
+        top.swap(bottom);
+      } else {
+        horizontal(rows[j], top);
+      }
+      horizontal(rows[j] + 1, bottom);
+      topRow = rows[j];
+    }
+    uint32_t w = rowWeights[j];
+    uint8_t* dest = &out.luma[j * outWidth];
+    for (int i = 0; i < outWidth; i++) {
+      dest[i] = static_cast<uint8_t>(
+        (top[i] * (kWeightOne - w) + bottom[i] * w +
+         (1 << (2 * kWeightBits - 1))) >> (2 * kWeightBits));
+    }
+  }
+
+  return out;
+}
+
+HybridPanTilt::HybridPanTilt(double panPixelsPerStep, double tiltPixelsPerStep,
+                             double marginX, double marginY,
+                             const LatencyModel& latency)
+  : motion_(panPixelsPerStep, tiltPixelsPerStep, latency)
+  , marginX_(marginX)
+  , marginY_(marginY)
+{}
+
+void HybridPanTilt::reframe(double dx, double dy) {
+  viewX_ += dx;
+  viewY_ += dy;
+}
+
+bool HybridPanTilt::update(int64_t nowUsec, Move* move) {
+  if (motion_.isMoving(nowUsec)) {
+    return false;
+  }
+
+  // Moving the image content by -view puts the view in the middle of
+  // the frame.  Anything less than a step is left to the window.
+  double finalX, finalY;
+  motion_.finalOffset(&finalX, &finalY);
+  Move m;
+  m.left = steps(-(viewX_ + finalX) / motion_.panPixelsPerStep());
+  m.up = steps(-(viewY_ + finalY) / motion_.tiltPixelsPerStep());
+  if (m.left == 0 && m.up == 0) {
+    return false;
+  }
+
+  motion_.add(nowUsec, m);
+  *move = m;
+  return true;
+}
+
+void HybridPanTilt::window(int64_t nowUsec, double* x, double* y) const {
+  // The window makes up whatever the mechanism hasn't done yet.  If
+  // that's more than the margin, the view lags until it catches up.
+  double offsetX, offsetY;
+  motion_.offsetAt(nowUsec, &offsetX, &offsetY);
+  *x = clamp(viewX_ + offsetX, marginX_);
+  *y = clamp(viewY_ + offsetY, marginY_);
+}
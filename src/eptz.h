@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "odometry.h"
+#include "position.h"
+#include "tracking.h"
+
+// Electronic pan/tilt shows a window of a larger frame, which can be
+// moved instantly.  Combined with the mechanism, small reframes show
+// up right away, and the window drifts back to the middle of the
+// frame as the camera catches up.
+
+// Bilinear resampling of the part of src starting at (x, y), with
+// scale source pixels per output pixel.  Parts of the window outside
+// of src repeat the edge.
+Image resample(const Image& src, double x, double y, double scale,
+               int outWidth, int outHeight);
+
+class HybridPanTilt {
+public:
+  // margin is how far the middle of the window can be from the middle
+  // of the frame, in pixels.
+  HybridPanTilt(double panPixelsPerStep, double tiltPixelsPerStep,
+                double marginX, double marginY, const LatencyModel& latency);
+
+  // Moves the view by dx, dy pixels, positive right and down.
+  void reframe(double dx, double dy);
+
+  // Returns true with *move set if a move should be sent at nowUsec.
+  bool update(int64_t nowUsec, Move* move);
+
+  // Where the middle of the window should be at nowUsec, relative to
+  // the middle of the frame.
+  void window(int64_t nowUsec, double* x, double* y) const;
+
+private:
+  MotionModel motion_;
+  double marginX_;
+  double marginY_;
+  // Where the view should be, relative to the middle of the frame
+  // with the camera at rest.
+  double viewX_ = 0;
+  double viewY_ = 0;
+};
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "faults.h"
+
+#include <stdlib.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// The same as a real transfer.
+constexpr int64_t kTimeoutUsec = 1000000;
+
+bool parseRate(const std::string& value, double* rate) {
+  char* end;
+  *rate = strtod(value.c_str(), &end);
+  return !value.empty() && *end == '\0' && *rate >= 0 && *rate <= 1;
+}
+
+bool parseMs(const std::string& value, int64_t* usec) {
+  char* end;
+  double ms = strtod(value.c_str(), &end);
+  *usec = static_cast<int64_t>(ms * 1000);
+  return !value.empty() && *end == '\0' && ms >= 0;
+}
+
+}
+
+bool parseFaults(const std::string& spec, FaultConfig* config) {
+  std::istringstream in(spec);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    size_t equals = item.find('=');
+    if (equals == std::string::npos) {
+      return false;
+    }
+    std::string key = item.substr(0, equals);
+    std::string value = item.substr(equals + 1);
+    bool ok;
+    if (key == "seed") {
+      char* end;
+      config->seed = strtoull(value.c_str(), &end, 10);
+      ok = !value.empty() && *end == '\0';
+    } else if (key == "latency") {
+      ok = parseMs(value, &config->meanLatencyUsec);
+    } else if (key == "tail") {
+      ok = parseRate(value, &config->tailRate);
+    } else if (key == "tail_ms") {
+      ok = parseMs(value, &config->meanTailUsec);
+    } else if (key == "stall") {
+      ok = parseRate(value, &config->stallRate);
+    } else if (key == "timeout") {
+      ok = parseRate(value, &config->timeoutRate);
+    } else if (key == "short") {
+      ok = parseRate(value, &config->shortRate);
+    } else if (key == "disconnect") {
+      ok = parseRate(value, &config->disconnectRate);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+FaultStats& FaultStats::operator+=(const FaultStats& other) {
+  requests += other.requests;
+  delayedUsec += other.delayedUsec;
+  tails += other.tails;
+  stalls += other.stalls;
+  timeouts += other.timeouts;
+  shorts += other.shorts;
+  disconnected += other.disconnected;
+  return *this;
+}
+
+FaultyTransport::FaultyTransport(std::unique_ptr<Transport> inner,
+                                 const FaultConfig& config,
+                                 std::function<void(int64_t usec)> delay)
+  : inner_(std::move(inner))
+  , config_(config)
+  , delay_(delay)
+  , random_(config.seed)
+{}
+
+bool FaultyTransport::chance(double rate) {
+  return rate > 0 && std::uniform_real_distribution<double>()(random_) < rate;
+}
+
+int64_t FaultyTransport::exponentialUsec(int64_t meanUsec) {
+  if (meanUsec <= 0) {
+    return 0;
+  }
+  std::exponential_distribution<double> distribution(1.0 / meanUsec);
+  return static_cast<int64_t>(distribution(random_));
+}
+
+uint32_t FaultyTransport::controlRequest(uint8_t request,
+                                         uint8_t unitId,
+                                         uint8_t selector,
+                                         uint8_t* data,
+                                         uint16_t length) {
+  // Decide everything up front, so the choices don't depend on how
+  // long the inner transport takes.
+  int64_t delayUsec;
+  bool stall, timeout, shortTransfer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.requests++;
+    if (!disconnected_ && chance(config_.disconnectRate)) {
+      disconnected_ = true;
+    }
+    if (disconnected_) {
+      stats_.disconnected++;
+      throw std::runtime_error("ControlRequest failed: device disconnected");
+    }
+    delayUsec = exponentialUsec(config_.meanLatencyUsec);
+    if (chance(config_.tailRate)) {
+      delayUsec += exponentialUsec(config_.meanTailUsec);
+      stats_.tails++;
+    }
+    stall = chance(config_.stallRate);
+    timeout = !stall && chance(config_.timeoutRate);
+    shortTransfer = !stall && !timeout && length > 0 &&
+      chance(config_.shortRate);
+    if (timeout) {
+      delayUsec += kTimeoutUsec;
+    }
+    stats_.delayedUsec += delayUsec;
+    stats_.stalls += stall;
+    stats_.timeouts += timeout;
+    stats_.shorts += shortTransfer;
+  }
+
+  if (delayUsec > 0) {
+    delay_(delayUsec);
+  }
+  if (stall) {
+    throw std::runtime_error("ControlRequest failed: pipe stalled");
+  }
+  if (timeout) {
+    throw std::runtime_error("ControlRequest failed: timed out");
+  }
+  uint32_t done = inner_->controlRequest(request, unitId, selector, data,
+                                         length);
+  if (shortTransfer && done > 0) {
+    done--;
+  }
+  return done;
+}
+
+FaultStats FaultyTransport::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "transport.h"
+
+// Wraps a Transport and makes it misbehave, to see how everything
+// above it copes with slow or failing cameras.  Each request can be
+// delayed, and can fail in one of the ways real transfers do.  All
+// the choices come from a seeded generator, so a run can be repeated.
+
+struct FaultConfig {
+  uint64_t seed = 1;
+  // Each request is delayed by an exponentially distributed amount
+  // with this mean, and a few are delayed by a lot more.
+  int64_t meanLatencyUsec = 0;
+  double tailRate = 0;
+  int64_t meanTailUsec = 0;
+  // The chances of each kind of failure, per request.  A stall fails
+  // right away, a timeout fails after the control timeout, a short
+  // transfer moves one byte less than asked, and after a disconnect
+  // every request fails.
+  double stallRate = 0;
+  double timeoutRate = 0;
+  double shortRate = 0;
+  double disconnectRate = 0;
+};
+
+// The format is comma separated key=value pairs, with times in
+// milliseconds, like "latency=2,tail=0.01,tail_ms=300,stall=0.001".
+// The keys are seed, latency, tail, tail_ms, stall, timeout, short and
+// disconnect.
+bool parseFaults(const std::string& spec, FaultConfig* config);
+
+struct FaultStats {
+  uint64_t requests = 0;
+  uint64_t delayedUsec = 0;
+  uint64_t tails = 0;
+  uint64_t stalls = 0;
+  uint64_t timeouts = 0;
+  uint64_t shorts = 0;
+  uint64_t disconnected = 0;
+
+  FaultStats& operator+=(const FaultStats& other);
+};
+
+class FaultyTransport : public Transport {
+public:
+  // delay is how time passes, which is usleep unless this is part of
+  // a simulation.
+  FaultyTransport(std::unique_ptr<Transport> inner, const FaultConfig& config,
+                  std::function<void(int64_t usec)> delay);
+
+  uint32_t controlRequest(uint8_t request,
+                          uint8_t unitId,
+                          uint8_t selector,
+                          uint8_t* data,
+                          uint16_t length) override;
+
+  FaultStats stats() const;
+
+private:
+  bool chance(double rate);
+  int64_t exponentialUsec(int64_t meanUsec);
+
+  std::unique_ptr<Transport> inner_;
+  FaultConfig config_;
+  std::function<void(int64_t usec)> delay_;
+  mutable std::mutex mutex_;
+  std::mt19937_64 random_;
+  bool disconnected_ = false;
+  FaultStats stats_;
+};
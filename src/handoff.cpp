@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "socket.h"
+
+namespace {
+
+// Descriptors are sent a batch at a time, each batch riding on one
+// byte of the stream.
+constexpr size_t kFdsPerMessage = 64;
+
+void writeAll(int fd, const void* data, size_t length) {
+  const char* p = static_cast<const char*>(data);
+  while (length > 0) {
+    ssize_t n = ::write(fd, p, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    sysCheck(n, "handoff write");
+    p += n;
+    length -= n;
+  }
+}
+
+void readAll(int fd, void* data, size_t length) {
+  char* p = static_cast<char*>(data);
+  while (length > 0) {
+    ssize_t n = ::read(fd, p, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    sysCheck(n, "handoff read");
+    if (n == 0) {
+      throw std::runtime_error("handoff ended early");
+    }
+    p += n;
+    length -= n;
+  }
+}
+
+void sendFds(int channel, const int* fds, size_t count) {
+  char byte = 0;
+  iovec iov{&byte, 1};
+  char control[CMSG_SPACE(kFdsPerMessage * sizeof(int))];
+  memset(control, 0, sizeof(control));
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+  cmsghdr* header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(count * sizeof(int));
+  memcpy(CMSG_DATA(header), fds, count * sizeof(int));
+  ssize_t n;
+  do {
+    n = sendmsg(channel, &message, 0);
+  } while (n < 0 && errno == EINTR);
+  sysCheck(n, "sendmsg");
+}
+
+void receiveFds(int channel, int* fds, size_t count) {
+  char byte;
+  iovec iov{&byte, 1};
+  char control[CMSG_SPACE(kFdsPerMessage * sizeof(int))];
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(channel, &message, 0);
+  } while (n < 0 && errno == EINTR);
+  sysCheck(n, "recvmsg");
+  cmsghdr* header = CMSG_FIRSTHDR(&message);
+  if (n != 1 || (message.msg_flags & MSG_CTRUNC) || !header ||
+      header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(count * sizeof(int))) {
+    throw std::runtime_error("handoff descriptors went missing");
+  }
+  memcpy(fds, CMSG_DATA(header), count * sizeof(int));
+}
+
+std::string hex(const std::string& bytes) {
+  std::string out;
+  char buf[3];
+  for (unsigned char c : bytes) {
+    snprintf(buf, sizeof(buf), "%02x", c);
+    out += buf;
+  }
+  return out;
+}
+
+std::string unhex(const std::string& text) {
+  std::string out;
+  for (size_t i = 0; i + 1 < text.size(); i += 2) {
+    out += static_cast<char>(strtoul(text.substr(i, 2).c_str(), nullptr, 16));
+  }
+  return out;
+}
+
+// The cameras and connections as text, in the same spirit as the
+// state files.  Each camera's state is written just as its file would
+// be, ending with a line of its own.
+std::string formatHandoff(const Handoff& handoff) {
+  std::ostringstream out;
+  for (const CameraSnapshot& camera : handoff.cameras) {
+    out << "camera " << camera.locationId << " " << camera.nextMoveUsec
+        << "\n";
+    for (const Move& move : camera.moves) {
+      out << "move " << move.left << " " << move.up << "\n";
+    }
+    writePositionState(out, camera.state);
+    out << "end\n";
+  }
+  for (const auto& connection : handoff.connections) {
+    out << "connection " << hex(connection.second) << "\n";
+  }
+  return out.str();
+}
+
+void parseHandoff(const std::string& text, Handoff* handoff) {
+  std::istringstream in(text);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream words(line);
+    std::string key;
+    words >> key;
+    if (key == "camera") {
+      CameraSnapshot camera;
+      if (!(words >> camera.locationId >> camera.nextMoveUsec)) {
+        throw std::runtime_error("bad handoff line: " + line);
+      }
+      std::string state;
+      while (std::getline(in, line) && line != "end") {
+        Move move;
+        std::istringstream moveWords(line);
+        if (moveWords >> key && key == "move") {
+          if (!(moveWords >> move.left >> move.up)) {
+            throw std::runtime_error("bad handoff line: " + line);
+          }
+          camera.moves.push_back(move);
+        } else {
+          state += line + "\n";
+        }
+      }
+      std::istringstream stateIn(state);
+      camera.state = readPositionState(stateIn, "handoff");
+      handoff->cameras.push_back(camera);
+    } else if (key == "connection") {
+      std::string partial;
+      words >> partial;
+      handoff->connections.emplace_back(-1, unhex(partial));
+    } else if (!key.empty()) {
+      throw std::runtime_error("bad handoff line: " + line);
+    }
+  }
+}
+
+}
+
+int spawnSuccessor(char* const argv[], pid_t* pid) {
+  int fds[2];
+  sysCheck(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair");
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  *pid = fork();
+  if (*pid < 0) {
+    int error = errno;
+    close(fds[0]);
+    close(fds[1]);
+    throw std::runtime_error(std::string("fork: ") + strerror(error));
+  }
+  if (*pid == 0) {
+    setenv("ORBITCTL_HANDOFF", std::to_string(fds[1]).c_str(), 1);
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+int handoffChannel() {
+  const char* channel = getenv("ORBITCTL_HANDOFF");
+  if (!channel) {
+    return -1;
+  }
+  int fd = atoi(channel);
+  // Anything this process starts shouldn't think it's being handed
+  // something too.
+  unsetenv("ORBITCTL_HANDOFF");
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
+
+void sendHandoff(int channel, const Handoff& handoff) {
+  std::vector<int> fds;
+  fds.push_back(handoff.listenFd);
+  for (const auto& connection : handoff.connections) {
+    fds.push_back(connection.first);
+  }
+  std::string text = formatHandoff(handoff);
+  uint32_t header[2] = {static_cast<uint32_t>(fds.size()),
+                        static_cast<uint32_t>(text.size())};
+  writeAll(channel, header, sizeof(header));
+  for (size_t i = 0; i < fds.size(); i += kFdsPerMessage) {
+    sendFds(channel, &fds[i], std::min(kFdsPerMessage, fds.size() - i));
+  }
+  writeAll(channel, text.data(), text.size());
+}
+
+Handoff receiveHandoff(int channel) {
+  uint32_t header[2];
+  readAll(channel, header, sizeof(header));
+  std::vector<int> fds(header[0]);
+  for (size_t i = 0; i < fds.size(); i += kFdsPerMessage) {
+    receiveFds(channel, &fds[i], std::min(kFdsPerMessage, fds.size() - i));
+  }
+  for (int fd : fds) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  std::string text(header[1], '\0');
+  readAll(channel, &text[0], text.size());
+
+  Handoff handoff;
+  parseHandoff(text, &handoff);
+  if (fds.size() != handoff.connections.size() + 1) {
+    throw std::runtime_error("handoff connections don't match");
+  }
+  handoff.listenFd = fds[0];
+  for (size_t i = 0; i < handoff.connections.size(); i++) {
+    handoff.connections[i].first = fds[i + 1];
+  }
+  return handoff;
+}
+
+void handoffDone(int channel) {
+  char done = 1;
+  writeAll(channel, &done, 1);
+}
+
+bool waitForSuccessor(int channel, int timeoutMs) {
+  pollfd fd{channel, POLLIN, 0};
+  int n;
+  do {
+    n = poll(&fd, 1, timeoutMs);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+  char done;
+  return ::read(channel, &done, 1) == 1 && done == 1;
+}
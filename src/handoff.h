@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "controller.h"
+
+// Upgrading a resident controller without dropping anything.  The old
+// process starts the new one with one end of a socket pair, and sends
+// it the listening socket and every client connection, along with
+// where each camera is and what it still has to do.  Clients just see
+// a short pause, and the cameras don't need to be reset.
+
+struct Handoff {
+  int listenFd = -1;
+  // Each connection, with any part of a frame already read from it.
+  std::vector<std::pair<int, std::string>> connections;
+  std::vector<CameraSnapshot> cameras;
+};
+
+// Starts argv[0] with argv, and $ORBITCTL_HANDOFF naming its end of
+// the channel, and returns this end.
+int spawnSuccessor(char* const argv[], pid_t* pid);
+// Returns the channel from $ORBITCTL_HANDOFF, or -1 if this process
+// wasn't started by spawnSuccessor.
+int handoffChannel();
+
+void sendHandoff(int channel, const Handoff& handoff);
+Handoff receiveHandoff(int channel);
+
+// The new process says when it's taken over, and the old one waits
+// for that, up to timeoutMs.  A false return means the old one should
+// carry on itself.
+void handoffDone(int channel);
+bool waitForSuccessor(int channel, int timeoutMs);
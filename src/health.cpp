@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "health.h"
+
+#include <algorithm>
+
+namespace {
+
+// One failure might be a fluke, so check again soon before deciding.
+constexpr int kFailuresBeforeRecovery = 2;
+constexpr int64_t kRecheckUsec = 1000000;
+constexpr int64_t kMaxBackoffUsec = 300000000;
+
+}
+
+HealthMonitor::HealthMonitor(size_t cameras, int64_t intervalUsec,
+                             int64_t nowUsec)
+  : intervalUsec_(intervalUsec)
+  , slots_(cameras)
+{
+  for (size_t i = 0; i < cameras; i++) {
+    slots_[i] = Slot{nowUsec + intervalUsec * static_cast<int64_t>(i) /
+                     static_cast<int64_t>(cameras),
+                     0, 0, false};
+  }
+}
+
+bool HealthMonitor::next(size_t* camera, int64_t* whenUsec) const {
+  bool found = false;
+  for (size_t i = 0; i < slots_.size(); i++) {
+    if (slots_[i].recovering) {
+      continue;
+    }
+    if (!found || slots_[i].nextUsec < *whenUsec) {
+      *camera = i;
+      *whenUsec = slots_[i].nextUsec;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool HealthMonitor::report(size_t camera, bool ok, int64_t nowUsec) {
+  Slot& slot = slots_[camera];
+  if (ok) {
+    slot.failures = 0;
+    slot.attempts = 0;
+    slot.nextUsec = nowUsec + intervalUsec_;
+    return false;
+  }
+
+  slot.failures++;
+  if (slot.failures < kFailuresBeforeRecovery) {
+    slot.nextUsec = nowUsec + std::min(kRecheckUsec, intervalUsec_);
+    return false;
+  }
+  slot.recovering = true;
+  return true;
+}
+
+void HealthMonitor::recovered(size_t camera, bool ok, int64_t nowUsec) {
+  Slot& slot = slots_[camera];
+  slot.recovering = false;
+  if (ok) {
+    slot.failures = 0;
+    slot.attempts = 0;
+    slot.nextUsec = nowUsec + intervalUsec_;
+    return;
+  }
+  // Leave failures at the threshold, so the next failed check goes
+  // straight to recovery.
+  slot.attempts++;
+  int64_t backoff = intervalUsec_ << std::min(slot.attempts, 16);
+  slot.nextUsec = nowUsec + std::min(backoff, kMaxBackoffUsec);
+}
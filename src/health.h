@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Cameras occasionally stop responding until they're reset.  This
+// decides when to check each camera with a cheap request, and when a
+// camera has failed enough checks that it needs recovering.  Doing
+// the checks and the recovery is up to the caller.
+
+class HealthMonitor {
+public:
+  // Each camera is checked once per interval, with the checks spread
+  // out evenly so they don't all land at once.
+  HealthMonitor(size_t cameras, int64_t intervalUsec, int64_t nowUsec);
+
+  // Returns false if every camera is being recovered.
+  bool next(size_t* camera, int64_t* whenUsec) const;
+
+  // Returns true if the camera needs recovering.  Until recovered()
+  // is called, it won't be checked again.
+  bool report(size_t camera, bool ok, int64_t nowUsec);
+
+  // If recovery failed, it's tried again later, backing off each time.
+  void recovered(size_t camera, bool ok, int64_t nowUsec);
+
+  bool isRecovering(size_t camera) const {
+    return slots_[camera].recovering;
+  }
+
+private:
+  struct Slot {
+    int64_t nextUsec;
+    int failures;
+    int attempts;
+    bool recovering;
+  };
+
+  int64_t intervalUsec_;
+  std::vector<Slot> slots_;
+};
@@ -0,0 +1,736 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "http.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "socket.h"
+#include "topology.h"
+
+namespace {
+
+// How often the stream looks for changes while anyone is watching.
+constexpr int64_t kStreamUsec = 1000000 / 60;
+// Requests bigger than this are refused, and viewers this far behind
+// are dropped.
+constexpr size_t kMaxRequest = 65536;
+constexpr size_t kMaxBuffered = 1 << 20;
+// Requests waiting on the controller, beyond which new ones get a 503.
+constexpr size_t kMaxOutstanding = 65536;
+
+uint32_t rotate(uint32_t v, int bits) {
+  return (v << bits) | (v >> (32 - bits));
+}
+
+// Only needed for the WebSocket handshake.
+std::string sha1(const std::string& message) {
+  uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                   0xc3d2e1f0};
+  std::string data = message;
+  uint64_t bits = static_cast<uint64_t>(message.size()) * 8;
+  data += static_cast<char>(0x80);
+  while (data.size() % 64 != 56) {
+    data += '\0';
+  }
+  for (int i = 7; i >= 0; i--) {
+    data += static_cast<char>(bits >> (i * 8));
+  }
+
+  for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const unsigned char* p =
+        reinterpret_cast<const unsigned char*>(&data[chunk + i * 4]);
+      w[i] = static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 |
+        p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t t = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::string digest;
+  for (uint32_t v : h) {
+    for (int i = 3; i >= 0; i--) {
+      digest += static_cast<char>(v >> (i * 8));
+    }
+  }
+  return digest;
+}
+
+std::string base64(const std::string& data) {
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t v = static_cast<unsigned char>(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      v |= static_cast<unsigned char>(data[i + 1]) << 8;
+    }
+    if (i + 2 < data.size()) {
+      v |= static_cast<unsigned char>(data[i + 2]);
+    }
+    out += digits[(v >> 18) & 63];
+    out += digits[(v >> 12) & 63];
+    out += i + 1 < data.size() ? digits[(v >> 6) & 63] : '=';
+    out += i + 2 < data.size() ? digits[v & 63] : '=';
+  }
+  return out;
+}
+
+std::string lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
+
+// Latency jitters, so only a change of half a millisecond, or a
+// fifth, is worth sending.
+bool latencyMoved(int then, int now) {
+  return std::abs(now - then) > std::max(5, then / 5);
+}
+
+std::string hexLocation(uint32_t locationId) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "0x%08x", locationId);
+  return buf;
+}
+
+const char* reason(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 413:
+    return "Payload Too Large";
+  case 503:
+    return "Service Unavailable";
+  }
+  return "Error";
+}
+
+std::string response(int status, const std::string& body) {
+  std::ostringstream out;
+  out << "HTTP/1.1 " << status << " " << reason(status) << "\r\n"
+      << "Content-Type: application/json\r\n"
+      << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+  return out.str();
+}
+
+std::string replyJson(uint32_t locationId, const ControlReply& reply) {
+  std::ostringstream out;
+  out << "{\"location\":\"" << hexLocation(locationId) << "\",\"ok\":"
+      << (reply.ok ? "true" : "false");
+  if (!reply.ok) {
+    // Errors are plain text, without quotes or backslashes.
+    out << ",\"error\":\""
+        << (reply.error.empty() ? "not responding" : reply.error) << "\"";
+  }
+  out << ",\"pan\":" << reply.pan << ",\"tilt\":" << reply.tilt
+      << ",\"homed\":" << (reply.homed ? "true" : "false")
+      << ",\"led\":" << reply.ledMode << "}\n";
+  return out.str();
+}
+
+// Server frames aren't masked.
+std::string webSocketFrame(uint8_t opcode, const std::string& payload) {
+  std::string frame(1, static_cast<char>(0x80 | opcode));
+  uint64_t length = payload.size();
+  if (length < 126) {
+    frame += static_cast<char>(length);
+  } else if (length < 65536) {
+    frame += static_cast<char>(126);
+    frame += static_cast<char>(length >> 8);
+    frame += static_cast<char>(length & 0xff);
+  } else {
+    frame += static_cast<char>(127);
+    for (int i = 7; i >= 0; i--) {
+      frame += static_cast<char>(length >> (i * 8));
+    }
+  }
+  return frame + payload;
+}
+
+}
+
+HttpServer::HttpServer(Controller& controller,
+                       const std::vector<CameraInfo>& cameras, uint16_t port)
+  : controller_(controller)
+  , cameras_(cameras)
+  , results_(kMaxOutstanding)
+  , polled_(cameras.size())
+  , current_(cameras.size())
+  , sent_(cameras.size())
+  , polling_(cameras.size())
+{
+  for (size_t i = 0; i < cameras.size(); i++) {
+    index_[cameras[i].locationId] = i;
+  }
+
+  sockaddr_in in;
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(port);
+  in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+  sysCheck(listenFd_, "socket");
+  int on = 1;
+  setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(listenFd_, reinterpret_cast<sockaddr*>(&in), sizeof(in)) < 0) {
+    int error = errno;
+    close(listenFd_);
+    throw std::runtime_error("binding port " + std::to_string(port) + ": " +
+                             strerror(error));
+  }
+  sysCheck(listen(listenFd_, 128), "listen");
+  setNonBlocking(listenFd_);
+  sysCheck(pipe(wakeFds_), "pipe");
+  setNonBlocking(wakeFds_[0]);
+  setNonBlocking(wakeFds_[1]);
+}
+
+HttpServer::~HttpServer() {
+  for (std::shared_ptr<Connection>& connection : connections_) {
+    close(connection->fd);
+  }
+  close(listenFd_);
+  close(wakeFds_[0]);
+  close(wakeFds_[1]);
+}
+
+void HttpServer::stop() {
+  stopping_ = true;
+  wake();
+}
+
+void HttpServer::wake() {
+  if (!wakePending_.exchange(true)) {
+    char c = 0;
+    ::write(wakeFds_[1], &c, 1);
+  }
+}
+
+void HttpServer::run() {
+  std::vector<pollfd> fds;
+  while (!stopping_) {
+    fds.clear();
+    fds.push_back(pollfd{listenFd_, POLLIN, 0});
+    fds.push_back(pollfd{wakeFds_[0], POLLIN, 0});
+    for (std::shared_ptr<Connection>& connection : connections_) {
+      short events = POLLIN;
+      if (!connection->out.empty()) {
+        events |= POLLOUT;
+      }
+      fds.push_back(pollfd{connection->fd, events, 0});
+    }
+
+    // Nobody watching means nothing to look for.
+    int timeoutMs = -1;
+    if (viewers_ > 0) {
+      int64_t wait = nextPollUsec_ - wallClockUsec();
+      timeoutMs = static_cast<int>(std::max<int64_t>(0, wait + 999) / 1000);
+    }
+    if (::poll(fds.data(), fds.size(), timeoutMs) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sysCheck(-1, "poll");
+    }
+
+    if (fds[1].revents) {
+      char buf[64];
+      while (::read(wakeFds_[0], buf, sizeof(buf)) > 0) {
+      }
+      wakePending_ = false;
+    }
+    Result result;
+    while (results_.pop(&result)) {
+      finish(result);
+    }
+    collectPolls();
+    int64_t now = wallClockUsec();
+    if (viewers_ > 0 && now >= nextPollUsec_) {
+      broadcast();
+      poll(now);
+    }
+
+    for (size_t i = connections_.size(); i-- > 0;) {
+      std::shared_ptr<Connection> connection = connections_[i];
+      bool ok = true;
+      if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ok = read(connection);
+      }
+      if (ok) {
+        ok = write(*connection);
+      }
+      if (!ok) {
+        if (connection->webSocket) {
+          viewers_--;
+        }
+        close(connection->fd);
+        connections_.erase(connections_.begin() + i);
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      accept();
+    }
+  }
+}
+
+void HttpServer::accept() {
+  for (;;) {
+    int fd = ::accept(listenFd_, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    setNonBlocking(fd);
+    noSigPipe(fd);
+    connections_.push_back(std::make_shared<Connection>(fd));
+  }
+}
+
+bool HttpServer::read(const std::shared_ptr<Connection>& connection) {
+  Connection& c = *connection;
+  char buf[4096];
+  ssize_t n = ::read(c.fd, buf, sizeof(buf));
+  if (n == 0) {
+    return false;
+  }
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR;
+  }
+  c.in.append(buf, n);
+  if (c.webSocket) {
+    frames(c);
+  } else {
+    request(connection);
+  }
+  return c.in.size() <= kMaxRequest;
+}
+
+bool HttpServer::write(Connection& c) {
+  if (!c.out.empty()) {
+    ssize_t n = ::send(c.fd, c.out.data(), c.out.size(), kSendFlags);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    c.out.erase(0, n);
+  }
+  if (c.webSocket && c.out.size() > kMaxBuffered) {
+    return false;
+  }
+  return !(c.closing && c.out.empty() && !c.waiting);
+}
+
+void HttpServer::request(const std::shared_ptr<Connection>& connection) {
+  Connection& c = *connection;
+  while (!c.waiting && !c.webSocket && !c.closing) {
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return;
+    }
+    std::istringstream head(c.in.substr(0, end));
+    std::string line, method, path;
+    std::getline(head, line);
+    std::istringstream(line) >> method >> path;
+    std::map<std::string, std::string> headers;
+    while (std::getline(head, line)) {
+      size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      size_t start = line.find_first_not_of(" \t", colon + 1);
+      size_t stop = line.find_last_not_of(" \t\r");
+      headers[lower(line.substr(0, colon))] =
+        start == std::string::npos ? "" : line.substr(start, stop - start + 1);
+    }
+
+    size_t length = atol(headers["content-length"].c_str());
+    if (length > kMaxRequest) {
+      respond(c, 413, "{\"error\":\"too big\"}\n");
+      c.closing = true;
+      return;
+    }
+    if (c.in.size() < end + 4 + length) {
+      return;
+    }
+    std::string body = c.in.substr(end + 4, length);
+    c.in.erase(0, end + 4 + length);
+    if (lower(headers["connection"]) == "close") {
+      c.closing = true;
+    }
+    route(connection, method, path, headers, body);
+  }
+}
+
+void HttpServer::route(const std::shared_ptr<Connection>& connection,
+                       const std::string& method, const std::string& path,
+                       const std::map<std::string, std::string>& headers,
+                       const std::string& body) {
+  Connection& c = *connection;
+  auto header = [&headers](const char* name) {
+    auto it = headers.find(name);
+    return it == headers.end() ? std::string() : it->second;
+  };
+
+  if (path == "/stream") {
+    std::string key = header("sec-websocket-key");
+    if (method != "GET" || lower(header("upgrade")) != "websocket" ||
+        key.empty()) {
+      respond(c, 400, "{\"error\":\"not a WebSocket request\"}\n");
+      return;
+    }
+    c.out += "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: " +
+      base64(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC11B65")) +
+      "\r\n\r\n";
+    c.webSocket = true;
+    if (viewers_++ == 0) {
+      nextPollUsec_ = wallClockUsec();
+    }
+    // A new viewer starts with everything the others have been sent,
+    // so the next delta applies to it too.
+    std::string snapshot = changes(sent_,
+                                   std::vector<State>(cameras_.size()));
+    c.out += webSocketFrame(0x1, "{\"cameras\":{" + snapshot + "}}");
+    frames(c);
+    return;
+  }
+
+  if (path == "/cameras") {
+    if (method != "GET") {
+      respond(c, 405, "{\"error\":\"GET only\"}\n");
+      return;
+    }
+    std::string body = "[";
+    for (size_t i = 0; i < cameras_.size(); i++) {
+      body += (i ? ",\n" : "") + describe(i);
+    }
+    respond(c, 200, body + "]\n");
+    return;
+  }
+
+  const std::string prefix = "/cameras/";
+  if (path.compare(0, prefix.size(), prefix) == 0) {
+    uint32_t locationId;
+    if (!parseLocation(path.substr(prefix.size()), &locationId) ||
+        !index_.count(locationId)) {
+      respond(c, 404, "{\"error\":\"no such camera\"}\n");
+      return;
+    }
+    ControlCommand command{ControlCommand::kPosition, locationId, 0, 0};
+    if (method == "POST") {
+      if (!parseControlAction(body, &command)) {
+        respond(c, 400, "{\"error\":\"bad command\"}\n");
+        return;
+      }
+    } else if (method != "GET") {
+      respond(c, 405, "{\"error\":\"GET or POST only\"}\n");
+      return;
+    }
+    this->command(connection, command);
+    return;
+  }
+
+  respond(c, 404, "{\"error\":\"not found\"}\n");
+}
+
+void HttpServer::command(const std::shared_ptr<Connection>& connection,
+                         const ControlCommand& command) {
+  if (outstanding_ >= kMaxOutstanding) {
+    respond(*connection, 503, "{\"error\":\"too busy\"}\n");
+    return;
+  }
+  HttpServer* server = this;
+  size_t camera = index_[command.locationId];
+  int64_t start = wallClockUsec();
+  connection->waiting = true;
+  outstanding_++;
+  bool ok = controller_.submit(
+    command, [server, connection, camera, start](const ControlReply& r) {
+      Result result{connection,
+                    response(r.ok ? 200 : 400,
+                             replyJson(server->cameras_[camera].locationId,
+                                       r)),
+                    camera, r, wallClockUsec() - start};
+      // There's always room, since outstanding_ is bounded by capacity.
+      server->results_.push(result);
+      server->wake();
+    });
+  if (!ok) {
+    connection->waiting = false;
+    outstanding_--;
+    respond(*connection, 503, "{\"error\":\"too busy\"}\n");
+  }
+}
+
+void HttpServer::respond(Connection& connection, int status,
+                         const std::string& body) {
+  connection.out += response(status, body);
+}
+
+void HttpServer::finish(const Result& result) {
+  outstanding_--;
+  update(result.camera, result.reply, result.latencyUsec);
+  Connection& c = *result.connection;
+  c.out += result.response;
+  c.waiting = false;
+  request(result.connection);
+}
+
+void HttpServer::update(size_t camera, const ControlReply& reply,
+                        int64_t latencyUsec) {
+  State& state = current_[camera];
+  state.known = true;
+  state.pan = reply.pan;
+  state.tilt = reply.tilt;
+  state.homed = reply.homed;
+  state.ledMode = reply.ledMode;
+  state.latency = static_cast<int>((latencyUsec + 50) / 100);
+}
+
+void HttpServer::collectPolls() {
+  std::lock_guard<std::mutex> lock(polledMutex_);
+  for (size_t i = 0; i < polled_.size(); i++) {
+    if (polled_[i].fresh) {
+      polled_[i].fresh = false;
+      polling_[i] = false;
+      update(i, polled_[i].reply, polled_[i].latencyUsec);
+    }
+  }
+}
+
+// Clients send masked frames.  Only closes and pings need answering.
+void HttpServer::frames(Connection& c) {
+  for (;;) {
+    if (c.in.size() < 2) {
+      return;
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(
+      c.in.data());
+    uint8_t opcode = p[0] & 0x0f;
+    bool masked = p[1] & 0x80;
+    uint64_t length = p[1] & 0x7f;
+    size_t header = 2;
+    if (length == 126) {
+      if (c.in.size() < 4) {
+        return;
+      }
+      length = p[2] << 8 | p[3];
+      header = 4;
+    } else if (length == 127) {
+      if (c.in.size() < 10) {
+        return;
+      }
+      length = 0;
+      for (int i = 0; i < 8; i++) {
+        length = length << 8 | p[2 + i];
+      }
+      header = 10;
+    }
+    if (length > kMaxRequest) {
+      c.closing = true;
+      c.in.clear();
+      return;
+    }
+    size_t maskAt = header;
+    if (masked) {
+      header += 4;
+    }
+    if (c.in.size() < header + length) {
+      return;
+    }
+    std::string payload = c.in.substr(header, length);
+    if (masked) {
+      for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] ^= p[maskAt + i % 4];
+      }
+    }
+    c.in.erase(0, header + length);
+
+    if (opcode == 0x8) {
+      c.out += webSocketFrame(0x8, payload.substr(0, 2));
+      c.closing = true;
+      c.in.clear();
+      return;
+    }
+    if (opcode == 0x9) {
+      c.out += webSocketFrame(0xa, payload);
+    }
+  }
+}
+
+void HttpServer::poll(int64_t nowUsec) {
+  for (size_t i = 0; i < cameras_.size(); i++) {
+    if (polling_[i]) {
+      continue;
+    }
+    HttpServer* server = this;
+    polling_[i] = true;
+    ControlCommand command{ControlCommand::kPosition,
+                           cameras_[i].locationId, 0, 0};
+    int64_t start = wallClockUsec();
+    bool ok = controller_.submit(
+      command, [server, i, start](const ControlReply& r) {
+        {
+          std::lock_guard<std::mutex> lock(server->polledMutex_);
+          Polled& polled = server->polled_[i];
+          polled.fresh = true;
+          polled.reply = r;
+          polled.latencyUsec = wallClockUsec() - start;
+        }
+        server->wake();
+      });
+    if (!ok) {
+      polling_[i] = false;
+    }
+  }
+  nextPollUsec_ = nowUsec + kStreamUsec;
+}
+
+std::string HttpServer::changes(const std::vector<State>& latest,
+                                const std::vector<State>& then) const {
+  std::string out;
+  for (size_t i = 0; i < cameras_.size(); i++) {
+    const State& now = latest[i];
+    const State& old = then[i];
+    if (!now.known) {
+      continue;
+    }
+    std::string fields;
+    auto field = [&fields](const char* name, const std::string& value) {
+      fields += std::string(fields.empty() ? "" : ",") + "\"" + name +
+        "\":" + value;
+    };
+    bool all = !old.known;
+    if (all || now.pan != old.pan) {
+      field("pan", std::to_string(now.pan));
+    }
+    if (all || now.tilt != old.tilt) {
+      field("tilt", std::to_string(now.tilt));
+    }
+    if (all || now.homed != old.homed) {
+      field("homed", now.homed ? "true" : "false");
+    }
+    if (all || now.ledMode != old.ledMode) {
+      field("led", std::to_string(now.ledMode));
+    }
+    if (all || latencyMoved(old.latency, now.latency)) {
+      char latency[32];
+      snprintf(latency, sizeof(latency), "%.1f", now.latency / 10.0);
+      field("latency_ms", latency);
+    }
+    if (!fields.empty()) {
+      out += std::string(out.empty() ? "" : ",") + "\"" +
+        hexLocation(cameras_[i].locationId) + "\":{" + fields + "}";
+    }
+  }
+  return out;
+}
+
+// Sends each viewer whatever's changed since the last time, as one
+// frame, or nothing if nothing has.
+void HttpServer::broadcast() {
+  std::string delta = changes(current_, sent_);
+  for (size_t i = 0; i < cameras_.size(); i++) {
+    // Unsent latency changes add up until they're worth sending.
+    int latency = sent_[i].latency;
+    bool known = sent_[i].known;
+    sent_[i] = current_[i];
+    if (known && !latencyMoved(latency, current_[i].latency)) {
+      sent_[i].latency = latency;
+    }
+  }
+  if (delta.empty()) {
+    return;
+  }
+
+  std::string frame = webSocketFrame(0x1, "{\"cameras\":{" + delta + "}}");
+  for (std::shared_ptr<Connection>& connection : connections_) {
+    if (connection->webSocket && !connection->closing) {
+      connection->out += frame;
+    }
+  }
+}
+
+std::string HttpServer::describe(size_t camera) const {
+  const CameraInfo& info = cameras_[camera];
+  std::string capabilities;
+  if (info.motorUnit) {
+    capabilities += "\"pan\",\"tilt\",\"reset\",\"presets\"";
+  }
+  if (info.hwControlUnit) {
+    capabilities += std::string(capabilities.empty() ? "" : ",") + "\"led\"";
+  }
+  return "{\"location\":\"" + hexLocation(info.locationId) +
+    "\",\"motorUnit\":" + std::to_string(info.motorUnit) +
+    ",\"hwControlUnit\":" + std::to_string(info.hwControlUnit) +
+    ",\"capabilities\":[" + capabilities + "]}";
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "controller.h"
+#include "queue.h"
+
+// A small HTTP server on the loopback interface, for web pages and
+// scripts:
+//
+//   GET /cameras                the cameras and what they can do
+//   GET /cameras/<location>     where one is
+//   POST /cameras/<location>    a command, like "goto 10 -5", as the
+//                               body, as parseControlAction takes it
+//   GET /stream                 a WebSocket of position, LED and
+//                               latency changes
+//
+// Replies are JSON.  The stream starts with everything, then only
+// sends what's changed, at most 60 times a second, and not at all
+// while nothing changes.  Everything runs on one thread, and replies
+// come back from the controller's workers, so the controller has to
+// be destroyed first.
+
+// What scanning a camera's descriptors found.
+struct CameraInfo {
+  uint32_t locationId;
+  uint8_t motorUnit;
+  uint8_t hwControlUnit;
+};
+
+class HttpServer {
+public:
+  HttpServer(Controller& controller, const std::vector<CameraInfo>& cameras,
+             uint16_t port);
+  ~HttpServer();
+
+  // Serves until stop() is called.
+  void run();
+  void stop();
+
+private:
+  struct Connection {
+    explicit Connection(int fd) : fd(fd) {}
+
+    int fd;
+    std::string in;
+    std::string out;
+    bool webSocket = false;
+    // Set while a request waits for the controller, since responses
+    // have to go out in order.
+    bool waiting = false;
+    bool closing = false;
+  };
+
+  // What workers hand back to the server thread for a request.
+  struct Result {
+    std::shared_ptr<Connection> connection;
+    std::string response;
+    size_t camera;
+    ControlReply reply;
+    int64_t latencyUsec;
+  };
+
+  // The latest answer to a camera's position poll.
+  struct Polled {
+    bool fresh = false;
+    ControlReply reply;
+    int64_t latencyUsec = 0;
+  };
+
+  struct State {
+    bool known = false;
+    int pan = 0;
+    int tilt = 0;
+    bool homed = false;
+    int ledMode = -1;
+    // In tenths of a millisecond.
+    int latency = 0;
+  };
+
+  void accept();
+  // These return false if the connection should be closed.
+  bool read(const std::shared_ptr<Connection>& connection);
+  bool write(Connection& connection);
+  void request(const std::shared_ptr<Connection>& connection);
+  void route(const std::shared_ptr<Connection>& connection,
+             const std::string& method, const std::string& path,
+             const std::map<std::string, std::string>& headers,
+             const std::string& body);
+  void command(const std::shared_ptr<Connection>& connection,
+               const ControlCommand& command);
+  void frames(Connection& connection);
+  void respond(Connection& connection, int status,
+               const std::string& body);
+  void finish(const Result& result);
+  void update(size_t camera, const ControlReply& reply, int64_t latencyUsec);
+  void collectPolls();
+  void poll(int64_t nowUsec);
+  void broadcast();
+  // The cameras whose state in latest differs from then, as JSON
+  // members, with only the fields which differ.
+  std::string changes(const std::vector<State>& latest,
+                      const std::vector<State>& then) const;
+  std::string describe(size_t camera) const;
+  void wake();
+
+  Controller& controller_;
+  std::vector<CameraInfo> cameras_;
+  std::map<uint32_t, size_t> index_;
+  int listenFd_ = -1;
+  int wakeFds_[2] = {-1, -1};
+  std::atomic<bool> wakePending_{false};
+  std::atomic<bool> stopping_{false};
+  std::vector<std::shared_ptr<Connection>> connections_;
+  BoundedQueue<Result> results_;
+  // Requests sent to the controller whose results haven't been taken
+  // off results_, which is never allowed to fill.
+  size_t outstanding_ = 0;
+  // Polls land here rather than in results_, one slot per camera, so
+  // they can't crowd out responses.
+  std::mutex polledMutex_;
+  std::vector<Polled> polled_;
+  // The latest state, and what the stream has been sent.
+  std::vector<State> current_;
+  std::vector<State> sent_;
+  // Cameras whose position query hasn't come back, which aren't
+  // asked again until it does.
+  std::vector<bool> polling_;
+  int64_t nextPollUsec_ = 0;
+  size_t viewers_ = 0;
+};
@@ -0,0 +1,548 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Sends a mix of requests to many emulated cameras from many threads
+// at once, and reports how many got through and how long they took.
+// It goes through the same Request and Transport code as orbitctl, so
+// it shows where that starts to contend as the numbers grow.  Or, it
+// can send them over the wire protocol to "orbitctl listen", to see
+// how that holds up.
+//
+// Given a topology, the cameras sit on a simulated USB tree where each
+// hub carries one transfer at a time, to compare threads picking any
+// camera with threads given whole hubs, as orbitctl serve does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator.h"
+#include "faults.h"
+#include "request.h"
+#include "topology.h"
+#include "wire.h"
+
+namespace {
+
+enum Op { kPan, kTilt, kLed, kQuery, kOps };
+
+const char* const kOpNames[kOps] = {"pan", "tilt", "led", "query"};
+
+struct LoadCamera {
+  std::unique_ptr<Transport> transport;
+  uint8_t motorUnit;
+  uint8_t hwControlUnit;
+};
+
+// Latencies are counted in buckets which grow with the latency, so
+// percentiles are good to a few percent without keeping every sample.
+class Histogram {
+public:
+  static constexpr int kSubBuckets = 32;
+
+  Histogram()
+    : counts_(64 * kSubBuckets)
+  {}
+
+  void add(uint64_t ns) {
+    counts_[bucket(ns)]++;
+    total_++;
+    max_ = std::max(max_, ns);
+  }
+
+  void merge(const Histogram& other) {
+    for (size_t i = 0; i < counts_.size(); i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  uint64_t total() const { return total_; }
+  uint64_t max() const { return max_; }
+
+  // Returns the upper bound of the bucket holding the percentile.
+  uint64_t percentile(double p) const {
+    uint64_t rank = static_cast<uint64_t>(p / 100 * total_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen > rank) {
+        return std::min(upperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  static size_t bucket(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    int shift = exponent - __builtin_ctz(kSubBuckets);
+    return (shift + 1) * kSubBuckets + ((ns >> shift) - kSubBuckets);
+  }
+
+  static uint64_t upperBound(size_t i) {
+    if (i < kSubBuckets) {
+      return i;
+    }
+    int shift = i / kSubBuckets - 1;
+    uint64_t low = (kSubBuckets + i % kSubBuckets) << shift;
+    return low + (1ULL << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  uint64_t max_ = 0;
+};
+
+struct ClientStats {
+  Histogram latency[kOps];
+  uint64_t errors = 0;
+};
+
+// One hub of the simulated tree.  Hubs, and so controllers, don't get
+// in each other's way.
+struct SimulatedHub {
+  std::mutex bus;
+  // Transfers at the hub, whether waiting for it or using it, and the
+  // most there have been at once.
+  std::atomic<int> contending{0};
+  std::atomic<int> mostContending{0};
+  std::atomic<uint64_t> waitNs{0};
+};
+
+// Holds the camera's hub for transferUsec around each transfer.
+class HubTransport : public Transport {
+public:
+  HubTransport(std::unique_ptr<Transport> inner, SimulatedHub& hub,
+               int transferUsec)
+    : inner_(std::move(inner)),
+      hub_(hub),
+      transferUsec_(transferUsec)
+  {}
+
+  uint32_t controlRequest(uint8_t request, uint8_t unitId, uint8_t selector,
+                          uint8_t* data, uint16_t length) override {
+    int contending = ++hub_.contending;
+    int most = hub_.mostContending;
+    while (contending > most &&
+           !hub_.mostContending.compare_exchange_weak(most, contending)) {
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(hub_.bus);
+    hub_.waitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    std::this_thread::sleep_for(std::chrono::microseconds(transferUsec_));
+    hub_.contending--;
+    return inner_->controlRequest(request, unitId, selector, data, length);
+  }
+
+private:
+  std::unique_ptr<Transport> inner_;
+  SimulatedHub& hub_;
+  int transferUsec_;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: orbitctl-load [-c cameras] [-t threads] [-s seconds] "
+          "[-m mix]\n"
+          "                     [-S socket [-b batch]]\n"
+          "                     [-T controllersxhubsxcameras [-u usec] "
+          "[-A]]\n"
+          "  mix is weights like pan=40,tilt=40,led=10,query=10\n"
+          "  -T puts cameras on a simulated USB tree, where each hub\n"
+          "  takes usec per transfer (125 by default), and -A gives\n"
+          "  each thread whole hubs, as orbitctl serve does\n"
+          "  ORBITCTL_FAULTS injects faults as it does for orbitctl\n"
+          "  with -S, requests go to orbitctl listen, which should be\n"
+          "  running with ORBITCTL_EMULATE set to at least cameras\n");
+  exit(1);
+}
+
+int parseCount(const char* arg) {
+  char* end;
+  long value = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || value <= 0 || value > 1000000) {
+    usage();
+  }
+  return static_cast<int>(value);
+}
+
+std::vector<int> parseMix(const std::string& spec) {
+  std::vector<int> weights(kOps, 0);
+  std::istringstream in(spec);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    size_t equals = item.find('=');
+    if (equals == std::string::npos) {
+      usage();
+    }
+    std::string name = item.substr(0, equals);
+    auto op = std::find(kOpNames, kOpNames + kOps, name);
+    if (op == kOpNames + kOps) {
+      usage();
+    }
+    weights[op - kOpNames] = parseCount(item.substr(equals + 1).c_str());
+  }
+  return weights;
+}
+
+// A tree with cameras on every port of hubs on every port of the
+// controllers, like 2x4x3.
+std::vector<uint32_t> parseShape(const std::string& spec) {
+  int controllers, hubs, cameras;
+  char extra;
+  if (sscanf(spec.c_str(), "%dx%dx%d%c", &controllers, &hubs, &cameras,
+             &extra) != 3 ||
+      controllers < 1 || controllers > 255 || hubs < 1 || hubs > 15 ||
+      cameras < 1 || cameras > 15) {
+    usage();
+  }
+  std::vector<uint32_t> locations;
+  for (int c = 1; c <= controllers; c++) {
+    for (int h = 1; h <= hubs; h++) {
+      for (int p = 1; p <= cameras; p++) {
+        uint32_t locationId;
+        parseUsbPath(std::to_string(c) + "-" + std::to_string(h) + "." +
+                     std::to_string(p), &locationId);
+        locations.push_back(locationId);
+      }
+    }
+  }
+  return locations;
+}
+
+// With locations, each camera is on its hub of the simulated tree.
+std::vector<LoadCamera> makeCameras(int count,
+                                    const std::vector<uint32_t>& locations,
+                                    std::map<uint32_t, SimulatedHub>& hubs,
+                                    int transferUsec) {
+  FaultConfig faults;
+  const char* spec = getenv("ORBITCTL_FAULTS");
+  if (spec && !parseFaults(spec, &faults)) {
+    fprintf(stderr, "bad ORBITCTL_FAULTS: %s\n", spec);
+    exit(1);
+  }
+
+  std::vector<LoadCamera> cameras(count);
+  for (int i = 0; i < count; i++) {
+    LoadCamera& camera = cameras[i];
+    if (!findExtensionUnits(OrbitEmulator::descriptors(), &camera.motorUnit,
+                            &camera.hwControlUnit)) {
+      fprintf(stderr, "emulator has no extension units\n");
+      exit(1);
+    }
+    camera.transport.reset(new OrbitEmulator());
+    if (!locations.empty()) {
+      camera.transport.reset(new HubTransport(
+        std::move(camera.transport), hubs[usbHub(locations[i])],
+        transferUsec));
+    }
+    if (spec) {
+      FaultConfig config = faults;
+      config.seed += i;
+      camera.transport.reset(new FaultyTransport(
+        std::move(camera.transport), config,
+        [](int64_t usec) { usleep(usec); }));
+    }
+  }
+  return cameras;
+}
+
+Request makeRequest(int op, std::mt19937& random) {
+  std::uniform_int_distribution<int> pickSteps(-10, 10);
+  Request req;
+  switch (op) {
+  case kPan:
+    req.panTiltRelative(pickSteps(random), 0);
+    break;
+  case kTilt:
+    req.panTiltRelative(0, pickSteps(random));
+    break;
+  case kLed:
+    req.ledControl(random() % 2, 0);
+    break;
+  case kQuery:
+    req.probe();
+    break;
+  }
+  return req;
+}
+
+// Sends to the cameras picked out by mine.
+void client(std::vector<LoadCamera>& cameras, const std::vector<size_t>& mine,
+            const std::vector<int>& mix, int seed,
+            std::chrono::steady_clock::time_point deadline,
+            ClientStats& stats) {
+  if (mine.empty()) {
+    return;
+  }
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<size_t> pickCamera(0, mine.size() - 1);
+  std::discrete_distribution<int> pickOp(mix.begin(), mix.end());
+
+  while (std::chrono::steady_clock::now() < deadline) {
+    LoadCamera& camera = cameras[mine[pickCamera(random)]];
+    int op = pickOp(random);
+    Request req = makeRequest(op, random);
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+      req.send(*camera.transport, camera.motorUnit, camera.hwControlUnit);
+    } catch (const std::exception&) {
+      stats.errors++;
+      continue;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    stats.latency[op].add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+}
+
+// Sends batches of frames, and waits for all their acks before sending
+// the next, so every batch is one write and as few reads as the server
+// allows.
+void wireClient(const std::string& path, int cameraCount,
+                const std::vector<int>& mix, int batch, int seed,
+                std::chrono::steady_clock::time_point deadline,
+                ClientStats& stats) {
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int> pickCamera(0, cameraCount - 1);
+  std::discrete_distribution<int> pickOp(mix.begin(), mix.end());
+  std::vector<WireFrame> frames(batch);
+  std::vector<WireFrame> acks(batch);
+  std::vector<int> ops(batch);
+  WireClient client(path);
+  uint32_t sequence = 0;
+
+  while (std::chrono::steady_clock::now() < deadline) {
+    uint32_t first = sequence;
+    for (int i = 0; i < batch; i++) {
+      ops[i] = pickOp(random);
+      frames[i] = wireControl(OrbitEmulator::location(pickCamera(random)),
+                              sequence++, makeRequest(ops[i], random));
+    }
+    auto start = std::chrono::steady_clock::now();
+    client.send(frames.data(), batch);
+    for (int received = 0; received < batch;) {
+      size_t count = client.receive(acks.data(), batch - received);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      uint64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      for (size_t i = 0; i < count; i++) {
+        // Only this batch is outstanding, so anything else is the
+        // server getting it wrong.
+        uint32_t index = acks[i].sequence - first;
+        if (index >= static_cast<uint32_t>(batch)) {
+          throw std::runtime_error("ack for sequence " +
+                                   std::to_string(acks[i].sequence) +
+                                   " isn't for this batch");
+        }
+        if (acks[i].status != kWireOk) {
+          stats.errors++;
+        } else {
+          stats.latency[ops[index]].add(ns);
+        }
+      }
+      received += count;
+    }
+  }
+}
+
+void report(const char* name, const Histogram& latency, double seconds) {
+  printf("%-6s %10llu %12.0f/s  p50 %8.1fus  p99 %8.1fus  "
+         "p99.9 %8.1fus  max %8.1fus\n",
+         name, static_cast<unsigned long long>(latency.total()),
+         latency.total() / seconds, latency.percentile(50) / 1000.0,
+         latency.percentile(99) / 1000.0, latency.percentile(99.9) / 1000.0,
+         latency.max() / 1000.0);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  int cameraCount = 16;
+  int threadCount = 4;
+  int seconds = 5;
+  std::vector<int> mix = parseMix("pan=40,tilt=40,led=10,query=10");
+  std::string socketPath;
+  int batch = 64;
+  std::vector<uint32_t> locations;
+  int transferUsec = 125;
+  bool byHub = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:t:s:m:S:b:T:u:A")) != -1) {
+    switch (opt) {
+    case 'c':
+      cameraCount = parseCount(optarg);
+      break;
+    case 't':
+      threadCount = parseCount(optarg);
+      break;
+    case 's':
+      seconds = parseCount(optarg);
+      break;
+    case 'm':
+      mix = parseMix(optarg);
+      break;
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'b':
+      batch = parseCount(optarg);
+      break;
+    case 'T':
+      locations = parseShape(optarg);
+      cameraCount = static_cast<int>(locations.size());
+      break;
+    case 'u':
+      transferUsec = parseCount(optarg);
+      break;
+    case 'A':
+      byHub = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc) usage();
+  if (!locations.empty() && !socketPath.empty()) usage();
+  if (byHub && locations.empty()) usage();
+
+  std::vector<LoadCamera> cameras;
+  std::map<uint32_t, SimulatedHub> hubs;
+  // Which cameras each thread sends to.
+  std::vector<std::vector<size_t>> mine(threadCount);
+  if (socketPath.empty()) {
+    cameras = makeCameras(cameraCount, locations, hubs, transferUsec);
+    std::vector<size_t> owners(cameras.size());
+    if (byHub) {
+      size_t workers = threadCount;
+      owners = assignWorkers(locations, &workers, threadCount);
+    }
+    for (size_t i = 0; i < cameras.size(); i++) {
+      if (byHub) {
+        mine[owners[i]].push_back(i);
+        continue;
+      }
+      for (std::vector<size_t>& thread : mine) {
+        thread.push_back(i);
+      }
+    }
+  }
+  std::vector<ClientStats> stats(threadCount);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  for (int i = 0; i < threadCount; i++) {
+    if (socketPath.empty()) {
+      threads.emplace_back(client, std::ref(cameras), std::cref(mine[i]),
+                           std::cref(mix), i + 1, deadline,
+                           std::ref(stats[i]));
+    } else {
+      threads.emplace_back([&, i]() {
+        try {
+          wireClient(socketPath, cameraCount, mix, batch, i + 1, deadline,
+                     stats[i]);
+        } catch (const std::exception& ex) {
+          fprintf(stderr, "%s\n", ex.what());
+        }
+      });
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  Histogram all;
+  Histogram byOp[kOps];
+  uint64_t errors = 0;
+  for (const ClientStats& client : stats) {
+    for (int op = 0; op < kOps; op++) {
+      byOp[op].merge(client.latency[op]);
+      all.merge(client.latency[op]);
+    }
+    errors += client.errors;
+  }
+
+  printf("%d cameras, %d threads, %.1fs\n", cameraCount, threadCount,
+         elapsed);
+  for (int op = 0; op < kOps; op++) {
+    if (byOp[op].total() > 0) {
+      report(kOpNames[op], byOp[op], elapsed);
+    }
+  }
+  report("all", all, elapsed);
+  printf("errors %llu\n", static_cast<unsigned long long>(errors));
+  if (!hubs.empty()) {
+    int mostContending = 0;
+    uint64_t waitNs = 0;
+    for (auto& hub : hubs) {
+      mostContending =
+        std::max(mostContending, hub.second.mostContending.load());
+      waitNs += hub.second.waitNs;
+    }
+    printf("hubs %d, most transfers contending for one hub %d, %.1f%% of "
+           "the time waiting for a hub\n", static_cast<int>(hubs.size()),
+           mostContending, 100.0 * waitNs / (threadCount * elapsed * 1e9));
+  }
+
+  FaultStats faults;
+  bool injected = false;
+  for (LoadCamera& camera : cameras) {
+    auto* faulty = dynamic_cast<FaultyTransport*>(camera.transport.get());
+    if (faulty) {
+      faults += faulty->stats();
+      injected = true;
+    }
+  }
+  if (injected) {
+    printf("faults: requests %llu stalls %llu timeouts %llu short %llu "
+           "disconnected %llu\n",
+           static_cast<unsigned long long>(faults.requests),
+           static_cast<unsigned long long>(faults.stalls),
+           static_cast<unsigned long long>(faults.timeouts),
+           static_cast<unsigned long long>(faults.shorts),
+           static_cast<unsigned long long>(faults.disconnected));
+  }
+  return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "mechanism.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace {
+
+double clamp(double v, double lo, double hi) {
+  return std::max(lo, std::min(hi, v));
+}
+
+// Time to cover a distance from rest to rest, accelerating as hard as
+// allowed up to the top speed.
+double travelSeconds(const AxisModel& model, double distance) {
+  double rampDistance =
+    model.maxVelocity * model.maxVelocity / model.acceleration;
+  if (distance < rampDistance) {
+    return 2 * sqrt(distance / model.acceleration);
+  }
+  return distance / model.maxVelocity + model.maxVelocity / model.acceleration;
+}
+
+// How far the motor has gone after some time on that same profile.
+double travelled(const AxisModel& model, double distance, double seconds) {
+  double total = travelSeconds(model, distance);
+  if (seconds >= total) {
+    return distance;
+  }
+  double rampSeconds = std::min(model.maxVelocity / model.acceleration,
+                                total / 2);
+  double a = model.acceleration;
+  if (seconds < rampSeconds) {
+    return a * seconds * seconds / 2;
+  }
+  if (seconds > total - rampSeconds) {
+    double left = total - seconds;
+    return distance - a * left * left / 2;
+  }
+  double peak = a * rampSeconds;
+  return a * rampSeconds * rampSeconds / 2 + peak * (seconds - rampSeconds);
+}
+
+}
+
+MechanismAxis::MechanismAxis(const AxisModel& model)
+  : model_(model)
+{}
+
+// The camera only moves when the motor pushes it, from one side of
+// the slack or the other.  This holds as long as the motor has only
+// moved one way since output was known.
+double MechanismAxis::slack(double output, double motor) const {
+  double half = model_.backlash / 2;
+  return clamp(output, motor - half, motor + half);
+}
+
+double MechanismAxis::motorAt(const Segment& segment, int64_t nowUsec) const {
+  double distance = fabs(segment.to - segment.from);
+  double seconds = std::max<int64_t>(0, nowUsec - segment.startUsec) / 1e6;
+  double dir = segment.to < segment.from ? -1 : 1;
+  double half = model_.backlash / 2;
+  return clamp(segment.from + dir * travelled(model_, distance, seconds),
+               model_.minPosition - half, model_.maxPosition + half);
+}
+
+double MechanismAxis::motor(int64_t nowUsec) const {
+  double motor = motor_;
+  for (const Segment& segment : segments_) {
+    if (nowUsec < segment.startUsec) {
+      break;
+    }
+    motor = motorAt(segment, nowUsec);
+  }
+  return motor;
+}
+
+double MechanismAxis::position(int64_t nowUsec) const {
+  double output = output_;
+  for (const Segment& segment : segments_) {
+    if (nowUsec < segment.startUsec) {
+      break;
+    }
+    output = slack(output,
+                   motorAt(segment, std::min(nowUsec, segment.endUsec)));
+  }
+  return output;
+}
+
+void MechanismAxis::stop(int64_t nowUsec) {
+  output_ = position(nowUsec);
+  motor_ = motor(nowUsec);
+  segments_.clear();
+  doneUsec_ = std::min(doneUsec_, nowUsec);
+}
+
+int64_t MechanismAxis::schedule(double to, int64_t startUsec) {
+  startUsec = std::max(startUsec, doneUsec_);
+  double from = segments_.empty()
+    ? motor_ : motorAt(segments_.back(), segments_.back().endUsec);
+  int64_t endUsec = startUsec +
+    static_cast<int64_t>(travelSeconds(model_, fabs(to - from)) * 1e6);
+  // Finished segments aren't needed any more.
+  while (!segments_.empty() && segments_.front().endUsec <= startUsec) {
+    output_ = slack(output_, motorAt(segments_.front(),
+                                     segments_.front().endUsec));
+    motor_ = motorAt(segments_.front(), segments_.front().endUsec);
+    segments_.erase(segments_.begin());
+  }
+  segments_.push_back(Segment{from, to, startUsec, endUsec});
+  doneUsec_ = endUsec;
+  return endUsec;
+}
+
+int64_t MechanismAxis::move(double steps, int64_t startUsec) {
+  if (steps == 0) {
+    return std::max(startUsec, doneUsec_);
+  }
+  double from = segments_.empty()
+    ? motor_ : motorAt(segments_.back(), segments_.back().endUsec);
+  return schedule(from + steps, startUsec);
+}
+
+int64_t MechanismAxis::home(int64_t startUsec) {
+  // The firmware doesn't know where the axis is, so it drives far
+  // enough to reach the stop from anywhere.
+  double range = model_.maxPosition - model_.minPosition + model_.backlash;
+  move(-range, startUsec);
+  // Coming back up, the camera trails the motor by half the slack.
+  return schedule(model_.backlash / 2, doneUsec_);
+}
+
+Mechanism::Mechanism(const MechanismModel& model)
+  : model_(model)
+  , pan_(model.pan)
+  , tilt_(model.tilt)
+{}
+
+void Mechanism::start(const Command& command) {
+  int64_t startUsec =
+    std::max(busyUntilUsec_, command.arrivedUsec) + model_.commandUsec;
+  busyUntilUsec_ = std::max(pan_.move(command.move.left, startUsec),
+                            tilt_.move(command.move.up, startUsec));
+}
+
+void Mechanism::advance(int64_t nowUsec) {
+  while (!buffer_.empty() && busyUntilUsec_ <= nowUsec) {
+    start(buffer_.front());
+    buffer_.pop_front();
+  }
+}
+
+bool Mechanism::move(const Move& move, int64_t nowUsec) {
+  advance(nowUsec);
+  Command command{move, nowUsec};
+  if (busyUntilUsec_ <= nowUsec) {
+    start(command);
+  } else if (buffer_.size() < model_.commandBuffer) {
+    buffer_.push_back(command);
+  } else {
+    dropped_++;
+    return false;
+  }
+  return true;
+}
+
+void Mechanism::reset(bool pan, bool tilt, int64_t nowUsec) {
+  advance(nowUsec);
+  buffer_.clear();
+  int64_t startUsec = nowUsec + model_.commandUsec;
+  if (pan) {
+    pan_.stop(nowUsec);
+    pan_.home(startUsec);
+  }
+  if (tilt) {
+    tilt_.stop(nowUsec);
+    tilt_.home(startUsec);
+  }
+  busyUntilUsec_ = std::max(pan_.doneUsec(), tilt_.doneUsec());
+}
+
+int64_t Mechanism::idleUsec() const {
+  Mechanism future(*this);
+  future.advance(INT64_MAX);
+  return future.busyUntilUsec_;
+}
+
+MoveScore scoreMoves(Mechanism& mechanism, int64_t startUsec,
+                     const std::vector<Move>& moves,
+                     double targetPan, double targetTilt) {
+  int64_t now = startUsec;
+  for (size_t i = 0; i < moves.size(); i++) {
+    if (i > 0) {
+      now += moveTimeUsec(moves[i - 1]);
+    }
+    mechanism.move(moves[i], now);
+  }
+  int64_t doneUsec = std::max(mechanism.idleUsec(), startUsec);
+  return MoveScore{mechanism.pan(doneUsec) - targetPan,
+                   mechanism.tilt(doneUsec) - targetTilt,
+                   doneUsec - startUsec};
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+#include "position.h"
+
+// A model of the pan/tilt mechanism, for judging how well moves are
+// planned without a camera.  It moves the way a stepper driven gear
+// train does: each axis speeds up and slows down at a limited rate,
+// can't go past its end stops, and loses steps to slack when it
+// reverses.  Moves go through a small command buffer in the firmware,
+// and run one after another.
+//
+// Nothing happens on its own.  The caller says what time it is with
+// every call, so a simulation can run on a virtual clock as fast as it
+// likes.  Positions are in steps from where a reset leaves the axis,
+// positive left and up, like PositionState.
+
+// These are guesses, chosen to agree with moveTimeUsec() and
+// resetTimeUsec().
+struct AxisModel {
+  // Steps per second, and steps per second per second.
+  double maxVelocity = 50;
+  double acceleration = 500;
+  // Where the end stops are.
+  double minPosition = -50;
+  double maxPosition = 50;
+  // Motor steps lost taking up slack when the axis reverses.
+  double backlash = 2;
+};
+
+struct MechanismModel {
+  MechanismModel() {
+    tilt.minPosition = -30;
+    tilt.maxPosition = 30;
+  }
+
+  AxisModel pan;
+  AxisModel tilt;
+  // How many moves the firmware holds while one is running.  Moves
+  // which arrive when it's full are dropped.
+  size_t commandBuffer = 2;
+  // How long the firmware takes to start a move.
+  int64_t commandUsec = 20000;
+};
+
+class MechanismAxis {
+public:
+  explicit MechanismAxis(const AxisModel& model);
+
+  // Abandons anything still to be done, leaving the motor where it is.
+  void stop(int64_t nowUsec);
+  // These start once anything already scheduled is done, and no
+  // earlier than startUsec.  They return when the axis will stop.
+  int64_t move(double steps, int64_t startUsec);
+  // Drives the axis against the low end stop, which is where it is
+  // sure to be, and then back to the middle.
+  int64_t home(int64_t startUsec);
+
+  // Where the camera is pointing, as opposed to where the motor is.
+  double position(int64_t nowUsec) const;
+  double motor(int64_t nowUsec) const;
+  int64_t doneUsec() const { return doneUsec_; }
+
+private:
+  struct Segment {
+    double from;
+    // This is what was commanded.  The motor stalls at the end stops.
+    double to;
+    int64_t startUsec;
+    int64_t endUsec;
+  };
+
+  double motorAt(const Segment& segment, int64_t nowUsec) const;
+  double slack(double output, double motor) const;
+  int64_t schedule(double to, int64_t startUsec);
+
+  AxisModel model_;
+  // The motor and camera position when the first segment starts.
+  double motor_ = 0;
+  double output_ = 0;
+  std::vector<Segment> segments_;
+  int64_t doneUsec_ = 0;
+};
+
+class Mechanism {
+public:
+  explicit Mechanism(const MechanismModel& model = MechanismModel());
+
+  // Returns false if the command buffer was full.
+  bool move(const Move& move, int64_t nowUsec);
+  // A reset throws away any buffered moves and starts right away.
+  void reset(bool pan, bool tilt, int64_t nowUsec);
+
+  double pan(int64_t nowUsec) const { return pan_.position(nowUsec); }
+  double tilt(int64_t nowUsec) const { return tilt_.position(nowUsec); }
+  // When everything buffered so far will be done.
+  int64_t idleUsec() const;
+  uint64_t dropped() const { return dropped_; }
+
+  // Starts buffered moves whose turn has come.
+  void advance(int64_t nowUsec);
+
+private:
+  struct Command {
+    Move move;
+    int64_t arrivedUsec;
+  };
+
+  void start(const Command& command);
+
+  MechanismModel model_;
+  MechanismAxis pan_;
+  MechanismAxis tilt_;
+  std::deque<Command> buffer_;
+  int64_t busyUntilUsec_ = 0;
+  uint64_t dropped_ = 0;
+};
+
+struct MoveScore {
+  // How far from the target the camera ends up, in steps.
+  double panError;
+  double tiltError;
+  // From sending the first move until the mechanism stops.
+  int64_t timeToTargetUsec;
+};
+
+// Sends moves to the mechanism, paced the way orbitctl paces them, and
+// scores where it ends up against where it was meant to.
+MoveScore scoreMoves(Mechanism& mechanism, int64_t startUsec,
+                     const std::vector<Move>& moves,
+                     double targetPan, double targetTilt);
@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "odometry.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// The largest correlation window.  Frames are box filtered down to
+// this, which is plenty for measuring how far the camera moved.
+constexpr int kMaxWindow = 128;
+constexpr int kMinWindow = 16;
+
+// Peaks lower than this are probably noise.
+constexpr double kMinConfidence = 0.05;
+
+// Moves this small are dominated by rounding when working out the
+// pixels per step.
+constexpr int kMinCalibrationSteps = 2;
+
+// How quickly new measurements replace old ones.
+constexpr double kScaleGain = 0.25;
+constexpr double kBacklashGain = 0.5;
+
+// An in-place radix 2 FFT of n x n complex values.  The real and
+// imaginary parts are kept in separate arrays, and the twiddle
+// factors for each pass are stored contiguously, so the inner loops
+// are simple enough for the compiler to vectorize.
+class Fft2d {
+public:
+  explicit Fft2d(int n)
+    : n_(n)
+    , bitReverse_(n)
+    , twiddleRe_(n)
+    , twiddleIm_(n)
+  {
+    int bits = 0;
+    while ((1 << bits) < n) {
+      bits++;
+    }
+    for (int i = 0; i < n; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      bitReverse_[i] = r;
+    }
+    // The twiddles for the pass with half-length h start at h.
+    for (int half = 1; half < n; half <<= 1) {
+      for (int k = 0; k < half; k++) {
+        double angle = -M_PI * k / half;
+        twiddleRe_[half + k] = static_cast<float>(cos(angle));
+        twiddleIm_[half + k] = static_cast<float>(sin(angle));
+      }
+    }
+  }
+
+  void forward(std::vector<float>& re, std::vector<float>& im) {
+    transform(re, im, false);
+  }
+
+  // This includes the 1/n^2 scaling.
+  void inverse(std::vector<float>& re, std::vector<float>& im) {
+    transform(re, im, true);
+    float scale = 1.0f / (n_ * n_);
+    for (size_t i = 0; i < re.size(); i++) {
+      re[i] *= scale;
+      im[i] *= scale;
+    }
+  }
+
+private:
+  void transform(std::vector<float>& re, std::vector<float>& im,
+                 bool inverse) {
+    // Rows, then columns by way of transposing.
+    for (int pass = 0; pass < 2; pass++) {
+      for (int row = 0; row < n_; row++) {
+        transformRow(&re[row * n_], &im[row * n_], inverse);
+      }
+      transpose(re);
+      transpose(im);
+    }
+  }
+
+  void transformRow(float* re, float* im, bool inverse) {
+    for (int i = 0; i < n_; i++) {
+      int j = bitReverse_[i];
+      if (i < j) {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+    float sign = inverse ? -1.0f : 1.0f;
+    for (int half = 1; half < n_; half <<= 1) {
+      const float* wRe = &twiddleRe_[half];
+      const float* wIm = &twiddleIm_[half];
+      for (int start = 0; start < n_; start += 2 * half) {
+        float* aRe = re + start;
+        float* aIm = im + start;
+        float* bRe = aRe + half;
+        float* bIm = aIm + half;
+        for (int k = 0; k < half; k++) {
+          float wi = sign * wIm[k];
+          float tRe = bRe[k] * wRe[k] - bIm[k] * wi;
+          float tIm = bRe[k] * wi + bIm[k] * wRe[k];
+          bRe[k] = aRe[k] - tRe;
+          bIm[k] = aIm[k] - tIm;
+          aRe[k] += tRe;
+          aIm[k] += tIm;
+        }
+      }
+    }
+  }
+
+  void transpose(std::vector<float>& v) {
+    for (int i = 0; i < n_; i++) {
+      for (int j = i + 1; j < n_; j++) {
+        std::swap(v[i * n_ + j], v[j * n_ + i]);
+      }
+    }
+  }
+
+  int n_;
+  std::vector<int> bitReverse_;
+  std::vector<float> twiddleRe_;
+  std::vector<float> twiddleIm_;
+};
+
+// Box filters the middle of the image down to n x n by factor,
+// removes the mean, and applies a Hann window so the edges of the
+// frame don't dominate the correlation.
+std::vector<float> prepare(const Image& image, int n, int factor,
+                           const std::vector<float>& window) {
+  int x0 = (image.width - n * factor) / 2;
+  int y0 = (image.height - n * factor) / 2;
+  std::vector<float> out(n * n);
+  double total = 0;
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      int sum = 0;
+      for (int dy = 0; dy < factor; dy++) {
+        const uint8_t* p =
+          &image.luma[(y0 + y * factor + dy) * image.width + x0 + x * factor];
+        for (int dx = 0; dx < factor; dx++) {
+          sum += p[dx];
+        }
+      }
+      out[y * n + x] = static_cast<float>(sum);
+      total += sum;
+    }
+  }
+  float mean = static_cast<float>(total / (n * n));
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      out[y * n + x] = (out[y * n + x] - mean) * window[y] * window[x];
+    }
+  }
+  return out;
+}
+
+// Fits a parabola through three samples around a peak, and returns
+// the offset of its vertex from the middle sample.
+double subpixel(float left, float middle, float right) {
+  double denom = left - 2.0 * middle + right;
+  if (denom >= 0) {
+    return 0;
+  }
+  return 0.5 * (left - right) / denom;
+}
+
+int sign(int v) {
+  return (v > 0) - (v < 0);
+}
+
+bool applyAxis(AxisState& axis, double pixels) {
+  int steps = axis.lastSteps;
+  axis.lastSteps = 0;
+  if (steps == 0) {
+    return false;
+  }
+
+  if (!axis.lastReversed) {
+    // With no slack to take up, any difference is the step size.
+    if (std::abs(steps) < kMinCalibrationSteps) {
+      return false;
+    }
+    double scale = pixels / steps;
+    if (axis.pixelsPerStep == 0) {
+      axis.pixelsPerStep = scale;
+    } else {
+      axis.pixelsPerStep += kScaleGain * (scale - axis.pixelsPerStep);
+    }
+    return true;
+  }
+
+  if (axis.pixelsPerStep == 0) {
+    return false;
+  }
+  // After a reversal, a difference means the backlash is off.  The
+  // position is corrected right away, the backlash gradually.
+  int error = static_cast<int>(lround(pixels / axis.pixelsPerStep - steps));
+  axis.position += error;
+  axis.uncertainty = std::min(axis.uncertainty, 1.0);
+  int shortfall = -error * sign(steps);
+  axis.backlash = std::max(
+    0, std::min(kMaxStepsPerMove,
+                axis.backlash +
+                static_cast<int>(lround(kBacklashGain * shortfall))));
+  return true;
+}
+
+}
+
+Image readPgm(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("opening " + path + " failed");
+  }
+
+  // The header is whitespace separated, and can have comments.
+  auto next = [&]() {
+    std::string token;
+    while (in >> token) {
+      if (token[0] != '#') {
+        return token;
+      }
+      std::getline(in, token);
+    }
+    throw std::runtime_error(path + ": truncated PGM header");
+  };
+
+  if (next() != "P5") {
+    throw std::runtime_error(path + ": not a binary PGM file");
+  }
+  Image image;
+  image.width = std::stoi(next());
+  image.height = std::stoi(next());
+  int maxval = std::stoi(next());
+  if (image.width <= 0 || image.height <= 0 || maxval <= 0 || maxval > 255) {
+    throw std::runtime_error(path + ": unsupported PGM file");
+  }
+  // Exactly one whitespace character separates the header and data.
+  in.get();
+
+  image.luma.resize(image.width * image.height);
+  if (!in.read(reinterpret_cast<char*>(image.luma.data()),
+               image.luma.size())) {
+    throw std::runtime_error(path + ": truncated PGM data");
+  }
+  return image;
+}
+
+void writePgm(const std::string& path, const Image& image) {
+  std::ofstream out(path, std::ios::binary);
+  out << "P5\n" << image.width << " " << image.height << "\n255\n";
+  out.write(reinterpret_cast<const char*>(image.luma.data()),
+            image.luma.size());
+  if (!out) {
+    throw std::runtime_error("writing " + path + " failed");
+  }
+}
+
+Shift measureShift(const Image& before, const Image& after) {
+  if (before.width != after.width || before.height != after.height) {
+    throw std::runtime_error("frames are different sizes");
+  }
+
+  int size = std::min(before.width, before.height);
+  int n = kMaxWindow;
+  while (n > size && n > kMinWindow) {
+    n /= 2;
+  }
+  if (n > size) {
+    throw std::runtime_error("frames are too small");
+  }
+  int factor = size / n;
+
+  std::vector<float> window(n);
+  for (int i = 0; i < n; i++) {
+    window[i] = static_cast<float>(0.5 - 0.5 * cos(2 * M_PI * i / (n - 1)));
+  }
+
+  Fft2d fft(n);
+  std::vector<float> aRe = prepare(before, n, factor, window);
+  std::vector<float> aIm(n * n);
+  std::vector<float> bRe = prepare(after, n, factor, window);
+  std::vector<float> bIm(n * n);
+  fft.forward(aRe, aIm);
+  fft.forward(bRe, bIm);
+
+  // The normalized cross power spectrum, B * conj(A) / |B * conj(A)|,
+  // whose inverse transform peaks at the shift from a to b.
+  for (int i = 0; i < n * n; i++) {
+    float re = bRe[i] * aRe[i] + bIm[i] * aIm[i];
+    float im = bIm[i] * aRe[i] - bRe[i] * aIm[i];
+    float mag = sqrtf(re * re + im * im) + 1e-12f;
+    aRe[i] = re / mag;
+    aIm[i] = im / mag;
+  }
+  fft.inverse(aRe, aIm);
+
+  int peak = static_cast<int>(
+    std::max_element(aRe.begin(), aRe.end()) - aRe.begin());
+  int px = peak % n;
+  int py = peak / n;
+  auto at = [&](int x, int y) {
+    return aRe[((y + n) % n) * n + (x + n) % n];
+  };
+  double dx = px + subpixel(at(px - 1, py), at(px, py), at(px + 1, py));
+  double dy = py + subpixel(at(px, py - 1), at(px, py), at(px, py + 1));
+  // The correlation wraps around, so the top half are negative.
+  if (dx > n / 2) {
+    dx -= n;
+  }
+  if (dy > n / 2) {
+    dy -= n;
+  }
+
+  Shift shift;
+  shift.dx = dx * factor;
+  shift.dy = dy * factor;
+  shift.confidence = aRe[peak];
+  shift.range = n / 4 * factor;
+  return shift;
+}
+
+bool applyShift(PositionState& state, const Shift& shift) {
+  if (shift.confidence < kMinConfidence ||
+      std::abs(shift.dx) > shift.range || std::abs(shift.dy) > shift.range) {
+    state.pan.lastSteps = 0;
+    state.tilt.lastSteps = 0;
+    return false;
+  }
+  bool pan = applyAxis(state.pan, shift.dx);
+  bool tilt = applyAxis(state.tilt, shift.dy);
+  return pan || tilt;
+}
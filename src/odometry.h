@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "position.h"
+
+// Odometry compares frames from before and after a move to see how
+// far the image actually moved, and uses that to correct the position
+// tracking.  Frames come from whatever tool is capturing video, as
+// 8-bit greyscale (luma) PGM files.
+
+struct Image {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> luma;
+};
+
+Image readPgm(const std::string& path);
+void writePgm(const std::string& path, const Image& image);
+
+struct Shift {
+  // How far the content of the image moved, in pixels of the original
+  // frames.  Positive is right and down.
+  double dx = 0;
+  double dy = 0;
+  // The height of the correlation peak, from 0 (no match) to 1 (the
+  // same image).
+  double confidence = 0;
+  // Shifts larger than this can't be told apart from wraparound, so
+  // they aren't trustworthy.
+  double range = 0;
+};
+
+// This uses phase correlation on downscaled copies of the frames.
+Shift measureShift(const Image& before, const Image& after);
+
+// Checks the last command's moves against the measured shift.  Moves
+// which didn't reverse refine the pixels per step, and once that is
+// known, reversals correct the position and the backlash.  Returns
+// false if the shift wasn't usable.
+bool applyShift(PositionState& state, const Shift& shift);
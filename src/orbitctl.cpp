@@ -29,12 +29,48 @@
 
 #include <mach/mach_error.h>
 
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <thread>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <type_traits>
-
+#include <vector>
+
+#include "aim.h"
+#include "cluster.h"
+#include "controller.h"
+#include "emulator.h"
+#include "eptz.h"
+#include "faults.h"
+#include "handoff.h"
+#include "health.h"
+#include "http.h"
+#include "odometry.h"
+#include "osc.h"
+#include "position.h"
+#include "request.h"
+#include "scene.h"
+#include "simulation.h"
+#include "topology.h"
+#include "tour.h"
+#include "tracking.h"
+#include "transport.h"
+#include "wire.h"
 #include "uvc.h"
+#include "visca.h"
 
 namespace {
 
@@ -98,8 +134,8 @@ struct StorageCleaner<IOCFPlugInInterface**> {
 };
 
 template <>
-struct StorageCleaner<IOUSBDeviceInterface**> {
-  static void clean(IOUSBDeviceInterface** val) {
+struct StorageCleaner<IOUSBDeviceInterface187**> {
+  static void clean(IOUSBDeviceInterface187** val) {
     if (val) {
       (*val)->Release(val);
     }
@@ -281,14 +317,15 @@ private:
 };
 
 template <>
-struct IOIteratorTraits<IOUSBDeviceInterface> {
+struct IOIteratorTraits<IOUSBDeviceInterface187> {
   static CFUUIDRef pluginType() { return kIOUSBDeviceUserClientTypeID; }
-  static CFUUIDRef interfaceID() { return kIOUSBDeviceInterfaceID; }
+  // 187 is the first version which can re-enumerate a device.
+  static CFUUIDRef interfaceID() { return kIOUSBDeviceInterfaceID187; }
 };
 
 class USBDevices {
 public:
-  using Iterator = IOIterator<IOUSBDeviceInterface>;
+  using Iterator = IOIterator<IOUSBDeviceInterface187>;
 
   Iterator begin() {
     CFMutableDictionaryRef matchingDict =
@@ -309,7 +346,7 @@ public:
 
 void listDevices() {
   USBDevices ds;
-  for (Storage<IOUSBDeviceInterface**>& device : ds) {
+  for (Storage<IOUSBDeviceInterface187**>& device : ds) {
     UInt16 vendor, product;
     kernCheck((*device)->GetDeviceVendor(device.ref(), &vendor),
               "getting vendor");
@@ -320,19 +357,41 @@ void listDevices() {
   }
 }
 
-Storage<IOUSBDeviceInterface**> getCamera() {
-  USBDevices ds;
-  for (Storage<IOUSBDeviceInterface**>& device : ds) {
-    UInt16 vendor, product;
-    kernCheck((*device)->GetDeviceVendor(device.ref(), &vendor),
-              "getting vendor");
-    kernCheck((*device)->GetDeviceProduct(device.ref(), &product),
-              "getting product");
+bool isCamera(Storage<IOUSBDeviceInterface187**>& device) {
+  UInt16 vendor, product;
+  kernCheck((*device)->GetDeviceVendor(device.ref(), &vendor),
+            "getting vendor");
+  kernCheck((*device)->GetDeviceProduct(device.ref(), &product),
+            "getting product");
+  return vendor == 0x046d && product == 0x0994;
+}
+
+// This is a stable name for a camera, as long as it stays plugged
+// into the same port.
+uint32_t getLocationId(Storage<IOUSBDeviceInterface187**>& device) {
+  UInt32 locationId;
+  kernCheck((*device)->GetLocationID(device.ref(), &locationId),
+            "getting location");
+  return locationId;
+}
 
-    if (vendor == 0x046d && product == 0x0994) {
-      // This uses the first matching device.
-      // TODO: support multiple devices.
+std::vector<Storage<IOUSBDeviceInterface187**>> getCameras() {
+  std::vector<Storage<IOUSBDeviceInterface187**>> cameras;
+  USBDevices ds;
+  for (Storage<IOUSBDeviceInterface187**>& device : ds) {
+    if (isCamera(device)) {
+      cameras.push_back(std::move(device));
+    }
+  }
+  return cameras;
+}
 
+// A locationId of 0 matches the first camera.
+Storage<IOUSBDeviceInterface187**> getCamera(uint32_t locationId) {
+  USBDevices ds;
+  for (Storage<IOUSBDeviceInterface187**>& device : ds) {
+    if (isCamera(device) &&
+        (locationId == 0 || getLocationId(device) == locationId)) {
       return std::move(device);
     }
   }
@@ -358,39 +417,72 @@ private:
   IOUSBInterfaceInterface220** interface_;  
 };
 
-void sendControlRequest(IOUSBInterfaceInterface220** interface,
-                        uint8_t interfaceNumber,
-                        uint8_t unitId,
-                        uint8_t selector,
-                        uint8_t* data,
-                        uint16_t length) {
-  IOUSBDevRequest controlRequest =
+// A camera which has stopped responding shouldn't hang us forever.
+constexpr UInt32 kControlTimeoutMs = 1000;
+
+// UVC GET requests have the high bit set, and read data from the
+// camera.  Returns the number of bytes transferred.
+uint32_t sendControlRequest(IOUSBInterfaceInterface220** interface,
+                            uint8_t interfaceNumber,
+                            uint8_t request,
+                            uint8_t unitId,
+                            uint8_t selector,
+                            uint8_t* data,
+                            uint16_t length) {
+  IOUSBDevRequestTO controlRequest =
     {
-     .bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface),
-     .bRequest = UVC_SET_CUR,
+     .bmRequestType = USBmakebmRequestType(
+       (request & 0x80) ? kUSBIn : kUSBOut, kUSBClass, kUSBInterface),
+     .bRequest = request,
      .wValue = static_cast<UInt16>(selector << 8),
      .wIndex = static_cast<UInt16>((unitId << 8) | interfaceNumber),
      .wLength = length,
+     .pData = data,
      .wLenDone = 0,
-     .pData = data
+     .noDataTimeout = kControlTimeoutMs,
+     .completionTimeout = kControlTimeoutMs
     };
 
   USBInterfaceOpen open{interface};
 
-  hrCheck((*interface)->ControlRequest(
+  hrCheck((*interface)->ControlRequestTO(
             interface, /* pipeRef */ 0, &controlRequest),
           "ControlRequest");
+  return controlRequest.wLenDone;
 }
 
-class Request;
+class UsbTransport : public Transport {
+public:
+  UsbTransport(Storage<IOUSBInterfaceInterface220**> interface,
+               uint8_t interfaceNumber)
+    : interface_(std::move(interface))
+    , interfaceNumber_(interfaceNumber)
+  {}
+
+  uint32_t controlRequest(uint8_t request,
+                          uint8_t unitId,
+                          uint8_t selector,
+                          uint8_t* data,
+                          uint16_t length) override {
+    return sendControlRequest(
+      interface_.ref(), interfaceNumber_, request, unitId, selector, data,
+      length);
+  }
+
+private:
+  Storage<IOUSBInterfaceInterface220**> interface_;
+  uint8_t interfaceNumber_;
+};
 
 struct Camera {
-  Storage<IOUSBInterfaceInterface220**> interface;
-  uint8_t videoInterfaceNumber;
+  // This is only valid for real cameras.
+  Storage<IOUSBDeviceInterface187**> device;
+  std::unique_ptr<Transport> transport;
+  uint32_t locationId;
   uint8_t motorUnit;
   uint8_t hwControlUnit;
 
-  bool isValid() { return interface.isValid(); }
+  bool isValid() { return transport != nullptr; }
   void send(Request& req);
 };
 
@@ -402,7 +494,7 @@ struct IOIteratorTraits<IOUSBInterfaceInterface220> {
 
 class USBVideoInterfaces {
 public:
-  USBVideoInterfaces(IOUSBDeviceInterface** device)
+  USBVideoInterfaces(IOUSBDeviceInterface187** device)
     : device_(device) {}
 
   using Iterator = IOIterator<IOUSBInterfaceInterface220>;
@@ -429,375 +521,1639 @@ public:
   }
 
 private:
-  IOUSBDeviceInterface** device_;
+  IOUSBDeviceInterface187** device_;
 };
 
 void extractExtensionData(
     Camera& camera, const VCExtensionUnitDescriptor* eudesc) {
-  constexpr uint8_t kMotorGuid[16] =
-    {
-     0x82, 0x06, 0x61, 0x63, 0x70, 0x50, 0xab, 0x49,
-     0xb8, 0xcc, 0xb3, 0x85, 0x5e, 0x8d, 0x22, 0x56
-    };
-
-  constexpr uint8_t kHwControlGuid[16] =
-    {
-     0x82, 0x06, 0x61, 0x63, 0x70, 0x50, 0xab, 0x49,
-     0xb8, 0xcc, 0xb3, 0x85, 0x5e, 0x8d, 0x22, 0x1f
-    };
-
   if (memcmp(
-        eudesc->guidExtensionCode, kMotorGuid, sizeof(kMotorGuid)) == 0) {
+        eudesc->guidExtensionCode, LXU_MOTOR_GUID,
+        sizeof(LXU_MOTOR_GUID)) == 0) {
     camera.motorUnit = eudesc->bUnitID;
   } else if (memcmp(
-               eudesc->guidExtensionCode, kHwControlGuid,
-               sizeof(kHwControlGuid)) == 0) {
+               eudesc->guidExtensionCode, LXU_HW_CONTROL_GUID,
+               sizeof(LXU_HW_CONTROL_GUID)) == 0) {
     camera.hwControlUnit = eudesc->bUnitID;
   }
 }
   
 
-Camera scanDescriptors(bool display) {
-  Storage<IOUSBDeviceInterface**> device = getCamera();
-  if (!device.isValid()) {
-    printf("No Logitech Orbit AF found\n");
-    return {};
+void parseDescriptor(
+    Camera& camera, IOUSBDescriptorHeader* descriptor, bool display) {
+  if (display) {
+    printf("Descriptor len=%d type=%d\n",
+           (int) descriptor->bLength,
+           (int) descriptor->bDescriptorType);
   }
 
+  switch (descriptor->bDescriptorType) {
+  case USB_ENDPOINT_DESCRIPTOR:
+    if (display) {
+      printf("  USB Endpoint\n");
+    }
+    break;
+  case CS_INTERFACE: {
+    auto* vcdesc = reinterpret_cast<VCDescriptor*>(descriptor);
+    switch (vcdesc->bDescriptorSubType) {
+    case VC_HEADER:
+      if (display) {
+        printf("  VC Interface Header\n");
+      }
+      break;
+    case VC_INPUT_TERMINAL: {
+      auto* itdesc = reinterpret_cast<VCInputTerminalDescriptor*>(vcdesc);
+      if (display) {
+        if (itdesc->wTerminalType == ITT_CAMERA) {
+          printf("  VC Camera Terminal id=%d\n", (int) itdesc->bTerminalID);
+        } else {
+          printf("  VC Input Terminal id=%d\n", (int) itdesc->bTerminalID);
+        }
+      }
+      break; }
+    case VC_OUTPUT_TERMINAL: {
+      auto* otdesc = reinterpret_cast<VCOutputTerminalDescriptor*>(vcdesc);
+      if (display) {
+        printf("  VC Output Terminal id=%d\n", (int) otdesc->bTerminalID);
+      }
+      break; }
+    case VC_SELECTOR_UNIT: {
+      auto* sudesc = reinterpret_cast<VCSelectorUnitDescriptor*>(vcdesc);
+      if (display) {
+        printf("  VC Selector Unit id=%d\n", (int) sudesc->bUnitID);
+      }
+      break; }
+    case VC_PROCESSING_UNIT: {
+      auto* pudesc = reinterpret_cast<VCProcessingUnitDescriptor*>(vcdesc);
+      if (display) {
+        printf("  VC Processing Unit id=%d\n", (int) pudesc->bUnitID);
+      }
+      break; }
+    case VC_EXTENSION_UNIT: {
+      auto* eudesc = reinterpret_cast<VCExtensionUnitDescriptor*>(vcdesc);
+      if (display) {
+        printf("  VC Extension Unit id=%d "
+               "guid=%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+               "%02x%02x%02x%02x%02x%02x\n",
+               (int) eudesc->bUnitID,
+               (int) eudesc->guidExtensionCode[0],
+               (int) eudesc->guidExtensionCode[1],
+               (int) eudesc->guidExtensionCode[2],
+               (int) eudesc->guidExtensionCode[3],
+               (int) eudesc->guidExtensionCode[4],
+               (int) eudesc->guidExtensionCode[5],
+               (int) eudesc->guidExtensionCode[6],
+               (int) eudesc->guidExtensionCode[7],
+               (int) eudesc->guidExtensionCode[8],
+               (int) eudesc->guidExtensionCode[9],
+               (int) eudesc->guidExtensionCode[10],
+               (int) eudesc->guidExtensionCode[11],
+               (int) eudesc->guidExtensionCode[12],
+               (int) eudesc->guidExtensionCode[13],
+               (int) eudesc->guidExtensionCode[14],
+               (int) eudesc->guidExtensionCode[15]);
+      }
+
+      extractExtensionData(camera, eudesc);
+
+      break; }
+    default:
+      if (display) {
+        printf("  Unknown VC Interface subtype\n");
+      }
+      break;
+    }
+    break; }
+  case CS_ENDPOINT:
+    if (display) {
+      printf("  VC Interrupt Endpoint\n");
+    }
+    break;
+  case VS_LOGITECH_TYPE: {
+    auto* vcdesc = reinterpret_cast<VCDescriptor*>(descriptor);
+    switch (vcdesc->bDescriptorSubType) {
+    case VS_LOGITECH_EXTENSION_UNIT: {
+      auto* eudesc = reinterpret_cast<VCExtensionUnitDescriptor*>(vcdesc);
+      if (display) {
+        printf("  Logitech Extension Unit id=%d "
+               "guid=%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+               "%02x%02x%02x%02x%02x%02x\n",
+               (int) eudesc->bUnitID,
+               (int) eudesc->guidExtensionCode[0],
+               (int) eudesc->guidExtensionCode[1],
+               (int) eudesc->guidExtensionCode[2],
+               (int) eudesc->guidExtensionCode[3],
+               (int) eudesc->guidExtensionCode[4],
+               (int) eudesc->guidExtensionCode[5],
+               (int) eudesc->guidExtensionCode[6],
+               (int) eudesc->guidExtensionCode[7],
+               (int) eudesc->guidExtensionCode[8],
+               (int) eudesc->guidExtensionCode[9],
+               (int) eudesc->guidExtensionCode[10],
+               (int) eudesc->guidExtensionCode[11],
+               (int) eudesc->guidExtensionCode[12],
+               (int) eudesc->guidExtensionCode[13],
+               (int) eudesc->guidExtensionCode[14],
+               (int) eudesc->guidExtensionCode[15]);
+      }
+
+      extractExtensionData(camera, eudesc);
+
+      break; }
+    default:
+      if (display) {
+        printf("  Unknown Logitech subtype\n");
+      }
+    }
+    break; }
+  default:
+    if (display) {
+      printf("  Unknown descriptor type\n");
+    }
+  }
+}
+
+// Returns an invalid Camera if the device has no video interface.
+Camera scanCamera(Storage<IOUSBDeviceInterface187**> device, bool display) {
   USBVideoInterfaces ifaces{device.ref()};
   auto it = ifaces.begin();
   if (it == ifaces.end()) {
-    printf("No video interfaces found\n");
     return {};
   }
   
   Camera camera;
   // Just use the first matching video interface
-  camera.interface = std::move(*it);
+  Storage<IOUSBInterfaceInterface220**> interface = std::move(*it);
   // clean up some state
   it = std::move(ifaces.end());
-  device.release();
+  camera.locationId = getLocationId(device);
+  camera.device = std::move(device);
+  if (display) {
+    printf("Location is 0x%08x\n", camera.locationId);
+  }
                                            
-  hrCheck((*camera.interface)->GetInterfaceNumber(
-            camera.interface.ref(),
-            reinterpret_cast<UInt8*>(&camera.videoInterfaceNumber)),
+  uint8_t videoInterfaceNumber;
+  hrCheck((*interface)->GetInterfaceNumber(
+            interface.ref(),
+            reinterpret_cast<UInt8*>(&videoInterfaceNumber)),
           "GetInterfaceNumber");
   if (display) {
-    printf("Video interface number is %d\n", (int) camera.videoInterfaceNumber);
+    printf("Video interface number is %d\n", (int) videoInterfaceNumber);
   }
 
   for (IOUSBDescriptorHeader *descriptor =
-         (*camera.interface)->FindNextAssociatedDescriptor(
-           camera.interface.ref(), NULL, kUSBAnyDesc);
+         (*interface)->FindNextAssociatedDescriptor(
+           interface.ref(), NULL, kUSBAnyDesc);
        descriptor;
        descriptor =
-         (*camera.interface)->FindNextAssociatedDescriptor(
-           camera.interface.ref(), descriptor, kUSBAnyDesc)) {
-    if (display) {
-      printf("Descriptor len=%d type=%d\n",
-             (int) descriptor->bLength,
-             (int) descriptor->bDescriptorType);
-    }
+         (*interface)->FindNextAssociatedDescriptor(
+           interface.ref(), descriptor, kUSBAnyDesc)) {
+    parseDescriptor(camera, descriptor, display);
+  }
 
-    switch (descriptor->bDescriptorType) {
-    case USB_ENDPOINT_DESCRIPTOR:
-      if (display) {
-        printf("  USB Endpoint\n");
-      }
-      break;
-    case CS_INTERFACE: {
-      auto* vcdesc = reinterpret_cast<VCDescriptor*>(descriptor);
-      switch (vcdesc->bDescriptorSubType) {
-      case VC_HEADER:
-        if (display) {
-          printf("  VC Interface Header\n");
-        }
-        break;
-      case VC_INPUT_TERMINAL: {
-        auto* itdesc = reinterpret_cast<VCInputTerminalDescriptor*>(vcdesc);
-        if (display) {
-          if (itdesc->wTerminalType == ITT_CAMERA) {
-            printf("  VC Camera Terminal id=%d\n", (int) itdesc->bTerminalID);
-          } else {
-            printf("  VC Input Terminal id=%d\n", (int) itdesc->bTerminalID);
-          }
-        }
-        break; }
-      case VC_OUTPUT_TERMINAL: {
-        auto* otdesc = reinterpret_cast<VCOutputTerminalDescriptor*>(vcdesc);
-        if (display) {
-          printf("  VC Output Terminal id=%d\n", (int) otdesc->bTerminalID);
-        }
-        break; }
-      case VC_SELECTOR_UNIT: {
-        auto* sudesc = reinterpret_cast<VCSelectorUnitDescriptor*>(vcdesc);
-        if (display) {
-          printf("  VC Selector Unit id=%d\n", (int) sudesc->bUnitID);
-        }
-        break; }
-      case VC_PROCESSING_UNIT: {
-        auto* pudesc = reinterpret_cast<VCProcessingUnitDescriptor*>(vcdesc);
-        if (display) {
-          printf("  VC Processing Unit id=%d\n", (int) pudesc->bUnitID);
-        }
-        break; }
-      case VC_EXTENSION_UNIT: {
-        auto* eudesc = reinterpret_cast<VCExtensionUnitDescriptor*>(vcdesc);
-        if (display) {
-          printf("  VC Extension Unit id=%d "
-                 "guid=%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
-                 "%02x%02x%02x%02x%02x%02x\n",
-                 (int) eudesc->bUnitID,
-                 (int) eudesc->guidExtensionCode[0],
-                 (int) eudesc->guidExtensionCode[1],
-                 (int) eudesc->guidExtensionCode[2],
-                 (int) eudesc->guidExtensionCode[3],
-                 (int) eudesc->guidExtensionCode[4],
-                 (int) eudesc->guidExtensionCode[5],
-                 (int) eudesc->guidExtensionCode[6],
-                 (int) eudesc->guidExtensionCode[7],
-                 (int) eudesc->guidExtensionCode[8],
-                 (int) eudesc->guidExtensionCode[9],
-                 (int) eudesc->guidExtensionCode[10],
-                 (int) eudesc->guidExtensionCode[11],
-                 (int) eudesc->guidExtensionCode[12],
-                 (int) eudesc->guidExtensionCode[13],
-                 (int) eudesc->guidExtensionCode[14],
-                 (int) eudesc->guidExtensionCode[15]);
-        }
+  camera.transport.reset(
+    new UsbTransport(std::move(interface), videoInterfaceNumber));
+  return std::move(camera);
+}  
 
-        extractExtensionData(camera, eudesc);
+// Setting ORBITCTL_EMULATE to a number replaces the real cameras with
+// that many emulated ones, or to USB paths, like "1-1.1,1-1.2,2-3",
+// puts one at each, to try out a topology.
+std::vector<uint32_t> emulatedLocations() {
+  std::vector<uint32_t> locations;
+  const char* spec = getenv("ORBITCTL_EMULATE");
+  if (!spec) {
+    return locations;
+  }
+  if (strchr(spec, '-') == nullptr) {
+    for (int i = 0; i < atoi(spec); i++) {
+      locations.push_back(OrbitEmulator::location(i));
+    }
+    return locations;
+  }
+  std::istringstream in(spec);
+  std::string path;
+  while (std::getline(in, path, ',')) {
+    uint32_t locationId;
+    if (!parseUsbPath(path, &locationId) ||
+        std::count(locations.begin(), locations.end(), locationId)) {
+      throw std::runtime_error("bad ORBITCTL_EMULATE path " + path);
+    }
+    locations.push_back(locationId);
+  }
+  return locations;
+}
 
-        break; }
-      default:
-        if (display) {
-          printf("  Unknown VC Interface subtype\n");
-        }
-        break;
-      }
-      break; }
-    case CS_ENDPOINT:
-      if (display) {
-        printf("  VC Interrupt Endpoint\n");
-      }
-      break;
-    case VS_LOGITECH_TYPE: {
-      auto* vcdesc = reinterpret_cast<VCDescriptor*>(descriptor);
-      switch (vcdesc->bDescriptorSubType) {
-      case VS_LOGITECH_EXTENSION_UNIT: {
-        auto* eudesc = reinterpret_cast<VCExtensionUnitDescriptor*>(vcdesc);
-        if (display) {
-          printf("  Logitech Extension Unit id=%d "
-                 "guid=%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
-                 "%02x%02x%02x%02x%02x%02x\n",
-                 (int) eudesc->bUnitID,
-                 (int) eudesc->guidExtensionCode[0],
-                 (int) eudesc->guidExtensionCode[1],
-                 (int) eudesc->guidExtensionCode[2],
-                 (int) eudesc->guidExtensionCode[3],
-                 (int) eudesc->guidExtensionCode[4],
-                 (int) eudesc->guidExtensionCode[5],
-                 (int) eudesc->guidExtensionCode[6],
-                 (int) eudesc->guidExtensionCode[7],
-                 (int) eudesc->guidExtensionCode[8],
-                 (int) eudesc->guidExtensionCode[9],
-                 (int) eudesc->guidExtensionCode[10],
-                 (int) eudesc->guidExtensionCode[11],
-                 (int) eudesc->guidExtensionCode[12],
-                 (int) eudesc->guidExtensionCode[13],
-                 (int) eudesc->guidExtensionCode[14],
-                 (int) eudesc->guidExtensionCode[15]);
-        }
+Camera emulatedCamera(uint32_t locationId, bool display) {
+  Camera camera;
+  camera.locationId = locationId;
+  if (display) {
+    printf("Emulated camera, location is 0x%08x\n", locationId);
+  }
 
-        extractExtensionData(camera, eudesc);
+  // Walk the emulator's descriptors the way FindNextAssociatedDescriptor
+  // would.
+  std::vector<uint8_t> descriptors = OrbitEmulator::descriptors();
+  for (size_t i = 0;
+       i + sizeof(IOUSBDescriptorHeader) <= descriptors.size() &&
+         descriptors[i] >= sizeof(IOUSBDescriptorHeader);
+       i += descriptors[i]) {
+    parseDescriptor(
+      camera, reinterpret_cast<IOUSBDescriptorHeader*>(&descriptors[i]),
+      display);
+  }
 
-        break; }
-      default:
-        if (display) {
-          printf("  Unknown Logitech subtype\n");
-        }
-      }
-      break; }
-    default:
-      if (display) {
-        printf("  Unknown descriptor type\n");
-      }
+  camera.transport.reset(new OrbitEmulator());
+  return camera;
+}
+
+std::vector<uint32_t> cameraLocations() {
+  std::vector<uint32_t> locations = emulatedLocations();
+  if (locations.empty()) {
+    for (Storage<IOUSBDeviceInterface187**>& device : getCameras()) {
+      locations.push_back(getLocationId(device));
     }
   }
+  return locations;
+}
 
-  return std::move(camera);
-}  
+// Which camera a command that works without one means: the only one
+// plugged in, or else the only one with its own state file.  Returns
+// 0 if there's no camera to go on, and throws if it's ambiguous.
+uint32_t offlineLocation() {
+  std::vector<uint32_t> locations = cameraLocations();
+  if (locations.size() == 1) {
+    return locations.front();
+  }
+  std::vector<uint32_t> saved = savedCameraStates();
+  if (!locations.empty()) {
+    std::sort(locations.begin(), locations.end());
+    std::vector<uint32_t> both;
+    std::set_intersection(locations.begin(), locations.end(), saved.begin(),
+                          saved.end(), std::back_inserter(both));
+    saved = both;
+  }
+  if (saved.size() > 1) {
+    throw std::runtime_error("more than one camera has state, pick one "
+                             "with -c");
+  }
+  if (saved.empty()) {
+    return locations.empty() ? 0 : locations.front();
+  }
+  return saved.front();
+}
 
-class Request {
-public:
-  // The direction is in terms of what the image appears to do.  So,
-  // up would move the center of the image on the screen in the same
-  // direction as if you dragged the window up.  I don't know what
-  // units these are, but higher number move more.  I haven't wanted
-  // to risk my device to see what happens if you exceed the range of
-  // the mechanism.
-  void panTiltRelative(int8_t left, int8_t up) {
-    LogitechMotorRequest value;
-    memset(&value, 0, sizeof(value));
-    if (left != 0) {
-      value.left = left < 0 ? left : left - 1;
-      value.leftEnable = LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE;
-    }
-    if (up != 0) {
-      value.up = up < 0 ? up : up - 1;
-      value.upEnable = LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE;
-    }
-
-    setData(
-      kMotorUnit,
-      LXU_MOTOR_PANTILT_RELATIVE_CONTROL,
-      &value,
-      sizeof(value));
-  }
-
-  void panTiltReset() {
-    uint8_t value = LXU_MOTOR_PANTILT_RESET_CONTROL_VALUE;
-
-    setData(
-      kMotorUnit,
-      LXU_MOTOR_PANTILT_RESET_CONTROL,
-      &value,
-      sizeof(value));
-  }
-
-  // frequency is in units of 0.05 Hz
-  void ledControl(uint8_t mode, uint16_t frequency) {
-    LogitechLedRequest value =
-      {
-       .mode = mode,
-       .frequency = CFSwapInt16HostToBig(frequency),
-      };
+// Setting ORBITCTL_FAULTS makes every camera's transfers misbehave,
+// as parseFaults describes.
+bool faultConfig(FaultConfig* config) {
+  const char* spec = getenv("ORBITCTL_FAULTS");
+  if (!spec) {
+    return false;
+  }
+  if (!parseFaults(spec, config)) {
+    throw std::runtime_error(std::string("bad ORBITCTL_FAULTS: ") + spec);
+  }
+  return true;
+}
 
-    setData(
-      kHwControlUnit,
-      LXU_HW_CONTROL_LED1,
-      &value,
-      sizeof(value));
+void injectFaults(Camera& camera) {
+  FaultConfig config;
+  if (!camera.isValid() || !faultConfig(&config)) {
+    return;
   }
+  // Different cameras shouldn't fail in lockstep.
+  config.seed += camera.locationId;
+  camera.transport.reset(new FaultyTransport(
+    std::move(camera.transport), config,
+    [](int64_t usec) { usleep(usec); }));
+}
 
-  void send(Camera& camera) {
-    uint8_t unitId;
-    switch (unit_) {
-    case kMotorUnit:
-      unitId = camera.motorUnit;
-      break;
-    case kHwControlUnit:
-      unitId = camera.hwControlUnit;
-      break;
-    default:
-      throw std::runtime_error("Unknown unit");
-    };
+// Returns an invalid Camera if there's no such camera.  A locationId
+// of 0 picks the first camera.
+Camera openCamera(uint32_t locationId, bool display) {
+  Camera camera;
+  std::vector<uint32_t> emulated = emulatedLocations();
+  if (!emulated.empty()) {
+    if (locationId == 0) {
+      locationId = emulated.front();
+    }
+    if (!std::count(emulated.begin(), emulated.end(), locationId)) {
+      return {};
+    }
+    camera = emulatedCamera(locationId, display);
+  } else {
+    Storage<IOUSBDeviceInterface187**> device = getCamera(locationId);
+    if (!device.isValid()) {
+      return {};
+    }
+    camera = scanCamera(std::move(device), display);
+  }
+  injectFaults(camera);
+  return camera;
+}
+
+void printFaultStats(const FaultStats& stats) {
+  fprintf(stderr,
+          "faults: requests %llu delayed %.1fms tails %llu stalls %llu "
+          "timeouts %llu short %llu disconnected %llu\n",
+          static_cast<unsigned long long>(stats.requests),
+          stats.delayedUsec / 1000.0,
+          static_cast<unsigned long long>(stats.tails),
+          static_cast<unsigned long long>(stats.stalls),
+          static_cast<unsigned long long>(stats.timeouts),
+          static_cast<unsigned long long>(stats.shorts),
+          static_cast<unsigned long long>(stats.disconnected));
+}
 
-    sendControlRequest(
-      camera.interface.ref(),
-      camera.videoInterfaceNumber,
-      unitId,
-      selector_,
-      data_,
-      length_);
+void printFaultStats(const Camera& camera) {
+  auto* faults = dynamic_cast<FaultyTransport*>(camera.transport.get());
+  if (faults) {
+    printFaultStats(faults->stats());
   }
+}
 
-private:
-  enum Unit { kMotorUnit, kHwControlUnit } unit_;
+// A locationId of 0 picks the first camera.
+Camera scanDescriptors(bool display, uint32_t locationId) {
+  Camera camera = openCamera(locationId, display);
+  if (!camera.isValid()) {
+    printf("No Logitech Orbit AF found\n");
+  }
+  return camera;
+}
 
-  void setData(Unit unit, uint8_t selector, void *data, uint16_t length) {
-    if (length > sizeof(data_)) {
-      throw std::runtime_error("length cannot exceed " +
-                               std::to_string(sizeof(data_)));
+std::vector<Camera> scanCameras() {
+  std::vector<Camera> cameras;
+  for (uint32_t locationId : cameraLocations()) {
+    Camera camera = openCamera(locationId, false);
+    if (camera.isValid()) {
+      cameras.push_back(std::move(camera));
     }
-    unit_ = unit;
-    selector_ = selector;
-    memcpy(data_, data, length);
-    length_ = length;
   }
+  return cameras;
+}
 
-  uint8_t selector_;
-  uint8_t data_[32];
-  uint16_t length_;
-};
+// Resets the camera's port and has it enumerated again, as if it had
+// been unplugged.  The Camera can't be used after this.
+void reenumerate(Camera& camera) {
+  camera.transport.reset();
+  if (!camera.device.isValid()) {
+    // Emulated cameras come back on their own.
+    return;
+  }
+  IOUSBDeviceInterface187** device = camera.device.ref();
+  // Re-enumerating needs the device open, but if something else has
+  // it open, it's still worth trying.
+  (*device)->USBDeviceOpen(device);
+  IOReturn result = (*device)->USBDeviceReEnumerate(device, 0);
+  (*device)->USBDeviceClose(device);
+  camera.device.release();
+  hrCheck(result, "USBDeviceReEnumerate");
+}
 
 void Camera::send(Request& req) {
-  req.send(*this);
+  req.send(*transport, motorUnit, hwControlUnit);
+}
+
+// The camera ignores moves on an axis which is resetting.
+void waitForReset(const PositionState& state,
+                  const std::vector<Move>& moves) {
+  int64_t until = 0;
+  for (const Move& move : moves) {
+    if (move.left != 0) {
+      until = std::max(until, state.pan.resetUntilUsec);
+    }
+    if (move.up != 0) {
+      until = std::max(until, state.tilt.resetUntilUsec);
+    }
+  }
+  int64_t now = wallClockUsec();
+  if (until > now) {
+    usleep(until - now);
+  }
+}
+
+// Sends a plan's moves, letting each finish before starting the next.
+void sendMoves(Camera& camera, const PositionState& state,
+               const std::vector<Move>& moves) {
+  waitForReset(state, moves);
+  for (size_t i = 0; i < moves.size(); i++) {
+    if (i > 0) {
+      usleep(moveTimeUsec(moves[i - 1]));
+    }
+    Request req;
+    req.panTiltRelative(moves[i].left, moves[i].up);
+    camera.send(req);
+  }
+}
+
+}
+
+int64_t nowUsec() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool probe(Camera& camera) {
+  // A camera which didn't come back has nothing to send through.
+  if (!camera.isValid()) {
+    return false;
+  }
+  try {
+    Request req;
+    req.probe();
+    camera.send(req);
+    return req.length() == 1;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Puts the camera back the way it was before it was reset.
+void restore(Camera& camera, PositionState& state) {
+  if (state.ledMode >= 0) {
+    Request req;
+    req.ledControl(state.ledMode, state.ledFrequency);
+    camera.send(req);
+  }
+
+  // The mechanism may or may not have moved when the camera came
+  // back, so reset it to be sure and go back to where it was.
+  bool wasHomed = state.homed();
+  int pan = state.pan.position;
+  int tilt = state.tilt.position;
+  Request req;
+  req.panTiltReset();
+  camera.send(req);
+  state.reset(true, true, wallClockUsec());
+  if (wasHomed) {
+    sendMoves(camera, state, planAbsolute(state, pan, tilt));
+  }
 }
 
+// How long a camera gets to come back after re-enumerating.
+constexpr int64_t kReenumerateTimeoutUsec = 10000000;
+constexpr int64_t kRescanIntervalUsec = 500000;
+
+bool recover(Camera& camera) {
+  uint32_t locationId = camera.locationId;
+  printf("0x%08x is not responding, resetting it\n", locationId);
+  try {
+    reenumerate(camera);
+  } catch (const std::exception& ex) {
+    printf("0x%08x: %s\n", locationId, ex.what());
+  }
+
+  for (int64_t waited = 0; waited < kReenumerateTimeoutUsec;
+       waited += kRescanIntervalUsec) {
+    usleep(kRescanIntervalUsec);
+    try {
+      // The camera keeps its location while this fails, so it can be
+      // tried again later.
+      Camera reopened = openCamera(locationId, false);
+      if (!reopened.isValid() || !probe(reopened)) {
+        continue;
+      }
+      PositionState state = loadCameraState(locationId);
+      restore(reopened, state);
+      savePositionState(statePath(locationId), state);
+      camera = std::move(reopened);
+      printf("0x%08x recovered\n", locationId);
+      return true;
+    } catch (const std::exception& ex) {
+      printf("0x%08x: %s\n", locationId, ex.what());
+    }
+  }
+
+  printf("0x%08x did not come back\n", locationId);
+  return false;
+}
+
+// Checks every camera in turn, and recovers any which stop
+// responding.  Recovery takes a while, so it happens on its own
+// thread, and the other cameras keep being checked meanwhile.
+void watch(int intervalSec) {
+  struct Watched {
+    Camera camera;
+    std::thread recovery;
+    std::atomic<bool> done{false};
+    bool ok = false;
+  };
+
+  std::vector<std::unique_ptr<Watched>> cameras;
+  for (Camera& camera : scanCameras()) {
+    cameras.emplace_back(new Watched);
+    cameras.back()->camera = std::move(camera);
+  }
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+  printf("Watching %d cameras\n", static_cast<int>(cameras.size()));
+
+  // Recoveries say when they're done, so nothing has to wake up to
+  // look for them.
+  std::mutex mutex;
+  std::condition_variable finished;
+  auto anyFinished = [&cameras]() {
+    for (std::unique_ptr<Watched>& w : cameras) {
+      if (w->recovery.joinable() && w->done) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  HealthMonitor monitor(cameras.size(), intervalSec * 1000000LL, nowUsec());
+  while (true) {
+    for (size_t i = 0; i < cameras.size(); i++) {
+      Watched& w = *cameras[i];
+      if (w.recovery.joinable() && w.done) {
+        w.recovery.join();
+        monitor.recovered(i, w.ok, nowUsec());
+      }
+    }
+
+    // Sleep until the next check, or until a recovery finishes.
+    size_t i;
+    int64_t when;
+    bool checking = monitor.next(&i, &when);
+    int64_t now = nowUsec();
+    if (!checking || when > now) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (checking) {
+        finished.wait_for(lock, std::chrono::microseconds(when - now),
+                          anyFinished);
+      } else {
+        finished.wait(lock, anyFinished);
+      }
+      continue;
+    }
+
+    Watched& w = *cameras[i];
+    if (monitor.report(i, probe(w.camera), nowUsec())) {
+      w.done = false;
+      w.recovery = std::thread([&w, &mutex, &finished]() {
+        w.ok = recover(w.camera);
+        std::lock_guard<std::mutex> lock(mutex);
+        w.done = true;
+        finished.notify_one();
+      });
+    }
+  }
 }
 
 void usage() {
   fprintf(stderr,
-          "usage: orbitctl cmd [opts ...]\n"
+          "usage: orbitctl [-c location] cmd [opts ...]\n"
+          "  list\n"
+          "  watch [interval_s]\n"
+          "  serve [shards]\n"
+          "  listen [shards]\n"
+          "  visca [port [address]]\n"
+          "  osc [port [address]]\n"
+          "  http [port]\n"
+          "  agent [port [address]]\n"
+          "  cluster host[:port] ...\n"
+          "  scene save | recall name\n"
+          "  simulate cameras hours [seed]\n"
           "  scan\n"
-          "  reset\n"
-          "  pan left | right\n"
-          "  tilt up | down\n"
+          "  reset [pan | tilt | auto]\n"
+          "  pan left | right [steps]\n"
+          "  tilt up | down [steps]\n"
+          "  goto pan tilt\n"
+          "  position\n"
+          "  backlash pan | tilt steps\n"
+          "  backlash policy takeup | approach\n"
+          "  place x y z yaw pitch [pan_degrees tilt_degrees]\n"
+          "  tour number [preset ... | optimise | clear]\n"
+          "  measure before.pgm after.pgm\n"
+          "  track [eval sequence [latency_ms]]\n"
+          "  reframe frame_width frame_height view_width view_height\n"
           "  led on | off | auto\n");
   exit(1);
 }
 
+int parseInt(const char* arg) {
+  char* end;
+  long value = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || value < -100000 || value > 100000) {
+    usage();
+  }
+  return static_cast<int>(value);
+}
+
+double parseDouble(const char* arg) {
+  char* end;
+  double value = strtod(arg, &end);
+  if (*arg == '\0' || *end != '\0' || !isfinite(value)) {
+    usage();
+  }
+  return value;
+}
+
+uint32_t parseLocation(const char* arg) {
+  uint32_t locationId;
+  if (!::parseLocation(std::string(arg), &locationId)) {
+    usage();
+  }
+  return locationId;
+}
+
+int parseSteps(int argc, char *argv[], int index) {
+  if (argc <= index) {
+    return 1;
+  }
+  int steps = parseInt(argv[index]);
+  if (steps <= 0) usage();
+  return steps;
+}
+
+// Reads detections from stdin, one "dx dy" line per frame giving the
+// target's offset from the middle of the frame, and follows it.
+void track(Camera& camera, PositionState& state) {
+  Tracker tracker(state.pan.pixelsPerStep, state.tilt.pixelsPerStep,
+                  LatencyModel(), true);
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    double dx, dy;
+    if (sscanf(line.c_str(), "%lf %lf", &dx, &dy) != 2) {
+      continue;
+    }
+    int64_t now = nowUsec();
+    Move move;
+    if (tracker.update(now, dx, dy, now, &move)) {
+      sendMoves(camera, state, planRelative(state, move.left, move.up));
+    }
+  }
+}
+
+// Reads lines from stdin which either move the view, "move dx dy", or
+// produce a view from a frame, "frame in.pgm out.pgm".  The view is
+// moved digitally right away, and the camera follows.
+void reframe(Camera& camera, PositionState& state, int frameWidth,
+             int frameHeight, int viewWidth, int viewHeight) {
+  HybridPanTilt view(state.pan.pixelsPerStep, state.tilt.pixelsPerStep,
+                     (frameWidth - viewWidth) / 2.0,
+                     (frameHeight - viewHeight) / 2.0, LatencyModel());
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream words(line);
+    std::string verb;
+    words >> verb;
+    if (verb == "move") {
+      double dx, dy;
+      if (words >> dx >> dy) {
+        view.reframe(dx, dy);
+      }
+    } else if (verb == "frame") {
+      std::string in, out;
+      if (!(words >> in >> out)) {
+        continue;
+      }
+      Image frame = readPgm(in);
+      if (frame.width != frameWidth || frame.height != frameHeight) {
+        throw std::runtime_error(in + " is not the expected size");
+      }
+      double x, y;
+      view.window(nowUsec(), &x, &y);
+      writePgm(out, resample(frame, (frameWidth - viewWidth) / 2.0 + x,
+                             (frameHeight - viewHeight) / 2.0 + y, 1,
+                             viewWidth, viewHeight));
+    }
+
+    Move move;
+    if (view.update(nowUsec(), &move)) {
+      sendMoves(camera, state, planRelative(state, move.left, move.up));
+    }
+  }
+}
+
+void evaluate(const char* path, int latencyMs, const PositionState& state) {
+  std::vector<TargetSample> sequence = readSequence(path);
+  // Without a measurement, any scale will do for comparing.
+  double pixelsPerStep =
+    state.pan.pixelsPerStep != 0 ? state.pan.pixelsPerStep : 4;
+  LatencyModel model;
+  LatencyModel actual;
+  if (latencyMs >= 0) {
+    actual.commandUsec = latencyMs * 1000;
+  }
+  for (bool predict : {false, true}) {
+    TrackingStats stats =
+      evaluateTracking(sequence, pixelsPerStep, actual, model, predict);
+    printf("%-10s rms error %.1f max error %.1f moves %d dropped %d\n",
+           predict ? "predictive" : "reactive", stats.rmsError,
+           stats.maxError, stats.moves, stats.dropped);
+  }
+}
+
+std::vector<ControlledCamera> controlledCameras() {
+  std::vector<ControlledCamera> cameras;
+  for (Camera& camera : scanCameras()) {
+    cameras.push_back(ControlledCamera{camera.locationId,
+                                       std::move(camera.transport),
+                                       camera.motorUnit,
+                                       camera.hwControlUnit});
+  }
+  return cameras;
+}
+
+// Reads "aim x y z location ..." or "aim x y z all", pointing each
+// camera, or every placed one, at the point.  Returns false if the line
+// isn't one, or names a camera which hasn't been placed.
+bool parseAim(const std::string& line,
+              const std::map<uint32_t, Placement>& placements,
+              std::vector<SyncTarget>* targets) {
+  std::istringstream in(line);
+  std::string kind, location;
+  double x, y, z;
+  if (!(in >> kind >> x >> y >> z) || kind != "aim") {
+    return false;
+  }
+  std::vector<uint32_t> locations;
+  while (in >> location) {
+    if (location == "all") {
+      for (const auto& placement : placements) {
+        locations.push_back(placement.first);
+      }
+      continue;
+    }
+    uint32_t locationId;
+    if (!::parseLocation(location, &locationId) ||
+        !placements.count(locationId)) {
+      return false;
+    }
+    locations.push_back(locationId);
+  }
+
+  targets->clear();
+  for (uint32_t locationId : locations) {
+    SyncTarget target{locationId, 0, 0};
+    aimAt(placements.at(locationId), &x, &y, &z, 1, &target.pan,
+          &target.tilt);
+    targets->push_back(target);
+  }
+  return !targets->empty();
+}
+
+// Runs a resident controller for every camera, taking commands a line
+// at a time from stdin, as parseControlCommand describes.
+void serve(int shards) {
+  std::vector<ControlledCamera> cameras = controlledCameras();
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+
+  // Placements only change with place, so they're read once.
+  std::map<uint32_t, Placement> placements;
+  for (const ControlledCamera& camera : cameras) {
+    PositionState state = loadCameraState(camera.locationId);
+    if (state.placed) {
+      placements[camera.locationId] = state.placement;
+    }
+  }
+
+  size_t count = cameras.size();
+  Controller controller(std::move(cameras), shards);
+  printf("Serving %d cameras on %d threads\n", static_cast<int>(count),
+         static_cast<int>(controller.shards()));
+  fflush(stdout);
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::vector<SyncTarget> targets;
+    if (line.compare(0, 4, "aim ") == 0 &&
+        !parseAim(line, placements, &targets)) {
+      printf("bad aim: %s\n", line.c_str());
+      fflush(stdout);
+      continue;
+    }
+    if (!targets.empty() || parseSyncCommand(line, &targets)) {
+      bool ok = controller.synchronize(targets, [targets](const SyncReply& r) {
+        std::string out;
+        for (size_t i = 0; i < targets.size(); i++) {
+          out += formatControlReply(targets[i].locationId, r.cameras[i]) +
+            "\n";
+        }
+        printf("%ssync skew %.3fms\n", out.c_str(), r.skewUsec / 1000.0);
+        fflush(stdout);
+      });
+      if (!ok) {
+        printf("sync error unknown or repeated camera\n");
+        fflush(stdout);
+      }
+      continue;
+    }
+
+    ControlCommand command;
+    if (!parseControlCommand(line, &command)) {
+      printf("bad command: %s\n", line.c_str());
+      fflush(stdout);
+      continue;
+    }
+    uint32_t locationId = command.locationId;
+    bool ok = controller.submit(command, [locationId](const ControlReply& r) {
+      // Replies come from the workers, so each is printed in one go.
+      printf("%s\n", formatControlReply(locationId, r).c_str());
+      fflush(stdout);
+    });
+    if (!ok) {
+      printf("0x%08x error unknown camera or too busy\n", locationId);
+      fflush(stdout);
+    }
+  }
+}
+
+// The server to stop when an upgrade is asked for.
+WireServer* listeningServer = nullptr;
+volatile sig_atomic_t upgradeRequested = 0;
+
+void requestUpgrade(int) {
+  upgradeRequested = 1;
+  if (listeningServer) {
+    listeningServer->stop();
+  }
+}
+
+// The cameras a handoff was about, opened again by location.  IOKit
+// handles can't be passed to another process, but opening a camera
+// doesn't disturb it the way re-enumerating would.
+std::vector<ControlledCamera> reopenCameras(const Handoff& handoff) {
+  std::vector<ControlledCamera> cameras;
+  for (const CameraSnapshot& snapshot : handoff.cameras) {
+    Camera camera = openCamera(snapshot.locationId, false);
+    if (camera.isValid()) {
+      cameras.push_back(ControlledCamera{camera.locationId,
+                                         std::move(camera.transport),
+                                         camera.motorUnit,
+                                         camera.hwControlUnit});
+    }
+  }
+  return cameras;
+}
+
+// Hands everything to a new copy of orbitctl, and returns false if it
+// didn't take over.
+bool handOver(char* argv[], const Handoff& handoff) {
+  pid_t pid;
+  int channel = spawnSuccessor(argv, &pid);
+  bool ok = false;
+  try {
+    sendHandoff(channel, handoff);
+    ok = waitForSuccessor(channel, 30000);
+  } catch (const std::exception& ex) {
+    fprintf(stderr, "handoff failed: %s\n", ex.what());
+  }
+  close(channel);
+  if (!ok) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  return ok;
+}
+
+// The same, but taking binary commands from other processes on a unix
+// domain socket, until it's killed.  SIGUSR2 hands the socket, the
+// clients and the cameras to a freshly started orbitctl, for upgrades.
+void listenSocket(int shards, char* argv[]) {
+  std::string path = defaultSocketPath();
+  int channel = handoffChannel();
+  Handoff handoff;
+  std::vector<ControlledCamera> cameras;
+  if (channel >= 0) {
+    handoff = receiveHandoff(channel);
+    cameras = reopenCameras(handoff);
+  } else {
+    cameras = controlledCameras();
+    if (cameras.empty()) {
+      printf("No Logitech Orbit AF found\n");
+      return;
+    }
+  }
+
+  for (;;) {
+    size_t count = cameras.size();
+    std::unique_ptr<Controller> controller(
+      new Controller(std::move(cameras), shards, handoff.cameras));
+    std::unique_ptr<WireServer> server(
+      handoff.listenFd >= 0
+      ? new WireServer(*controller, path, handoff.listenFd)
+      : new WireServer(*controller, path));
+    for (const auto& connection : handoff.connections) {
+      server->adopt(connection.first, connection.second);
+    }
+    if (channel >= 0) {
+      handoffDone(channel);
+      close(channel);
+      channel = -1;
+    }
+    printf("Serving %d cameras on %d threads at %s\n",
+           static_cast<int>(count), static_cast<int>(controller->shards()),
+           path.c_str());
+    fflush(stdout);
+
+    listeningServer = server.get();
+    signal(SIGUSR2, requestUpgrade);
+    server->run();
+    signal(SIGUSR2, SIG_DFL);
+    listeningServer = nullptr;
+    if (!upgradeRequested) {
+      controller.reset();
+      return;
+    }
+    upgradeRequested = 0;
+
+    // The controller goes first, so the last acks are queued and the
+    // cameras are closed before the new process opens them.
+    handoff = Handoff();
+    handoff.cameras = controller->detach();
+    controller.reset();
+    server->release(&handoff.listenFd, &handoff.connections);
+    server.reset();
+    if (handOver(argv, handoff)) {
+      return;
+    }
+    fprintf(stderr, "upgrade failed, carrying on\n");
+    cameras = reopenCameras(handoff);
+  }
+}
+
+// The cameras' locations, in order, for numbering them.
+std::vector<uint32_t> sortedLocations(
+  const std::vector<ControlledCamera>& cameras) {
+  std::vector<uint32_t> locations;
+  for (const ControlledCamera& camera : cameras) {
+    locations.push_back(camera.locationId);
+  }
+  std::sort(locations.begin(), locations.end());
+  return locations;
+}
+
+// Lets VISCA controllers drive every camera, the first on port, the
+// next on port + 1, and so on, until it's killed.
+void visca(int port, const std::string& address) {
+  std::vector<ControlledCamera> cameras = controlledCameras();
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+
+  std::vector<uint32_t> locations = sortedLocations(cameras);
+  std::unique_ptr<Controller> controller(
+    new Controller(std::move(cameras), 0));
+  ViscaGateway gateway(*controller, locations, address, port);
+  for (size_t i = 0; i < locations.size(); i++) {
+    printf("0x%08x on %s port %d\n", locations[i], address.c_str(),
+           static_cast<int>(port + i));
+  }
+  fflush(stdout);
+  gateway.run();
+  controller.reset();
+}
+
+// Takes OSC messages for every camera on one UDP port, until it's
+// killed.
+void osc(int port, const std::string& address) {
+  std::vector<ControlledCamera> cameras = controlledCameras();
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+
+  std::vector<uint32_t> locations = sortedLocations(cameras);
+  std::unique_ptr<Controller> controller(
+    new Controller(std::move(cameras), 0));
+  OscGateway gateway(*controller, locations, address, port);
+  for (size_t i = 0; i < locations.size(); i++) {
+    printf("0x%08x is /cam/%d\n", locations[i], static_cast<int>(i + 1));
+  }
+  printf("Listening on %s port %d\n", address.c_str(), port);
+  fflush(stdout);
+  gateway.run();
+  controller.reset();
+}
+
+// Serves HTTP and a WebSocket stream on the loopback interface, until
+// it's killed.
+void http(int port) {
+  std::vector<ControlledCamera> cameras = controlledCameras();
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+
+  std::vector<CameraInfo> info;
+  for (const ControlledCamera& camera : cameras) {
+    info.push_back(CameraInfo{camera.locationId, camera.motorUnit,
+                              camera.hwControlUnit});
+  }
+  std::unique_ptr<Controller> controller(
+    new Controller(std::move(cameras), 0));
+  HttpServer server(*controller, info, port);
+  printf("Serving %d cameras at http://127.0.0.1:%d/cameras\n",
+         static_cast<int>(info.size()), port);
+  fflush(stdout);
+  server.run();
+  controller.reset();
+}
+
+// Serves the binary protocol over TCP, for a cluster coordinator on
+// another host, until it's killed.
+void agent(int port, const std::string& address) {
+  std::vector<ControlledCamera> cameras = controlledCameras();
+  if (cameras.empty()) {
+    printf("No Logitech Orbit AF found\n");
+    return;
+  }
+
+  size_t count = cameras.size();
+  std::unique_ptr<Controller> controller(
+    new Controller(std::move(cameras), 0));
+  std::unique_ptr<WireServer> server(
+    new WireServer(*controller, "", listenWireTcp(address, port)));
+  printf("Serving %d cameras on %s port %d\n", static_cast<int>(count),
+         address.c_str(), port);
+  fflush(stdout);
+  server->run();
+  controller.reset();
+}
+
+// Drives the cameras on every agent, taking commands from stdin like
+// serve, but naming the cameras as Cluster::select describes, so
+// "all led on" or "1/0xfa120000,2/0xfa120000 goto 0 0" reaches many
+// at once.
+void cluster(const std::vector<std::string>& agents) {
+  // Replies come from a thread per agent.
+  std::mutex mutex;
+  std::condition_variable replied;
+  size_t outstanding = 0;
+  Cluster cluster(agents);
+  std::vector<std::string> names(agents.size());
+  for (const ClusterCamera& camera : cluster.cameras()) {
+    names[camera.agent] += " " + cluster.name(camera);
+  }
+  for (size_t i = 0; i < agents.size(); i++) {
+    printf("%s:%s\n", agents[i].c_str(),
+           names[i].empty() ? " no cameras" : names[i].c_str());
+  }
+  fflush(stdout);
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream in(line);
+    std::string targets, action;
+    std::vector<size_t> cameras;
+    ControlCommand command;
+    if (!(in >> targets) || !std::getline(in, action) ||
+        !cluster.select(targets, &cameras) ||
+        !parseControlAction(action, &command)) {
+      std::lock_guard<std::mutex> lock(mutex);
+      printf("bad command: %s\n", line.c_str());
+      fflush(stdout);
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      outstanding += cameras.size();
+    }
+    bool ok = cluster.submit(
+      cameras, command,
+      [&](const ClusterCamera& camera, const ControlReply& r) {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The reply, with the camera's cluster name in place of its
+        // location.
+        std::string reply = formatControlReply(camera.locationId, r);
+        printf("%s%s\n", cluster.name(camera).c_str(),
+               reply.substr(reply.find(' ')).c_str());
+        fflush(stdout);
+        if (--outstanding == 0) {
+          replied.notify_all();
+        }
+      });
+    if (!ok) {
+      std::lock_guard<std::mutex> lock(mutex);
+      outstanding -= cameras.size();
+      printf("can't send to an agent: %s\n", line.c_str());
+      fflush(stdout);
+    }
+  }
+
+  // Everything sent gets its reply before the agents are let go.
+  std::unique_lock<std::mutex> lock(mutex);
+  replied.wait(lock, [&outstanding]() { return outstanding == 0; });
+}
+
+// Saves where every homed camera is, and its LED, as the named scene.
+void saveCurrentScene(const std::string& name) {
+  std::vector<SceneCamera> scene;
+  for (uint32_t locationId : cameraLocations()) {
+    PositionState state = loadCameraState(locationId);
+    if (!state.homed()) {
+      printf("0x%08x position is unknown, left out\n", locationId);
+      continue;
+    }
+    scene.push_back(SceneCamera{locationId, state.pan.position,
+                                state.tilt.position, state.ledMode});
+  }
+  if (scene.empty()) {
+    throw std::runtime_error("no homed cameras to save");
+  }
+  saveScene(scenePath(name), scene);
+  printf("Saved %d cameras as %s\n", static_cast<int>(scene.size()),
+         name.c_str());
+}
+
+// Puts every camera in the named scene back, all at once.  Each
+// shard's worker plans its own cameras' moves from where they are, and
+// the recall is done once the slowest camera has stopped.
+void recallScene(const std::string& name) {
+  std::vector<SceneCamera> scene = loadScene(scenePath(name));
+  // Replies come from the workers.
+  std::mutex mutex;
+  std::condition_variable replied;
+  size_t outstanding = 0;
+  int64_t settledUsec = 0;
+  uint32_t slowest = 0;
+  bool failed = false;
+  Controller controller(controlledCameras(), 0);
+  auto submit = [&](const ControlCommand& command) {
+    uint32_t locationId = command.locationId;
+    bool quiet = command.kind == ControlCommand::kLed;
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = controller.submit(
+      command, [&, locationId, quiet](const ControlReply& r) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!r.ok || !quiet) {
+        printf("%s\n", formatControlReply(locationId, r).c_str());
+      }
+      failed |= !r.ok;
+      if (r.settledUsec > settledUsec) {
+        settledUsec = r.settledUsec;
+        slowest = locationId;
+      }
+      if (--outstanding == 0) {
+        replied.notify_all();
+      }
+    });
+    if (ok) {
+      outstanding++;
+    } else {
+      printf("0x%08x error unknown camera or too busy\n", locationId);
+      failed = true;
+    }
+  };
+
+  int64_t startUsec = wallClockUsec();
+  for (const SceneCamera& camera : scene) {
+    if (camera.ledMode >= 0) {
+      submit(ControlCommand{ControlCommand::kLed, camera.locationId,
+                            camera.ledMode, 0});
+    }
+    submit(ControlCommand{ControlCommand::kGoto, camera.locationId,
+                          camera.pan, camera.tilt});
+  }
+
+  // A plan's reply comes with its last move, so after the last reply
+  // it's only a matter of waiting for the slowest camera.
+  std::unique_lock<std::mutex> lock(mutex);
+  replied.wait(lock, [&outstanding]() { return outstanding == 0; });
+  int64_t waitUsec = settledUsec - wallClockUsec();
+  if (waitUsec > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(waitUsec));
+  }
+  printf("Scene %s %s in %.2fs", name.c_str(),
+         failed ? "partly recalled" : "recalled",
+         (std::max(settledUsec, startUsec) - startUsec) / 1e6);
+  if (slowest != 0) {
+    printf(", slowest 0x%08x", slowest);
+  }
+  printf("\n");
+  if (failed) {
+    throw std::runtime_error("some cameras didn't move");
+  }
+}
+
+void simulate(int cameras, int hours, int seed) {
+  FleetConfig config;
+  config.cameras = cameras;
+  config.durationUsec = hours * 3600 * 1000000LL;
+  config.seed = seed;
+  config.injectFaults = faultConfig(&config.faults);
+  FleetStats stats = simulateFleet(config);
+  printf("events %llu requests %llu failed %llu\n",
+         static_cast<unsigned long long>(stats.events),
+         static_cast<unsigned long long>(stats.requests),
+         static_cast<unsigned long long>(stats.failedRequests));
+  printf("latency p50 %.1fms p99 %.1fms max %.1fms\n",
+         stats.latencyP50Usec / 1000.0, stats.latencyP99Usec / 1000.0,
+         stats.latencyMaxUsec / 1000.0);
+  printf("plans %llu mean error %.2f max error %.2f mean time %.2fs\n",
+         static_cast<unsigned long long>(stats.plans), stats.meanError,
+         stats.maxError, stats.meanPlanUsec / 1e6);
+  printf("dropped moves %llu\n",
+         static_cast<unsigned long long>(stats.droppedMoves));
+  printf("unplugs %llu recoveries %llu failed %llu mean detection %.1fs\n",
+         static_cast<unsigned long long>(stats.unplugs),
+         static_cast<unsigned long long>(stats.recoveries),
+         static_cast<unsigned long long>(stats.failedRecoveries),
+         stats.meanDetectUsec / 1e6);
+  if (config.injectFaults) {
+    printFaultStats(stats.faults);
+  }
+}
+
+bool saveState(const std::string& path, const PositionState& state) {
+  try {
+    savePositionState(path, state);
+  } catch (const std::exception& ex) {
+    std::cout << "Failure: " << ex.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
+  // Skip over the options, so the command is always argv[1].
+  uint32_t locationId = 0;
+  if (argc >= 3 && std::string(argv[1]) == "-c") {
+    locationId = parseLocation(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
   if (argc < 2) usage();
 
-  Request req;
+  std::string cmd = argv[1];
+  if (cmd == "list" || cmd == "watch" || cmd == "serve" ||
+      cmd == "listen" || cmd == "visca" || cmd == "osc" ||
+      cmd == "http" || cmd == "agent" || cmd == "cluster" ||
+      cmd == "scene" || cmd == "simulate") {
+    if (locationId != 0) usage();
+    try {
+      if (cmd == "list") {
+        if (argc != 2) usage();
+        for (uint32_t location : cameraLocations()) {
+          printf("0x%08x %s\n", location, usbPath(location).c_str());
+        }
+      } else if (cmd == "serve" || cmd == "listen") {
+        if (argc > 3) usage();
+        int shards = argc == 3 ? parseInt(argv[2]) : 0;
+        if (shards < 0) usage();
+        if (cmd == "serve") {
+          serve(shards);
+        } else {
+          listenSocket(shards, argv);
+        }
+      } else if (cmd == "visca" || cmd == "osc") {
+        if (argc > 4) usage();
+        int port = argc >= 3 ? parseInt(argv[2])
+          : cmd == "visca" ? kViscaPort : kOscPort;
+        if (port <= 0 || port > 65535) usage();
+        std::string address = argc == 4 ? argv[3] : "127.0.0.1";
+        if (cmd == "visca") {
+          visca(port, address);
+        } else {
+          osc(port, address);
+        }
+      } else if (cmd == "http") {
+        if (argc > 3) usage();
+        int port = argc == 3 ? parseInt(argv[2]) : 8080;
+        if (port <= 0 || port > 65535) usage();
+        http(port);
+      } else if (cmd == "agent") {
+        if (argc > 4) usage();
+        int port = argc >= 3 ? parseInt(argv[2]) : kWirePort;
+        if (port <= 0 || port > 65535) usage();
+        agent(port, argc == 4 ? argv[3] : "127.0.0.1");
+      } else if (cmd == "cluster") {
+        if (argc < 3) usage();
+        cluster(std::vector<std::string>(argv + 2, argv + argc));
+      } else if (cmd == "scene") {
+        if (argc != 4) usage();
+        std::string action = argv[2];
+        if (action == "save") {
+          saveCurrentScene(argv[3]);
+        } else if (action == "recall") {
+          recallScene(argv[3]);
+        } else {
+          usage();
+        }
+      } else if (cmd == "simulate") {
+        if (argc < 4 || argc > 5) usage();
+        int cameras = parseInt(argv[2]);
+        int hours = parseInt(argv[3]);
+        int seed = argc == 5 ? parseInt(argv[4]) : 1;
+        if (cameras <= 0 || hours <= 0) usage();
+        simulate(cameras, hours, seed);
+      } else {
+        if (argc > 3) usage();
+        int interval = argc == 3 ? parseInt(argv[2]) : 10;
+        if (interval <= 0) usage();
+        watch(interval);
+      }
+    } catch (const std::exception& ex) {
+      std::cout << "Failure: " << ex.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  // Each camera has its own state, so find out which one this is.
+  // Commands that only read or edit the state don't need a camera
+  // plugged in, if it's clear whose state is meant.
+  bool offline = cmd == "position" || cmd == "measure" ||
+                 cmd == "backlash" || cmd == "place" || cmd == "tour" ||
+                 (cmd == "track" && argc > 2);
+  std::string statePath;
+  PositionState state;
+  try {
+    if (locationId == 0 && offline) {
+      locationId = offlineLocation();
+    }
+    if (locationId == 0 && offline) {
+      // Nothing's plugged in and no camera has its own state yet.
+      statePath = defaultStatePath();
+      state = loadPositionState(statePath);
+    } else {
+      if (locationId == 0) {
+        std::vector<uint32_t> locations = cameraLocations();
+        if (locations.empty()) {
+          printf("No Logitech Orbit AF found\n");
+          return 1;
+        }
+        locationId = locations.front();
+      }
+      statePath = ::statePath(locationId);
+      state = loadCameraState(locationId);
+    }
+  } catch (const std::exception& ex) {
+    std::cout << "Failure: " << ex.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<Request> reqs;
+  std::vector<Move> moves;
   bool display = false;
+  bool moved = false;
+  bool changed = false;
+  bool tracking = false;
+  bool reframing = false;
+  int reframeSize[4];
 
-  std::string cmd = argv[1];
   if (cmd == "scan") {
     display = true;
   } else if (cmd == "reset") {
-    if (argc != 2) usage();
-    req.panTiltReset();
+    if (argc != 2 && argc != 3) usage();
+    std::string axes = argc == 3 ? argv[2] : "both";
+    bool pan = true;
+    bool tilt = true;
+    if (axes == "pan") {
+      tilt = false;
+    } else if (axes == "tilt") {
+      pan = false;
+    } else if (axes == "auto") {
+      resetNeeded(state, &pan, &tilt);
+      if (!pan && !tilt) {
+        printf("No reset needed\n");
+        return 0;
+      }
+      printf("Resetting%s%s\n", pan ? " pan" : "", tilt ? " tilt" : "");
+    } else if (axes != "both") {
+      usage();
+    }
+    reqs.emplace_back();
+    reqs.back().panTiltReset(pan, tilt);
+    state.reset(pan, tilt, wallClockUsec());
+    moved = true;
   } else if (cmd == "pan") {
-    if (argc != 3) usage();
+    if (argc != 3 && argc != 4) usage();
+    int steps = parseSteps(argc, argv, 3);
     std::string dir = argv[2];
     if (dir == "left") {
-      // Larger value arguments to panTiltRelative work, I was just
-      // too lazy to write the argument parsing.
-      req.panTiltRelative(1, 0);
+      moves = planRelative(state, steps, 0);
     } else if (dir == "right") {
-      req.panTiltRelative(-1, 0);
+      moves = planRelative(state, -steps, 0);
     } else {
       usage();
     }
   } else if (cmd == "tilt") {
-    if (argc != 3) usage();
+    if (argc != 3 && argc != 4) usage();
+    int steps = parseSteps(argc, argv, 3);
     std::string dir = argv[2];
     if (dir == "up") {
-      req.panTiltRelative(0, 1);
+      moves = planRelative(state, 0, steps);
     } else if (dir == "down") {
-      req.panTiltRelative(0, -1);
+      moves = planRelative(state, 0, -steps);
+    } else {
+      usage();
+    }
+  } else if (cmd == "goto") {
+    if (argc != 4) usage();
+    if (!state.homed()) {
+      printf("Position is unknown, reset first\n");
+      return 1;
+    }
+    moves = planAbsolute(state, parseInt(argv[2]), parseInt(argv[3]));
+  } else if (cmd == "position") {
+    if (argc != 2) usage();
+    int64_t now = wallClockUsec();
+    for (const AxisState* axis : {&state.pan, &state.tilt}) {
+      printf("%s %d", axis == &state.pan ? "pan" : "tilt", axis->position);
+      if (!axis->homed) {
+        printf(" (unknown, reset first)\n");
+      } else if (axis->resetUntilUsec > now) {
+        printf(" (resetting)\n");
+      } else {
+        printf(" (within %.1f)\n", axis->uncertainty);
+      }
+    }
+    printf("backlash pan %d tilt %d policy %s\n", state.pan.backlash,
+           state.tilt.backlash, policyName(state.policy));
+    printf("pixels per step pan %.2f tilt %.2f\n", state.pan.pixelsPerStep,
+           state.tilt.pixelsPerStep);
+    return 0;
+  } else if (cmd == "measure") {
+    // The frames are from before and after the last move command.
+    if (argc != 4) usage();
+    try {
+      Shift shift = measureShift(readPgm(argv[2]), readPgm(argv[3]));
+      printf("shift %.1f %.1f confidence %.2f\n", shift.dx, shift.dy,
+             shift.confidence);
+      if (!applyShift(state, shift)) {
+        printf("Shift not used\n");
+      }
+      printf("pan %d tilt %d\n", state.pan.position, state.tilt.position);
+    } catch (const std::exception& ex) {
+      std::cout << "Failure: " << ex.what() << std::endl;
+      return 1;
+    }
+    return saveState(statePath, state) ? 0 : 1;
+  } else if (cmd == "backlash") {
+    if (argc != 4) usage();
+    std::string axis = argv[2];
+    if (axis == "pan" || axis == "tilt") {
+      int steps = parseInt(argv[3]);
+      if (steps < 0 || steps > kMaxStepsPerMove) usage();
+      (axis == "pan" ? state.pan : state.tilt).backlash = steps;
+    } else if (axis == "policy") {
+      if (!parsePolicy(argv[3], &state.policy)) usage();
     } else {
       usage();
     }
+    return saveState(statePath, state) ? 0 : 1;
+  } else if (cmd == "place") {
+    if (argc != 7 && argc != 9) usage();
+    Placement& p = state.placement;
+    p.x = parseDouble(argv[2]);
+    p.y = parseDouble(argv[3]);
+    p.z = parseDouble(argv[4]);
+    p.yaw = parseDouble(argv[5]);
+    p.pitch = parseDouble(argv[6]);
+    if (argc == 9) {
+      p.panDegreesPerStep = parseDouble(argv[7]);
+      p.tiltDegreesPerStep = parseDouble(argv[8]);
+      if (p.panDegreesPerStep <= 0 || p.tiltDegreesPerStep <= 0) usage();
+    }
+    state.placed = true;
+    return saveState(statePath, state) ? 0 : 1;
+  } else if (cmd == "tour") {
+    if (argc < 3) usage();
+    int number = parseInt(argv[2]);
+    std::string action = argc == 4 ? argv[3] : "";
+    std::vector<int>& tour = state.tours[number];
+    if (action == "clear") {
+      state.tours.erase(number);
+      return saveState(statePath, state) ? 0 : 1;
+    }
+    if (argc > 3 && action != "optimise") {
+      tour.clear();
+      for (int i = 3; i < argc; i++) {
+        tour.push_back(parseInt(argv[i]));
+      }
+    }
+    if (tour.empty()) {
+      printf("There's no tour %d\n", number);
+      return 1;
+    }
+    std::vector<std::pair<int, int>> stops;
+    for (int preset : tour) {
+      auto it = state.presets.find(preset);
+      if (it == state.presets.end()) {
+        printf("There's no preset %d\n", preset);
+        return 1;
+      }
+      stops.push_back(it->second);
+    }
+    TourOrder order = optimiseTour(stops);
+    if (action == "optimise") {
+      std::vector<int> presets;
+      for (size_t i : order.order) {
+        presets.push_back(tour[i]);
+      }
+      tour = presets;
+    }
+    printf("tour %d:", number);
+    for (int preset : tour) {
+      printf(" %d", preset);
+    }
+    if (action == "optimise") {
+      printf("\nlap %.2fs, was %.2fs\n", order.optimisedUsec / 1e6,
+             order.givenUsec / 1e6);
+    } else {
+      printf("\nlap %.2fs, or %.2fs reordered\n", order.givenUsec / 1e6,
+             order.optimisedUsec / 1e6);
+    }
+    if (argc == 3) {
+      return 0;
+    }
+    return saveState(statePath, state) ? 0 : 1;
+  } else if (cmd == "track") {
+    if (argc > 2) {
+      if (argc < 4 || argc > 5 || std::string(argv[2]) != "eval") usage();
+      try {
+        evaluate(argv[3], argc == 5 ? parseInt(argv[4]) : -1, state);
+      } catch (const std::exception& ex) {
+        std::cout << "Failure: " << ex.what() << std::endl;
+        return 1;
+      }
+      return 0;
+    }
+    if (state.pan.pixelsPerStep == 0 || state.tilt.pixelsPerStep == 0) {
+      printf("Pixels per step are unknown, measure some moves first\n");
+      return 1;
+    }
+    tracking = true;
+  } else if (cmd == "reframe") {
+    if (argc != 6) usage();
+    for (int i = 2; i < 6; i++) {
+      reframeSize[i - 2] = parseInt(argv[i]);
+      if (reframeSize[i - 2] <= 0) usage();
+    }
+    if (reframeSize[2] > reframeSize[0] || reframeSize[3] > reframeSize[1]) {
+      usage();
+    }
+    if (state.pan.pixelsPerStep == 0 || state.tilt.pixelsPerStep == 0) {
+      printf("Pixels per step are unknown, measure some moves first\n");
+      return 1;
+    }
+    reframing = true;
   } else if (cmd == "led") {
     if (argc != 3) usage();
     std::string mode = argv[2];
     if (mode == "off") {
-      req.ledControl(LXU_HW_CONTROL_LED1_MODE_OFF, 0);
+      state.ledMode = LXU_HW_CONTROL_LED1_MODE_OFF;
     } else if (mode == "on") {
-      req.ledControl(LXU_HW_CONTROL_LED1_MODE_ON, 0);
+      state.ledMode = LXU_HW_CONTROL_LED1_MODE_ON;
     } else if (mode == "auto") {
-      req.ledControl(LXU_HW_CONTROL_LED1_MODE_AUTO, 0);
+      state.ledMode = LXU_HW_CONTROL_LED1_MODE_AUTO;
     } else {
       usage();
     }
+    state.ledFrequency = 0;
+    reqs.emplace_back();
+    reqs.back().ledControl(state.ledMode, state.ledFrequency);
+    changed = true;
   } else {
     usage();
   }
 
+  if (!moves.empty() || tracking || reframing) {
+    moved = true;
+  }
+
+  Camera camera;
   try {
-    Camera camera = scanDescriptors(display);
+    camera = scanDescriptors(display, locationId);
     if (!camera.isValid()) {
       return 1;
     }
-    if (!display) {
-      camera.send(req);
+    if (tracking) {
+      track(camera, state);
+    } else if (reframing) {
+      reframe(camera, state, reframeSize[0], reframeSize[1], reframeSize[2],
+              reframeSize[3]);
+    } else if (!display) {
+      for (Request& req : reqs) {
+        camera.send(req);
+      }
+      sendMoves(camera, state, moves);
     }
   } catch (const std::exception& ex) {
     std::cout << "Failure: " << ex.what() << std::endl;
+    printFaultStats(camera);
+    if (moved) {
+      // Some of the moves may have happened, so the position can't
+      // be trusted any more.
+      state.pan.homed = false;
+      state.tilt.homed = false;
+      saveState(statePath, state);
+    }
+    return 1;
+  }
+
+  printFaultStats(camera);
+
+  if ((moved || changed) && !saveState(statePath, state)) {
     return 1;
   }
 
@@ -0,0 +1,598 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "osc.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <stdexcept>
+
+#include "socket.h"
+#include "uvc.h"
+
+namespace {
+
+// Nested bundles deeper than this are taken to be malformed.
+constexpr int kMaxBundleDepth = 8;
+// Senders which make up new patterns all the time shouldn't use up
+// all the memory.
+constexpr size_t kMaxResolved = 4096;
+
+size_t padded(size_t length) {
+  return (length + 3) & ~static_cast<size_t>(3);
+}
+
+uint32_t getWord(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void putWord(std::vector<uint8_t>& out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back((v >> 16) & 0xff);
+  out.push_back((v >> 8) & 0xff);
+  out.push_back(v & 0xff);
+}
+
+// Strings end with a NUL, padded out to a multiple of four bytes.
+bool getString(const uint8_t*& p, const uint8_t* end, std::string* s) {
+  const uint8_t* nul = static_cast<const uint8_t*>(memchr(p, 0, end - p));
+  if (!nul) {
+    return false;
+  }
+  s->assign(reinterpret_cast<const char*>(p), nul - p);
+  size_t length = padded(nul - p + 1);
+  if (length > static_cast<size_t>(end - p)) {
+    return false;
+  }
+  p += length;
+  return true;
+}
+
+void putString(std::vector<uint8_t>& out, const std::string& s) {
+  out.insert(out.end(), s.begin(), s.end());
+  out.resize(out.size() + padded(s.size() + 1) - s.size(), 0);
+}
+
+bool parseMessage(const uint8_t* p, const uint8_t* end, OscMessage* message) {
+  std::string types;
+  if (!getString(p, end, &message->address) || !getString(p, end, &types) ||
+      types.empty() || types[0] != ',') {
+    return false;
+  }
+  for (size_t i = 1; i < types.size(); i++) {
+    OscArgument argument{types[i], 0, ""};
+    size_t left = end - p;
+    switch (types[i]) {
+    case 'i':
+    case 'f': {
+      if (left < 4) {
+        return false;
+      }
+      uint32_t word = getWord(p);
+      p += 4;
+      if (types[i] == 'i') {
+        argument.number = static_cast<int32_t>(word);
+      } else {
+        float f;
+        memcpy(&f, &word, sizeof(f));
+        argument.number = f;
+      }
+      break; }
+    case 'h':
+    case 'd': {
+      if (left < 8) {
+        return false;
+      }
+      uint64_t word = static_cast<uint64_t>(getWord(p)) << 32 |
+        getWord(p + 4);
+      p += 8;
+      if (types[i] == 'h') {
+        argument.number = static_cast<int64_t>(word);
+      } else {
+        double d;
+        memcpy(&d, &word, sizeof(d));
+        argument.number = d;
+      }
+      break; }
+    case 's':
+    case 'S':
+      if (!getString(p, end, &argument.text)) {
+        return false;
+      }
+      break;
+    case 'T':
+      argument.number = 1;
+      break;
+    case 'F':
+    case 'N':
+    case 'I':
+      break;
+    default:
+      // Without knowing its size, nothing after it can be read.
+      return false;
+    }
+    message->arguments.push_back(argument);
+  }
+  return true;
+}
+
+bool parsePacket(const uint8_t* p, size_t length, int depth,
+                 std::vector<OscMessage>* messages) {
+  const uint8_t* end = p + length;
+  if (length >= 16 && memcmp(p, "#bundle", 8) == 0) {
+    if (depth == kMaxBundleDepth) {
+      return false;
+    }
+    // Skip the time tag.
+    p += 16;
+    while (p < end) {
+      if (end - p < 4) {
+        return false;
+      }
+      uint32_t size = getWord(p);
+      p += 4;
+      if (size > static_cast<size_t>(end - p) ||
+          !parsePacket(p, size, depth + 1, messages)) {
+        return false;
+      }
+      p += size;
+    }
+    return true;
+  }
+  if (length == 0 || p[0] != '/') {
+    return false;
+  }
+  OscMessage message;
+  if (!parseMessage(p, end, &message)) {
+    return false;
+  }
+  messages->push_back(message);
+  return true;
+}
+
+std::vector<std::string> split(const std::string& address) {
+  std::vector<std::string> parts;
+  size_t start = 1;
+  for (;;) {
+    size_t slash = address.find('/', start);
+    parts.push_back(address.substr(start, slash - start));
+    if (slash == std::string::npos) {
+      return parts;
+    }
+    start = slash + 1;
+  }
+}
+
+int number(const OscMessage& message, size_t i) {
+  if (i >= message.arguments.size()) {
+    throw std::runtime_error(message.address + ": missing argument");
+  }
+  return static_cast<int>(std::lround(message.arguments[i].number));
+}
+
+}
+
+bool parseOsc(const uint8_t* data, size_t length,
+              std::vector<OscMessage>* messages) {
+  return length % 4 == 0 && parsePacket(data, length, 0, messages);
+}
+
+std::vector<uint8_t> formatOsc(const OscMessage& message) {
+  std::vector<uint8_t> out;
+  putString(out, message.address);
+  std::string types = ",";
+  for (const OscArgument& argument : message.arguments) {
+    types += argument.type;
+  }
+  putString(out, types);
+  for (const OscArgument& argument : message.arguments) {
+    if (argument.type == 'i') {
+      putWord(out, static_cast<uint32_t>(
+                static_cast<int32_t>(std::lround(argument.number))));
+    } else if (argument.type == 'f') {
+      float f = static_cast<float>(argument.number);
+      uint32_t word;
+      memcpy(&word, &f, sizeof(word));
+      putWord(out, word);
+    } else if (argument.type == 's') {
+      putString(out, argument.text);
+    } else {
+      throw std::runtime_error("can't format OSC type " +
+                               std::string(1, argument.type));
+    }
+  }
+  return out;
+}
+
+OscPattern::OscPattern(const std::string& pattern) {
+  if (pattern.empty() || pattern[0] != '/') {
+    return;
+  }
+  for (const std::string& text : split(pattern)) {
+    Part part;
+    for (size_t i = 0; i < text.size(); i++) {
+      Token token;
+      char c = text[i];
+      if (c == '?') {
+        token.kind = Token::kAny;
+      } else if (c == '*') {
+        token.kind = Token::kStar;
+      } else if (c == '[' && text.find(']', i) != std::string::npos) {
+        size_t close = text.find(']', i);
+        token.kind = Token::kSet;
+        token.set.assign(256, false);
+        size_t j = i + 1;
+        bool negate = j < close && text[j] == '!';
+        if (negate) {
+          j++;
+        }
+        for (; j < close; j++) {
+          unsigned char from = text[j];
+          unsigned char to = from;
+          if (j + 2 < close && text[j + 1] == '-') {
+            to = text[j + 2];
+            j += 2;
+          }
+          for (unsigned c = from; c <= to; c++) {
+            token.set[c] = true;
+          }
+        }
+        if (negate) {
+          token.set.flip();
+        }
+        i = close;
+      } else if (c == '{' && text.find('}', i) != std::string::npos) {
+        size_t close = text.find('}', i);
+        token.kind = Token::kChoice;
+        size_t start = i + 1;
+        for (;;) {
+          size_t comma = text.find(',', start);
+          if (comma == std::string::npos || comma > close) {
+            token.choices.push_back(text.substr(start, close - start));
+            break;
+          }
+          token.choices.push_back(text.substr(start, comma - start));
+          start = comma + 1;
+        }
+        i = close;
+      } else {
+        // Runs of plain characters are one token.
+        token.kind = Token::kLiteral;
+        size_t end = text.find_first_of("?*[{", i);
+        if (end == std::string::npos) {
+          end = text.size();
+        }
+        token.text = text.substr(i, std::max<size_t>(1, end - i));
+        i += token.text.size() - 1;
+      }
+      part.push_back(token);
+    }
+    parts_.push_back(part);
+  }
+}
+
+bool OscPattern::matches(const std::string& address) const {
+  if (parts_.empty() || address.empty() || address[0] != '/') {
+    return false;
+  }
+  std::vector<std::string> parts = split(address);
+  if (parts.size() != parts_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < parts.size(); i++) {
+    const std::string& s = parts[i];
+    if (!matchPart(parts_[i], 0, s.data(), s.data() + s.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool OscPattern::matchPart(const Part& part, size_t token, const char* s,
+                           const char* end) {
+  if (token == part.size()) {
+    return s == end;
+  }
+  const Token& t = part[token];
+  switch (t.kind) {
+  case Token::kLiteral:
+    return static_cast<size_t>(end - s) >= t.text.size() &&
+      memcmp(s, t.text.data(), t.text.size()) == 0 &&
+      matchPart(part, token + 1, s + t.text.size(), end);
+  case Token::kAny:
+    return s < end && matchPart(part, token + 1, s + 1, end);
+  case Token::kSet:
+    return s < end && t.set[static_cast<unsigned char>(*s)] &&
+      matchPart(part, token + 1, s + 1, end);
+  case Token::kStar:
+    for (const char* p = end; p >= s; p--) {
+      if (matchPart(part, token + 1, p, end)) {
+        return true;
+      }
+    }
+    return false;
+  case Token::kChoice:
+    for (const std::string& choice : t.choices) {
+      if (static_cast<size_t>(end - s) >= choice.size() &&
+          memcmp(s, choice.data(), choice.size()) == 0 &&
+          matchPart(part, token + 1, s + choice.size(), end)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+OscGateway::OscGateway(Controller& controller,
+                       const std::vector<uint32_t>& cameras,
+                       const std::string& address, uint16_t port)
+  : controller_(controller)
+  , cameras_(cameras)
+{
+  static const std::pair<const char*, Method> methods[] = {
+    {"pan", kPan}, {"tilt", kTilt}, {"move", kMove}, {"goto", kGoto},
+    {"reset", kReset}, {"led", kLed}, {"preset", kPreset}, {"save", kSave},
+  };
+  for (size_t i = 0; i < cameras.size(); i++) {
+    for (const auto& method : methods) {
+      addresses_.emplace_back(
+        "/cam/" + std::to_string(i + 1) + "/" + method.first,
+        Target{i, method.second});
+    }
+  }
+
+  sockaddr_in in;
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &in.sin_addr) != 1) {
+    throw std::runtime_error(address + ": bad address");
+  }
+  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  sysCheck(fd_, "socket");
+  if (bind(fd_, reinterpret_cast<sockaddr*>(&in), sizeof(in)) < 0) {
+    int error = errno;
+    close(fd_);
+    throw std::runtime_error("binding port " + std::to_string(port) + ": " +
+                             strerror(error));
+  }
+  setNonBlocking(fd_);
+  sysCheck(pipe(wakeFds_), "pipe");
+  setNonBlocking(wakeFds_[0]);
+  setNonBlocking(wakeFds_[1]);
+}
+
+OscGateway::~OscGateway() {
+  close(fd_);
+  close(wakeFds_[0]);
+  close(wakeFds_[1]);
+}
+
+void OscGateway::stop() {
+  stopping_ = true;
+  char c = 0;
+  ::write(wakeFds_[1], &c, 1);
+}
+
+void OscGateway::run() {
+  while (!stopping_) {
+    pollfd fds[] = {{fd_, POLLIN, 0}, {wakeFds_[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sysCheck(-1, "poll");
+    }
+    // Big enough for any UDP packet.
+    static uint8_t packet[65536];
+    ssize_t n;
+    while ((n = recv(fd_, packet, sizeof(packet), 0)) >= 0) {
+      handle(packet, n);
+    }
+    if (fds[1].revents) {
+      char buf[64];
+      while (::read(wakeFds_[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+  }
+}
+
+const std::vector<OscGateway::Target>& OscGateway::resolve(
+  const std::string& pattern) {
+  auto it = resolved_.find(pattern);
+  if (it != resolved_.end()) {
+    return it->second;
+  }
+  if (resolved_.size() >= kMaxResolved) {
+    resolved_.clear();
+  }
+  OscPattern compiled(pattern);
+  std::vector<Target>& targets = resolved_[pattern];
+  for (const auto& address : addresses_) {
+    if (compiled.matches(address.first)) {
+      targets.push_back(address.second);
+    }
+  }
+  return targets;
+}
+
+void OscGateway::handle(const uint8_t* data, size_t length) {
+  std::vector<OscMessage> messages;
+  if (!parseOsc(data, length, &messages)) {
+    fprintf(stderr, "bad OSC packet\n");
+    return;
+  }
+
+  std::vector<Cue> cues(cameras_.size());
+  for (const OscMessage& message : messages) {
+    const std::vector<Target>& targets = resolve(message.address);
+    if (targets.empty()) {
+      fprintf(stderr, "%s: no such method\n", message.address.c_str());
+    }
+    for (const Target& target : targets) {
+      try {
+        apply(cues[target.camera], target.method, message);
+      } catch (const std::exception& ex) {
+        fprintf(stderr, "%s\n", ex.what());
+      }
+    }
+  }
+
+  for (size_t i = 0; i < cues.size(); i++) {
+    const Cue& cue = cues[i];
+    if (!cue.used) {
+      continue;
+    }
+    // One queue entry per camera, however much the bundle asked of it.
+    uint32_t locationId = cameras_[i];
+    std::vector<ControlCommand> commands;
+    if (cue.resetAxes >= 0) {
+      commands.push_back(ControlCommand{ControlCommand::kReset, locationId,
+                                        cue.resetAxes, 0});
+    }
+    if (cue.motion != ControlCommand::kPosition) {
+      commands.push_back(ControlCommand{cue.motion, locationId, cue.a,
+                                        cue.b});
+    }
+    if (cue.afterLeft != 0 || cue.afterUp != 0) {
+      commands.push_back(ControlCommand{ControlCommand::kMove, locationId,
+                                        cue.afterLeft, cue.afterUp});
+    }
+    if (cue.save >= 0) {
+      commands.push_back(ControlCommand{ControlCommand::kSavePreset,
+                                        locationId, cue.save, 0});
+    }
+    if (cue.ledMode >= 0) {
+      commands.push_back(ControlCommand{ControlCommand::kLed, locationId,
+                                        cue.ledMode, 0});
+    }
+    if (!commands.empty()) {
+      submit(i, commands);
+    }
+  }
+}
+
+// Moves add up.  A goto or preset replaces whatever motion came
+// before it, and moves after a goto shift where it goes.
+void OscGateway::apply(Cue& cue, Method method, const OscMessage& message) {
+  int left = 0;
+  int up = 0;
+  switch (method) {
+  case kPan:
+    left = number(message, 0);
+    break;
+  case kTilt:
+    up = number(message, 0);
+    break;
+  case kMove:
+    left = number(message, 0);
+    up = number(message, 1);
+    break;
+  case kGoto:
+    cue.motion = ControlCommand::kGoto;
+    cue.a = number(message, 0);
+    cue.b = number(message, 1);
+    cue.afterLeft = cue.afterUp = 0;
+    break;
+  case kPreset:
+    cue.motion = ControlCommand::kRecallPreset;
+    cue.a = number(message, 0);
+    cue.afterLeft = cue.afterUp = 0;
+    break;
+  case kSave:
+    cue.save = number(message, 0);
+    break;
+  case kReset: {
+    std::string axes = message.arguments.empty()
+      ? "both" : message.arguments[0].text;
+    if (axes == "pan") {
+      cue.resetAxes = LXU_MOTOR_PANTILT_RESET_CONTROL_PAN;
+    } else if (axes == "tilt") {
+      cue.resetAxes = LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+    } else if (axes == "both") {
+      cue.resetAxes = LXU_MOTOR_PANTILT_RESET_CONTROL_PAN |
+        LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+    } else if (axes == "auto") {
+      cue.resetAxes = 0;
+    } else {
+      throw std::runtime_error(message.address + ": bad axes " + axes);
+    }
+    break; }
+  case kLed: {
+    std::string mode = message.arguments.empty()
+      ? "" : message.arguments[0].text;
+    if (mode == "on") {
+      cue.ledMode = LXU_HW_CONTROL_LED1_MODE_ON;
+    } else if (mode == "off") {
+      cue.ledMode = LXU_HW_CONTROL_LED1_MODE_OFF;
+    } else if (mode == "auto") {
+      cue.ledMode = LXU_HW_CONTROL_LED1_MODE_AUTO;
+    } else {
+      throw std::runtime_error(message.address + ": bad mode " + mode);
+    }
+    break; }
+  }
+  cue.used = true;
+
+  if (left == 0 && up == 0) {
+    return;
+  }
+  switch (cue.motion) {
+  case ControlCommand::kGoto:
+  case ControlCommand::kMove:
+    cue.a += left;
+    cue.b += up;
+    break;
+  case ControlCommand::kRecallPreset:
+    cue.afterLeft += left;
+    cue.afterUp += up;
+    break;
+  default:
+    cue.motion = ControlCommand::kMove;
+    cue.a = left;
+    cue.b = up;
+    break;
+  }
+}
+
+void OscGateway::submit(size_t camera,
+                        const std::vector<ControlCommand>& commands) {
+  uint32_t locationId = cameras_[camera];
+  bool ok = controller_.submit(commands, [locationId](const ControlReply& r) {
+    if (!r.ok) {
+      fprintf(stderr, "%s\n", formatControlReply(locationId, r).c_str());
+    }
+  });
+  if (!ok) {
+    fprintf(stderr, "0x%08x error too busy\n", locationId);
+  }
+}
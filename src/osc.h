@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "controller.h"
+
+// Open Sound Control input, for show control software.  Each camera
+// has methods at /cam/<n>/..., numbered from 1 in location order:
+//
+//   /cam/n/pan steps, /cam/n/tilt steps, /cam/n/move left up
+//   /cam/n/goto pan tilt
+//   /cam/n/reset [pan | tilt | both | auto]
+//   /cam/n/led on | off | auto
+//   /cam/n/preset number, /cam/n/save number
+//
+// Addresses can be patterns, like /cam/*/led or /cam/{1,3}/goto, to
+// reach many cameras at once.  Everything in one packet, bundles and
+// all, is gathered up per camera first, so a cue's pan and tilt make
+// one move.  Bundles are run when they arrive, whatever their time
+// tag says.
+
+constexpr uint16_t kOscPort = 9000;
+
+struct OscArgument {
+  char type;
+  // Numbers of any type are here, and strings are in text.
+  double number;
+  std::string text;
+};
+
+struct OscMessage {
+  std::string address;
+  std::vector<OscArgument> arguments;
+};
+
+// Adds the messages in a packet, which is a message or a bundle, to
+// messages, in order.  Returns false if it's malformed.
+bool parseOsc(const uint8_t* data, size_t length,
+              std::vector<OscMessage>* messages);
+// Builds a message with int, float and string arguments, for senders.
+std::vector<uint8_t> formatOsc(const OscMessage& message);
+
+// An address pattern, compiled once so it's quick to match: ? and *
+// match any character or run of characters, [a-z] and [!a-z] match
+// any character in or not in the set, and {foo,bar} matches either.
+// None of them match across a /.
+class OscPattern {
+public:
+  explicit OscPattern(const std::string& pattern);
+
+  bool matches(const std::string& address) const;
+
+private:
+  struct Token {
+    enum Kind { kLiteral, kAny, kStar, kSet, kChoice };
+    Kind kind;
+    std::string text;
+    // For sets, which characters are in it.
+    std::vector<bool> set;
+    std::vector<std::string> choices;
+  };
+
+  using Part = std::vector<Token>;
+
+  static bool matchPart(const Part& part, size_t token, const char* s,
+                        const char* end);
+
+  std::vector<Part> parts_;
+};
+
+// Listens for OSC over UDP on one thread.  Failures are printed on
+// stderr, since OSC has no replies.
+class OscGateway {
+public:
+  OscGateway(Controller& controller, const std::vector<uint32_t>& cameras,
+             const std::string& address, uint16_t port);
+  ~OscGateway();
+
+  // Serves until stop() is called.
+  void run();
+  void stop();
+
+  // Handles one packet, as if it had arrived.
+  void handle(const uint8_t* data, size_t length);
+
+private:
+  enum Method { kPan, kTilt, kMove, kGoto, kReset, kLed, kPreset, kSave };
+
+  struct Target {
+    size_t camera;
+    Method method;
+  };
+
+  // What a packet asks of one camera.
+  struct Cue {
+    bool used = false;
+    int resetAxes = -1;
+    ControlCommand::Kind motion = ControlCommand::kPosition;
+    int a = 0;
+    int b = 0;
+    // Moves after a preset, whose position isn't known here.
+    int afterLeft = 0;
+    int afterUp = 0;
+    int save = -1;
+    int ledMode = -1;
+  };
+
+  // The methods a pattern reaches, worked out once per pattern.
+  const std::vector<Target>& resolve(const std::string& pattern);
+  void apply(Cue& cue, Method method, const OscMessage& message);
+  void submit(size_t camera, const std::vector<ControlCommand>& commands);
+
+  Controller& controller_;
+  std::vector<uint32_t> cameras_;
+  std::vector<std::pair<std::string, Target>> addresses_;
+  std::unordered_map<std::string, std::vector<Target>> resolved_;
+  int fd_ = -1;
+  int wakeFds_[2] = {-1, -1};
+  std::atomic<bool> stopping_{false};
+};
@@ -0,0 +1,381 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "position.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// These are guesses.  They err on the slow side, since starting a
+// move before the last one finishes is worse than waiting a bit.
+constexpr int64_t kMoveOverheadUsec = 100000;
+constexpr int64_t kUsecPerStep = 20000;
+constexpr int64_t kPanResetUsec = 4000000;
+constexpr int64_t kTiltResetUsec = 2500000;
+
+// How much each move adds to an axis's uncertainty.  Reversals are
+// the main source of error, but long moves can slip a little too.
+constexpr double kReversalUncertainty = 1;
+constexpr double kUncertaintyPerStep = 0.01;
+constexpr double kMaxUncertainty = 5;
+
+int sign(int v) {
+  return (v > 0) - (v < 0);
+}
+
+// Moves the axis by steps, and returns the number of steps to
+// command, which includes any slack taken up by a reversal.
+int commandAxis(AxisState& axis, int steps) {
+  int dir = sign(steps);
+  int commanded = steps;
+  if (axis.lastDirection == -dir) {
+    commanded += dir * axis.backlash;
+    axis.lastReversed = true;
+    axis.uncertainty += kReversalUncertainty;
+  }
+  axis.uncertainty += kUncertaintyPerStep * std::abs(steps);
+  axis.position += steps;
+  axis.lastDirection = dir;
+  return commanded;
+}
+
+void planAxis(AxisState& axis, int steps, BacklashPolicy policy,
+              std::vector<int>& commands) {
+  axis.lastSteps = steps;
+  axis.lastReversed = false;
+  if (steps == 0) {
+    return;
+  }
+  if (policy == BacklashPolicy::kApproach && steps < 0) {
+    // Go past the target, then come back to it moving positive.
+    int overshoot = std::max(axis.backlash, 1);
+    commands.push_back(commandAxis(axis, steps - overshoot));
+    commands.push_back(commandAxis(axis, overshoot));
+  } else {
+    commands.push_back(commandAxis(axis, steps));
+  }
+}
+
+std::vector<int> chunk(const std::vector<int>& commands) {
+  std::vector<int> chunks;
+  for (int steps : commands) {
+    while (steps != 0) {
+      int c = std::max(-kMaxStepsPerMove, std::min(kMaxStepsPerMove, steps));
+      chunks.push_back(c);
+      steps -= c;
+    }
+  }
+  return chunks;
+}
+
+// The axes are independent, so pan and tilt commands are paired up
+// to share requests.
+std::vector<Move> combine(const std::vector<int>& pan,
+                          const std::vector<int>& tilt) {
+  std::vector<int> panChunks = chunk(pan);
+  std::vector<int> tiltChunks = chunk(tilt);
+  std::vector<Move> moves;
+  for (size_t i = 0; i < std::max(panChunks.size(), tiltChunks.size()); i++) {
+    moves.push_back(
+      Move{i < panChunks.size() ? panChunks[i] : 0,
+           i < tiltChunks.size() ? tiltChunks[i] : 0});
+  }
+  return moves;
+}
+
+bool parseAxis(std::istringstream& line, AxisState& axis) {
+  if (!(line >> axis.position >> axis.lastDirection >> axis.backlash)) {
+    return false;
+  }
+  // Older state files stop here.
+  if (!(line >> axis.pixelsPerStep)) {
+    return true;
+  }
+  if (!(line >> axis.lastSteps >> axis.lastReversed)) {
+    return false;
+  }
+  if (!(line >> axis.homed)) {
+    return true;
+  }
+  return static_cast<bool>(line >> axis.uncertainty >> axis.resetUntilUsec);
+}
+
+void resetAxis(AxisState& axis, int64_t untilUsec) {
+  axis.position = 0;
+  axis.lastDirection = 0;
+  axis.lastSteps = 0;
+  axis.lastReversed = false;
+  axis.homed = true;
+  axis.uncertainty = 0;
+  axis.resetUntilUsec = untilUsec;
+}
+
+void writeAxis(std::ostream& out, const char* name, const AxisState& axis) {
+  out << name << " " << axis.position << " " << axis.lastDirection << " "
+      << axis.backlash << " " << axis.pixelsPerStep << " " << axis.lastSteps
+      << " " << axis.lastReversed << " " << axis.homed << " "
+      << axis.uncertainty << " " << axis.resetUntilUsec << "\n";
+}
+
+}
+
+void PositionState::reset(bool resetPan, bool resetTilt, int64_t nowUsec) {
+  if (resetPan) {
+    resetAxis(pan, nowUsec + resetTimeUsec(true, false));
+  }
+  if (resetTilt) {
+    resetAxis(tilt, nowUsec + resetTimeUsec(false, true));
+  }
+}
+
+void resetNeeded(const PositionState& state, bool* pan, bool* tilt) {
+  *pan = !state.pan.homed || state.pan.uncertainty > kMaxUncertainty;
+  *tilt = !state.tilt.homed || state.tilt.uncertainty > kMaxUncertainty;
+}
+
+int64_t resetTimeUsec(bool pan, bool tilt) {
+  return std::max(pan ? kPanResetUsec : 0, tilt ? kTiltResetUsec : 0);
+}
+
+int64_t wallClockUsec() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::vector<Move> planRelative(PositionState& state, int left, int up) {
+  std::vector<int> pan, tilt;
+  planAxis(state.pan, left, state.policy, pan);
+  planAxis(state.tilt, up, state.policy, tilt);
+  return combine(pan, tilt);
+}
+
+std::vector<Move> planAbsolute(PositionState& state, int pan, int tilt) {
+  if (!state.homed()) {
+    throw std::runtime_error("position is unknown, reset first");
+  }
+  return planRelative(
+    state, pan - state.pan.position, tilt - state.tilt.position);
+}
+
+int64_t moveTimeUsec(const Move& move) {
+  int steps = std::max(std::abs(move.left), std::abs(move.up));
+  if (steps == 0) {
+    return 0;
+  }
+  return kMoveOverheadUsec + steps * kUsecPerStep;
+}
+
+int64_t travelTimeUsec(int left, int up) {
+  int64_t total = 0;
+  for (const Move& move : combine({left}, {up})) {
+    total += moveTimeUsec(move);
+  }
+  return total;
+}
+
+std::string defaultStatePath() {
+  if (const char* path = getenv("ORBITCTL_STATE")) {
+    return path;
+  }
+  if (const char* home = getenv("HOME")) {
+    return std::string(home) + "/.orbitctl";
+  }
+  return ".orbitctl";
+}
+
+std::string statePath(uint32_t locationId) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "-%08x", locationId);
+  return defaultStatePath() + suffix;
+}
+
+PositionState loadCameraState(uint32_t locationId) {
+  std::string path = statePath(locationId);
+  if (access(path.c_str(), F_OK) != 0) {
+    return loadPositionState(defaultStatePath());
+  }
+  return loadPositionState(path);
+}
+
+std::vector<uint32_t> savedCameraStates() {
+  std::string base = defaultStatePath();
+  size_t slash = base.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : base.substr(0, slash);
+  std::string prefix = base.substr(slash + 1) + "-";
+  std::vector<uint32_t> locations;
+  DIR* d = opendir(dir.empty() ? "/" : dir.c_str());
+  if (!d) {
+    return locations;
+  }
+  while (dirent* entry = readdir(d)) {
+    std::string name = entry->d_name;
+    char* end;
+    if (name.size() != prefix.size() + 8 ||
+        name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    unsigned long value = strtoul(name.c_str() + prefix.size(), &end, 16);
+    if (*end == '\0' && value != 0) {
+      locations.push_back(static_cast<uint32_t>(value));
+    }
+  }
+  closedir(d);
+  std::sort(locations.begin(), locations.end());
+  return locations;
+}
+
+PositionState loadPositionState(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    return PositionState();
+  }
+  return readPositionState(in, path);
+}
+
+PositionState readPositionState(std::istream& in, const std::string& name) {
+  PositionState state;
+  std::string text;
+  int lineNumber = 0;
+  while (std::getline(in, text)) {
+    lineNumber++;
+    std::istringstream line(text);
+    std::string key;
+    if (!(line >> key)) {
+      continue;
+    }
+
+    bool ok;
+    if (key == "pan") {
+      ok = parseAxis(line, state.pan);
+    } else if (key == "tilt") {
+      ok = parseAxis(line, state.tilt);
+    } else if (key == "policy") {
+      std::string name;
+      ok = (line >> name) && parsePolicy(name, &state.policy);
+    } else if (key == "led") {
+      ok = static_cast<bool>(line >> state.ledMode >> state.ledFrequency);
+    } else if (key == "preset") {
+      int number;
+      std::pair<int, int> position;
+      ok = static_cast<bool>(line >> number >> position.first
+                             >> position.second);
+      state.presets[number] = position;
+    } else if (key == "tour") {
+      int number, preset;
+      ok = static_cast<bool>(line >> number);
+      while (ok && line >> preset) {
+        state.tours[number].push_back(preset);
+      }
+    } else if (key == "placement") {
+      Placement& p = state.placement;
+      ok = static_cast<bool>(line >> p.x >> p.y >> p.z >> p.yaw >> p.pitch
+                             >> p.panDegreesPerStep
+                             >> p.tiltDegreesPerStep);
+      state.placed = ok;
+    } else if (key == "homed") {
+      // Older state files had one flag for both axes.
+      bool homed;
+      ok = static_cast<bool>(line >> homed);
+      state.pan.homed = state.tilt.homed = homed;
+    } else {
+      // Ignore keys from newer versions.
+      ok = true;
+    }
+    if (!ok) {
+      throw std::runtime_error(
+        name + ":" + std::to_string(lineNumber) + ": bad state line");
+    }
+  }
+
+  return state;
+}
+
+void savePositionState(const std::string& path, const PositionState& state) {
+  // Write a new file and rename it, so an interrupted save doesn't
+  // lose the old state.
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath);
+    writePositionState(out, state);
+    if (!out) {
+      throw std::runtime_error("writing " + tmpPath + " failed");
+    }
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("renaming " + tmpPath + " failed");
+  }
+}
+
+void writePositionState(std::ostream& out, const PositionState& state) {
+  writeAxis(out, "pan", state.pan);
+  writeAxis(out, "tilt", state.tilt);
+  out << "policy " << policyName(state.policy) << "\n";
+  out << "led " << state.ledMode << " " << state.ledFrequency << "\n";
+  for (const auto& preset : state.presets) {
+    out << "preset " << preset.first << " " << preset.second.first << " "
+        << preset.second.second << "\n";
+  }
+  for (const auto& tour : state.tours) {
+    out << "tour " << tour.first;
+    for (int preset : tour.second) {
+      out << " " << preset;
+    }
+    out << "\n";
+  }
+  if (state.placed) {
+    const Placement& p = state.placement;
+    out << "placement " << p.x << " " << p.y << " " << p.z << " " << p.yaw
+        << " " << p.pitch << " " << p.panDegreesPerStep << " "
+        << p.tiltDegreesPerStep << "\n";
+  }
+}
+
+const char* policyName(BacklashPolicy policy) {
+  switch (policy) {
+  case BacklashPolicy::kTakeUp:
+    return "takeup";
+  case BacklashPolicy::kApproach:
+    return "approach";
+  }
+  return "unknown";
+}
+
+bool parsePolicy(const std::string& name, BacklashPolicy* policy) {
+  if (name == "takeup") {
+    *policy = BacklashPolicy::kTakeUp;
+  } else if (name == "approach") {
+    *policy = BacklashPolicy::kApproach;
+  } else {
+    return false;
+  }
+  return true;
+}
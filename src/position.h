@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+// The mechanism only does relative moves, so the position is tracked
+// by dead reckoning.  Positions are in units of panTiltRelative()
+// steps, counted from where the mechanism ends up after a reset.
+// Positive is left and up, the same as panTiltRelative().
+
+// This is the largest step count which fits in a single request.
+constexpr int kMaxStepsPerMove = 127;
+
+struct AxisState {
+  int position = 0;
+  // Direction of the last move on this axis: 1, -1, or 0 if it isn't
+  // known, like right after a reset.
+  int lastDirection = 0;
+  // Commanded steps which are lost taking up slack in the gear train
+  // when the axis reverses direction.
+  int backlash = 0;
+  // How far the image moves for each step, as measured by odometry,
+  // or 0 if it hasn't been measured.
+  double pixelsPerStep = 0;
+  // The net steps of the last command which moved the camera, and
+  // whether it took up slack on the way, so odometry can check it.
+  int lastSteps = 0;
+  bool lastReversed = false;
+  // The position is meaningless until the axis has been reset.
+  bool homed = false;
+  // A rough bound on how far off the position might be, in steps.  It
+  // grows with each move, and shrinks when odometry checks it.
+  double uncertainty = 0;
+  // When the last reset of this axis should be done, in wall clock
+  // microseconds, since the camera doesn't say.
+  int64_t resetUntilUsec = 0;
+};
+
+enum class BacklashPolicy {
+  // Add the backlash to the first move after a reversal.
+  kTakeUp,
+  // Always finish a move travelling left or up, overshooting and
+  // coming back if needed, so every stop loads the gears the same way.
+  kApproach,
+};
+
+// Where a camera is in the room, and which way it faces after a reset,
+// for aiming it at points in the room.  The room's z axis is up.
+struct Placement {
+  double x = 0;
+  double y = 0;
+  double z = 0;
+  // In degrees.  Yaw is anticlockwise from the x axis, seen from
+  // above, and pitch is up from level.
+  double yaw = 0;
+  double pitch = 0;
+  // How far a step turns each axis.  These are rough figures for the
+  // Orbit's travel, until they're calibrated.
+  double panDegreesPerStep = 1.9;
+  double tiltDegreesPerStep = 1.7;
+};
+
+struct PositionState {
+  AxisState pan;
+  AxisState tilt;
+  BacklashPolicy policy = BacklashPolicy::kTakeUp;
+  // Not a position, but this is the last LED setting, kept here so it
+  // can be restored if the camera has to be reset.  The mode is -1 if
+  // it's never been set.
+  int ledMode = -1;
+  int ledFrequency = 0;
+  // Saved positions, by number, as pan and tilt.
+  std::map<int, std::pair<int, int>> presets;
+  bool placed = false;
+  Placement placement;
+  // Patrol tours, by number, as the presets to visit in order.
+  std::map<int, std::vector<int>> tours;
+
+  bool homed() const { return pan.homed && tilt.homed; }
+  void reset(bool resetPan, bool resetTilt, int64_t nowUsec);
+};
+
+// A reset is slow, so only axes which are unhomed, or whose
+// uncertainty has grown past a limit, need one.
+void resetNeeded(const PositionState& state, bool* pan, bool* tilt);
+
+// A rough estimate of how long a reset takes.  Resetting both axes
+// takes as long as the slower one.
+int64_t resetTimeUsec(bool pan, bool tilt);
+
+int64_t wallClockUsec();
+
+// One panTiltRelative() request.
+struct Move {
+  int left;
+  int up;
+};
+
+// These update state to reflect the moves they return.  planRelative
+// moves by the given number of steps, planAbsolute moves to the given
+// position.
+std::vector<Move> planRelative(PositionState& state, int left, int up);
+std::vector<Move> planAbsolute(PositionState& state, int pan, int tilt);
+
+// A rough estimate of how long the mechanism takes to carry out a
+// move, in microseconds.  Both axes move at once.
+int64_t moveTimeUsec(const Move& move);
+// The same for moving that far, split into requests the way plans are,
+// but leaving out backlash, which depends on the moves before.
+int64_t travelTimeUsec(int left, int up);
+
+// The state file is $ORBITCTL_STATE, or ~/.orbitctl, with the
+// camera's USB location appended.  A missing file yields a default,
+// unhomed state.
+std::string defaultStatePath();
+std::string statePath(uint32_t locationId);
+PositionState loadPositionState(const std::string& path);
+// If the camera has no state file, this falls back to the one from
+// before there was a file per camera.
+PositionState loadCameraState(uint32_t locationId);
+// The cameras which have their own state file.
+std::vector<uint32_t> savedCameraStates();
+void savePositionState(const std::string& path, const PositionState& state);
+// The state file's format, for passing state along some other way.
+// name is only used in errors.
+PositionState readPositionState(std::istream& in, const std::string& name);
+void writePositionState(std::ostream& out, const PositionState& state);
+
+const char* policyName(BacklashPolicy policy);
+bool parsePolicy(const std::string& name, BacklashPolicy* policy);
@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "request.h"
+
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "uvc.h"
+
+void Request::panTiltRelative(int8_t left, int8_t up) {
+  LogitechMotorRequest value;
+  memset(&value, 0, sizeof(value));
+  if (left != 0) {
+    value.left = left < 0 ? left : left - 1;
+    value.leftEnable = LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE;
+  }
+  if (up != 0) {
+    value.up = up < 0 ? up : up - 1;
+    value.upEnable = LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE;
+  }
+
+  setData(
+    kMotorUnit,
+    LXU_MOTOR_PANTILT_RELATIVE_CONTROL,
+    &value,
+    sizeof(value));
+}
+
+void Request::panTiltReset(bool pan, bool tilt) {
+  uint8_t value = (pan ? LXU_MOTOR_PANTILT_RESET_CONTROL_PAN : 0) |
+                  (tilt ? LXU_MOTOR_PANTILT_RESET_CONTROL_TILT : 0);
+
+  setData(
+    kMotorUnit,
+    LXU_MOTOR_PANTILT_RESET_CONTROL,
+    &value,
+    sizeof(value));
+}
+
+void Request::probe() {
+  uint8_t info = 0;
+  setData(
+    kMotorUnit,
+    LXU_MOTOR_PANTILT_RELATIVE_CONTROL,
+    &info,
+    sizeof(info));
+  request_ = UVC_GET_INFO;
+}
+
+void Request::ledControl(uint8_t mode, uint16_t frequency) {
+  // The frequency is big endian.
+  uint8_t value[sizeof(LogitechLedRequest)] =
+    {
+     mode,
+     static_cast<uint8_t>(frequency >> 8),
+     static_cast<uint8_t>(frequency & 0xff),
+    };
+
+  setData(
+    kHwControlUnit,
+    LXU_HW_CONTROL_LED1,
+    value,
+    sizeof(value));
+}
+
+void Request::send(Transport& transport, uint8_t motorUnit,
+                   uint8_t hwControlUnit) {
+  uint8_t unitId;
+  switch (unit_) {
+  case kMotorUnit:
+    unitId = motorUnit;
+    break;
+  case kHwControlUnit:
+    unitId = hwControlUnit;
+    break;
+  default:
+    throw std::runtime_error("Unknown unit");
+  };
+
+  uint32_t done = transport.controlRequest(
+    request_,
+    unitId,
+    selector_,
+    data_,
+    length_);
+  // A SET which didn't all get there may have been half done.
+  if (!(request_ & 0x80) && done < length_) {
+    throw std::runtime_error("short transfer");
+  }
+  length_ = done;
+}
+
+void Request::setData(Unit unit, uint8_t selector, const void *data,
+                      uint16_t length) {
+  if (length > sizeof(data_)) {
+    throw std::runtime_error("length cannot exceed " +
+                             std::to_string(sizeof(data_)));
+  }
+  unit_ = unit;
+  request_ = UVC_SET_CUR;
+  selector_ = selector;
+  memcpy(data_, data, length);
+  length_ = length;
+}
+
+namespace {
+
+int decodeSteps(uint8_t enable, uint8_t value) {
+  if (!(enable & LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE)) {
+    return 0;
+  }
+  int v = static_cast<int8_t>(value);
+  return v < 0 ? v : v + 1;
+}
+
+}
+
+void decodePanTiltRelative(const uint8_t* data, int* left, int* up) {
+  LogitechMotorRequest value;
+  memcpy(&value, data, sizeof(value));
+  *left = decodeSteps(value.leftEnable, value.left);
+  *up = decodeSteps(value.upEnable, value.up);
+}
+
+bool findExtensionUnits(const std::vector<uint8_t>& descriptors,
+                        uint8_t* motorUnit, uint8_t* hwControlUnit) {
+  bool foundMotor = false;
+  bool foundHwControl = false;
+  for (size_t i = 0;
+       i + sizeof(VCDescriptor) <= descriptors.size() &&
+         descriptors[i] >= sizeof(VCDescriptor);
+       i += descriptors[i]) {
+    auto* vcdesc = reinterpret_cast<const VCDescriptor*>(&descriptors[i]);
+    if (vcdesc->bDescriptorType != VS_LOGITECH_TYPE ||
+        vcdesc->bDescriptorSubType != VS_LOGITECH_EXTENSION_UNIT ||
+        i + sizeof(VCExtensionUnitDescriptor) > descriptors.size()) {
+      continue;
+    }
+    auto* eudesc = reinterpret_cast<const VCExtensionUnitDescriptor*>(vcdesc);
+    if (memcmp(eudesc->guidExtensionCode, LXU_MOTOR_GUID,
+               sizeof(LXU_MOTOR_GUID)) == 0) {
+      *motorUnit = eudesc->bUnitID;
+      foundMotor = true;
+    } else if (memcmp(eudesc->guidExtensionCode, LXU_HW_CONTROL_GUID,
+                      sizeof(LXU_HW_CONTROL_GUID)) == 0) {
+      *hwControlUnit = eudesc->bUnitID;
+      foundHwControl = true;
+    }
+  }
+  return foundMotor && foundHwControl;
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "transport.h"
+
+// A control request for one of the camera's Logitech extension units.
+// Build it with one of the setters, then send it.
+class Request {
+public:
+  enum Unit { kMotorUnit, kHwControlUnit };
+
+  // The direction is in terms of what the image appears to do.  So,
+  // up would move the center of the image on the screen in the same
+  // direction as if you dragged the window up.  I don't know what
+  // units these are, but higher number move more.  I haven't wanted
+  // to risk my device to see what happens if you exceed the range of
+  // the mechanism.
+  void panTiltRelative(int8_t left, int8_t up);
+
+  // The value is a bitmask of which axes to reset.
+  void panTiltReset(bool pan = true, bool tilt = true);
+
+  // This reads the capabilities of the pan/tilt control, which
+  // doesn't disturb the camera, so it's a cheap way to check that the
+  // camera is still responding.
+  void probe();
+
+  // frequency is in units of 0.05 Hz
+  void ledControl(uint8_t mode, uint16_t frequency);
+
+  // The unit ids come from the camera's descriptors.
+  void send(Transport& transport, uint8_t motorUnit, uint8_t hwControlUnit);
+
+  Unit unit() const { return unit_; }
+  uint8_t request() const { return request_; }
+  uint8_t selector() const { return selector_; }
+  // For GET requests, this is what the camera sent.
+  const uint8_t* data() const { return data_; }
+  uint16_t length() const { return length_; }
+
+private:
+  void setData(Unit unit, uint8_t selector, const void *data,
+               uint16_t length);
+
+  Unit unit_;
+  uint8_t request_;
+  uint8_t selector_;
+  uint8_t data_[32];
+  uint16_t length_;
+};
+
+// The inverse of panTiltRelative's encoding, for the other end.
+void decodePanTiltRelative(const uint8_t* data, int* left, int* up);
+
+// Finds the Logitech extension units in a video control interface's
+// class specific descriptors, for when they don't come from IOKit.
+// Returns false if either is missing.
+bool findExtensionUnits(const std::vector<uint8_t>& descriptors,
+                        uint8_t* motorUnit, uint8_t* hwControlUnit);
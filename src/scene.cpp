@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "scene.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "controller.h"
+#include "position.h"
+#include "uvc.h"
+
+namespace {
+
+const char* ledName(int mode) {
+  switch (mode) {
+  case LXU_HW_CONTROL_LED1_MODE_ON:
+    return "on";
+  case LXU_HW_CONTROL_LED1_MODE_OFF:
+    return "off";
+  case LXU_HW_CONTROL_LED1_MODE_AUTO:
+    return "auto";
+  }
+  return nullptr;
+}
+
+}
+
+std::string scenePath(const std::string& name) {
+  if (name.empty() || name.find('/') != std::string::npos) {
+    throw std::runtime_error("bad scene name " + name);
+  }
+  return defaultStatePath() + "-scene-" + name;
+}
+
+std::vector<SceneCamera> loadScene(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("can't read " + path);
+  }
+  std::vector<SceneCamera> cameras;
+  std::set<uint32_t> seen;
+  std::string text;
+  int lineNumber = 0;
+  while (std::getline(in, text)) {
+    lineNumber++;
+    std::istringstream line(text);
+    std::string location, led;
+    if (!(line >> location)) {
+      continue;
+    }
+    char* end;
+    unsigned long locationId = strtoul(location.c_str(), &end, 16);
+    SceneCamera camera{static_cast<uint32_t>(locationId), 0, 0, -1};
+    bool ok = *end == '\0' && locationId != 0 &&
+      locationId <= 0xffffffff && (line >> camera.pan >> camera.tilt) &&
+      seen.insert(camera.locationId).second;
+    if (ok && line >> led) {
+      ControlCommand command;
+      ok = parseControlAction("led " + led, &command);
+      camera.ledMode = command.a;
+    }
+    if (!ok || line >> led) {
+      throw std::runtime_error(
+        path + ":" + std::to_string(lineNumber) + ": bad scene line");
+    }
+    cameras.push_back(camera);
+  }
+  return cameras;
+}
+
+void saveScene(const std::string& path,
+               const std::vector<SceneCamera>& cameras) {
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath);
+    for (const SceneCamera& camera : cameras) {
+      char location[16];
+      snprintf(location, sizeof(location), "%08x", camera.locationId);
+      out << location << " " << camera.pan << " " << camera.tilt;
+      if (const char* led = ledName(camera.ledMode)) {
+        out << " " << led;
+      }
+      out << "\n";
+    }
+    if (!out) {
+      throw std::runtime_error("writing " + tmpPath + " failed");
+    }
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("renaming " + tmpPath + " failed");
+  }
+}
@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// A scene is where a set of cameras point, and what their LEDs do, so
+// they can all be put back together.  Scene files have a line per
+// camera, "location pan tilt [on | off | auto]", with the location in
+// hex, and the LED left alone if there's no mode.
+
+struct SceneCamera {
+  uint32_t locationId;
+  int pan;
+  int tilt;
+  // The LED mode, or -1.
+  int ledMode;
+};
+
+// Where the named scene is kept, next to the state files.
+std::string scenePath(const std::string& name);
+std::vector<SceneCamera> loadScene(const std::string& path);
+void saveScene(const std::string& path,
+               const std::vector<SceneCamera>& cameras);
@@ -0,0 +1,382 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "simulation.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "emulator.h"
+#include "health.h"
+#include "position.h"
+#include "request.h"
+
+Simulation::Simulation(uint64_t seed)
+  : random_(seed)
+{}
+
+void Simulation::at(int64_t whenUsec, std::function<void()> event) {
+  events_.push(Event{std::max(whenUsec, nowUsec_), sequence_++,
+                     std::move(event)});
+}
+
+uint64_t Simulation::run(int64_t untilUsec) {
+  uint64_t count = 0;
+  while (!events_.empty() && events_.top().whenUsec < untilUsec) {
+    // The event may add more, so take it off first.
+    Event event = events_.top();
+    events_.pop();
+    nowUsec_ = event.whenUsec;
+    event.run();
+    count++;
+  }
+  nowUsec_ = std::max(nowUsec_, untilUsec);
+  return count;
+}
+
+int64_t Simulation::exponentialUsec(int64_t meanUsec) {
+  std::exponential_distribution<double> distribution(1.0 / meanUsec);
+  return static_cast<int64_t>(distribution(random_));
+}
+
+namespace {
+
+// The same as a real transfer which gets no answer.
+constexpr int64_t kTimeoutUsec = 1000000;
+// The same as recover in orbitctl.
+constexpr int64_t kReenumerateTimeoutUsec = 10000000;
+constexpr int64_t kRescanIntervalUsec = 500000;
+
+// Where plans send the cameras, staying clear of the end stops.
+constexpr int kPanRange = 40;
+constexpr int kTiltRange = 25;
+
+void send(Transport& transport, Request& req) {
+  req.send(transport, OrbitEmulator::kMotorUnit, OrbitEmulator::kHwControlUnit);
+}
+
+class Fleet {
+public:
+  Fleet(const FleetConfig& config)
+    : config_(config)
+    , sim_(config.seed)
+    , cameras_(config.cameras)
+    , monitor_(config.cameras, config.probeIntervalUsec, 0)
+  {}
+
+  FleetStats run();
+
+private:
+  struct SimulatedCamera {
+    std::unique_ptr<Transport> transport;
+    OrbitEmulator* emulator = nullptr;
+    FaultyTransport* faults = nullptr;
+    bool plugged = true;
+    uint64_t plugs = 0;
+    int64_t unpluggedUsec = 0;
+    // When the last transfer will be done.
+    int64_t busyUntilUsec = 0;
+    PositionState state;
+    uint64_t dropped = 0;
+    FaultStats pastFaults;
+  };
+
+  using Body = std::function<void(Transport&)>;
+  using Done = std::function<void(bool ok)>;
+
+  void plugIn(size_t i);
+  void transfer(size_t i, Body body, Done done);
+  void reset(size_t i, Done done);
+  void plan(size_t i);
+  void sendMoves(size_t i, std::vector<Move> moves, size_t next, int pan,
+                 int tilt, int64_t startUsec);
+  void unplug(size_t i);
+  void probe();
+  void recover(size_t i);
+  void rescan(size_t i, int64_t waitedUsec);
+  void recovered(size_t i, bool ok);
+
+  FleetConfig config_;
+  Simulation sim_;
+  std::vector<SimulatedCamera> cameras_;
+  HealthMonitor monitor_;
+  bool probing_ = false;
+  // Injected delay during the current transfer.
+  int64_t injectedUsec_ = 0;
+
+  FleetStats stats_;
+  std::vector<int64_t> latencies_;
+  double totalError_ = 0;
+  int64_t totalPlanUsec_ = 0;
+  int64_t totalDetectUsec_ = 0;
+  uint64_t detections_ = 0;
+};
+
+void Fleet::plugIn(size_t i) {
+  SimulatedCamera& camera = cameras_[i];
+  if (camera.emulator) {
+    camera.dropped += camera.emulator->status().dropped;
+  }
+  if (camera.faults) {
+    camera.pastFaults += camera.faults->stats();
+  }
+  // A camera which has been unplugged starts over.
+  camera.emulator = new OrbitEmulator(
+    config_.mechanism, [this]() { return sim_.nowUsec(); });
+  camera.transport.reset(camera.emulator);
+  camera.faults = nullptr;
+  if (config_.injectFaults) {
+    FaultConfig faults = config_.faults;
+    faults.seed += i * 1000003 + camera.plugs;
+    camera.faults = new FaultyTransport(
+      std::move(camera.transport), faults,
+      [this](int64_t usec) { injectedUsec_ += usec; });
+    camera.transport.reset(camera.faults);
+  }
+  camera.plugs++;
+  camera.plugged = true;
+}
+
+void Fleet::transfer(size_t i, Body body, Done done) {
+  SimulatedCamera& camera = cameras_[i];
+  int64_t start = std::max(sim_.nowUsec(), camera.busyUntilUsec);
+  int64_t latency = kTimeoutUsec;
+  if (camera.plugged) {
+    latency = config_.minLatencyUsec +
+      sim_.exponentialUsec(config_.meanExtraLatencyUsec);
+  }
+  camera.busyUntilUsec = start + latency;
+  int64_t issued = sim_.nowUsec();
+  sim_.at(camera.busyUntilUsec, [this, i, issued, body, done]() {
+    SimulatedCamera& camera = cameras_[i];
+    bool ok = camera.plugged;
+    injectedUsec_ = 0;
+    if (ok) {
+      try {
+        body(*camera.transport);
+      } catch (const std::exception&) {
+        ok = false;
+      }
+    }
+    stats_.requests++;
+    if (!ok) {
+      stats_.failedRequests++;
+    }
+    // Injected delays hold up this camera's later transfers too.
+    int64_t injected = injectedUsec_;
+    camera.busyUntilUsec += injected;
+    latencies_.push_back(sim_.nowUsec() + injected - issued);
+    sim_.after(injected, [done, ok]() { done(ok); });
+  });
+}
+
+void Fleet::reset(size_t i, Done done) {
+  transfer(i, [](Transport& transport) {
+    Request req;
+    req.panTiltReset();
+    send(transport, req);
+  }, [this, i, done](bool ok) {
+    if (ok) {
+      cameras_[i].state.reset(true, true, sim_.nowUsec());
+    }
+    done(ok);
+  });
+}
+
+// Moves are paced the way sendMoves paces them.
+void Fleet::sendMoves(size_t i, std::vector<Move> moves, size_t next,
+                      int pan, int tilt, int64_t startUsec) {
+  if (next == moves.size()) {
+    OrbitEmulator::Status status = cameras_[i].emulator->status();
+    double error = hypot(status.pan - pan, status.tilt - tilt);
+    totalError_ += error;
+    stats_.maxError = std::max(stats_.maxError, error);
+    totalPlanUsec_ += sim_.nowUsec() - startUsec;
+    stats_.plans++;
+    return;
+  }
+
+  Move move = moves[next];
+  transfer(i, [move](Transport& transport) {
+    Request req;
+    req.panTiltRelative(move.left, move.up);
+    send(transport, req);
+  }, [this, i, moves, next, pan, tilt, startUsec, move](bool ok) {
+    if (!ok) {
+      // Where the camera got to is anyone's guess.
+      cameras_[i].state.pan.homed = cameras_[i].state.tilt.homed = false;
+      return;
+    }
+    sim_.after(moveTimeUsec(move), [=]() {
+      sendMoves(i, moves, next + 1, pan, tilt, startUsec);
+    });
+  });
+}
+
+void Fleet::plan(size_t i) {
+  sim_.after(config_.moveIntervalUsec, [this, i]() { plan(i); });
+
+  SimulatedCamera& camera = cameras_[i];
+  if (monitor_.isRecovering(i)) {
+    return;
+  }
+  if (!camera.state.homed()) {
+    // Like reset auto, before going anywhere.
+    reset(i, [](bool) {});
+    return;
+  }
+  std::uniform_int_distribution<int> panTarget(-kPanRange, kPanRange);
+  std::uniform_int_distribution<int> tiltTarget(-kTiltRange, kTiltRange);
+  int pan = panTarget(sim_.random());
+  int tilt = tiltTarget(sim_.random());
+  std::vector<Move> moves = planAbsolute(camera.state, pan, tilt);
+  int64_t startUsec = sim_.nowUsec();
+  int64_t until = std::max(camera.state.pan.resetUntilUsec,
+                           camera.state.tilt.resetUntilUsec);
+  sim_.at(until, [=]() { sendMoves(i, moves, 0, pan, tilt, startUsec); });
+}
+
+void Fleet::unplug(size_t i) {
+  SimulatedCamera& camera = cameras_[i];
+  if (camera.plugged) {
+    camera.plugged = false;
+    camera.unpluggedUsec = sim_.nowUsec();
+    stats_.unplugs++;
+    sim_.after(sim_.exponentialUsec(config_.meanUnpluggedUsec),
+               [this, i]() { plugIn(i); });
+  }
+  sim_.after(sim_.exponentialUsec(config_.meanUnplugIntervalUsec),
+             [this, i]() { unplug(i); });
+}
+
+// The same loop as watch, one check at a time.
+void Fleet::probe() {
+  size_t i;
+  int64_t when;
+  if (!monitor_.next(&i, &when)) {
+    probing_ = false;
+    return;
+  }
+  probing_ = true;
+  sim_.at(when, [this, i]() {
+    transfer(i, [](Transport& transport) {
+      Request req;
+      req.probe();
+      send(transport, req);
+      if (req.length() != 1) {
+        throw std::runtime_error("short transfer");
+      }
+    }, [this, i](bool ok) {
+      if (monitor_.report(i, ok, sim_.nowUsec())) {
+        recover(i);
+      }
+      probe();
+    });
+  });
+}
+
+void Fleet::recover(size_t i) {
+  SimulatedCamera& camera = cameras_[i];
+  if (!camera.plugged) {
+    totalDetectUsec_ += sim_.nowUsec() - camera.unpluggedUsec;
+    detections_++;
+  }
+  rescan(i, 0);
+}
+
+// Like recover in orbitctl, this looks for the camera every so often
+// until it comes back or it's been too long, then resets it.
+void Fleet::rescan(size_t i, int64_t waitedUsec) {
+  sim_.after(kRescanIntervalUsec, [this, i, waitedUsec]() {
+    int64_t waited = waitedUsec + kRescanIntervalUsec;
+    if (cameras_[i].plugged) {
+      // Re-enumerating restarts the camera.
+      plugIn(i);
+      reset(i, [this, i](bool ok) { recovered(i, ok); });
+    } else if (waited < kReenumerateTimeoutUsec) {
+      rescan(i, waited);
+    } else {
+      recovered(i, false);
+    }
+  });
+}
+
+void Fleet::recovered(size_t i, bool ok) {
+  if (ok) {
+    stats_.recoveries++;
+  } else {
+    stats_.failedRecoveries++;
+  }
+  monitor_.recovered(i, ok, sim_.nowUsec());
+  if (!probing_) {
+    probe();
+  }
+}
+
+FleetStats Fleet::run() {
+  for (size_t i = 0; i < cameras_.size(); i++) {
+    plugIn(i);
+    reset(i, [](bool) {});
+    // Spread the plans out like the checks.
+    sim_.after(config_.moveIntervalUsec * static_cast<int64_t>(i) /
+               static_cast<int64_t>(cameras_.size()),
+               [this, i]() { plan(i); });
+    sim_.after(sim_.exponentialUsec(config_.meanUnplugIntervalUsec),
+               [this, i]() { unplug(i); });
+  }
+  probe();
+
+  stats_.events = sim_.run(config_.durationUsec);
+
+  for (SimulatedCamera& camera : cameras_) {
+    stats_.droppedMoves += camera.dropped + camera.emulator->status().dropped;
+    stats_.faults += camera.pastFaults;
+    if (camera.faults) {
+      stats_.faults += camera.faults->stats();
+    }
+  }
+  if (!latencies_.empty()) {
+    std::sort(latencies_.begin(), latencies_.end());
+    stats_.latencyP50Usec = latencies_[latencies_.size() / 2];
+    stats_.latencyP99Usec = latencies_[latencies_.size() * 99 / 100];
+    stats_.latencyMaxUsec = latencies_.back();
+  }
+  if (stats_.plans > 0) {
+    stats_.meanError = totalError_ / stats_.plans;
+    stats_.meanPlanUsec = totalPlanUsec_ / static_cast<int64_t>(stats_.plans);
+  }
+  if (detections_ > 0) {
+    stats_.meanDetectUsec =
+      totalDetectUsec_ / static_cast<int64_t>(detections_);
+  }
+  return stats_;
+}
+
+}
+
+FleetStats simulateFleet(const FleetConfig& config) {
+  Fleet fleet(config);
+  return fleet.run();
+}
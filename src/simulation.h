@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "faults.h"
+#include "mechanism.h"
+
+// A discrete event simulation, for running long schedules on many
+// cameras without waiting for them.  Time only passes between events,
+// so a day goes by in seconds, and since everything random comes from
+// one seeded generator, a run can be repeated exactly.
+
+class Simulation {
+public:
+  explicit Simulation(uint64_t seed);
+
+  int64_t nowUsec() const { return nowUsec_; }
+  std::mt19937_64& random() { return random_; }
+
+  // Events at the same time run in the order they were added.
+  void at(int64_t whenUsec, std::function<void()> event);
+  void after(int64_t delayUsec, std::function<void()> event) {
+    at(nowUsec_ + delayUsec, std::move(event));
+  }
+
+  // Runs events until there are none left before untilUsec, and
+  // returns how many ran.
+  uint64_t run(int64_t untilUsec);
+
+  // A random delay with the given mean, exponentially distributed, like
+  // the time between independent events.
+  int64_t exponentialUsec(int64_t meanUsec);
+
+private:
+  struct Event {
+    int64_t whenUsec;
+    uint64_t sequence;
+    std::function<void()> run;
+  };
+
+  struct Later {
+    bool operator()(const Event& a, const Event& b) const {
+      return a.whenUsec != b.whenUsec
+        ? a.whenUsec > b.whenUsec : a.sequence > b.sequence;
+    }
+  };
+
+  int64_t nowUsec_ = 0;
+  uint64_t sequence_ = 0;
+  std::mt19937_64 random_;
+  std::priority_queue<Event, std::vector<Event>, Later> events_;
+};
+
+// A fleet of emulated cameras, each being moved around on a schedule
+// and checked by a HealthMonitor the way watch does, while being
+// unplugged and plugged back in now and then.
+struct FleetConfig {
+  size_t cameras = 4;
+  int64_t durationUsec = 24 * 3600 * 1000000LL;
+  uint64_t seed = 1;
+  // Each transfer takes the minimum plus an exponentially distributed
+  // extra with this mean.  Transfers to one camera don't overlap.
+  int64_t minLatencyUsec = 500;
+  int64_t meanExtraLatencyUsec = 1500;
+  // How often each camera is sent somewhere new, and checked.
+  int64_t moveIntervalUsec = 10000000;
+  int64_t probeIntervalUsec = 10000000;
+  // The mean time between a camera being unplugged, and how long it
+  // stays unplugged.
+  int64_t meanUnplugIntervalUsec = 6 * 3600 * 1000000LL;
+  int64_t meanUnpluggedUsec = 30000000;
+  MechanismModel mechanism;
+  // Faults are injected between the fleet and the cameras if asked.
+  bool injectFaults = false;
+  FaultConfig faults;
+};
+
+struct FleetStats {
+  uint64_t events = 0;
+  uint64_t requests = 0;
+  uint64_t failedRequests = 0;
+  uint64_t plans = 0;
+  uint64_t unplugs = 0;
+  uint64_t recoveries = 0;
+  uint64_t failedRecoveries = 0;
+  uint64_t droppedMoves = 0;
+  // Transfer latency, including waiting for the camera's previous
+  // transfer to finish.
+  int64_t latencyP50Usec = 0;
+  int64_t latencyP99Usec = 0;
+  int64_t latencyMaxUsec = 0;
+  // How far off each plan left the camera, in steps, once orbitctl
+  // would think it was done, and how long that took.
+  double meanError = 0;
+  double maxError = 0;
+  int64_t meanPlanUsec = 0;
+  // How long an unplugged camera went before recovery started.
+  int64_t meanDetectUsec = 0;
+  FaultStats faults;
+};
+
+FleetStats simulateFleet(const FleetConfig& config);
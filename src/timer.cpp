@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "timer.h"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel(int64_t nowUsec, int64_t tickUsec, size_t slots)
+  : tickUsec_(tickUsec)
+  , slots_(slots)
+  , nextTick_(nowUsec / tickUsec)
+{
+}
+
+uint64_t TimerWheel::add(int64_t atUsec, int64_t slackUsec, Callback done) {
+  uint64_t id = nextId_++;
+  int64_t tick = std::max(atUsec / tickUsec_, nextTick_);
+  size_t slot = tick % slots_.size();
+  int64_t latest = atUsec + std::max<int64_t>(0, slackUsec);
+  slots_[slot].push_back(Timer{id, atUsec, latest, std::move(done)});
+  where_[id] = slot;
+  wakes_.push(std::make_pair(latest, id));
+  return id;
+}
+
+bool TimerWheel::cancel(uint64_t id) {
+  auto it = where_.find(id);
+  if (it == where_.end()) {
+    return false;
+  }
+  std::vector<Timer>& slot = slots_[it->second];
+  for (size_t i = 0; i < slot.size(); i++) {
+    if (slot[i].id == id) {
+      slot[i] = std::move(slot.back());
+      slot.pop_back();
+      break;
+    }
+  }
+  where_.erase(it);
+  if (wakes_.size() > 2 * where_.size() + slots_.size()) {
+    decltype(wakes_) wakes;
+    for (const std::vector<Timer>& timers : slots_) {
+      for (const Timer& timer : timers) {
+        wakes.push(std::make_pair(timer.latestUsec, timer.id));
+      }
+    }
+    wakes_.swap(wakes);
+  }
+  return true;
+}
+
+int64_t TimerWheel::nextWakeUsec() {
+  while (!wakes_.empty() && !where_.count(wakes_.top().second)) {
+    wakes_.pop();
+  }
+  return wakes_.empty() ? INT64_MAX : wakes_.top().first;
+}
+
+size_t TimerWheel::expire(int64_t nowUsec) {
+  // Take everything due out first, since running a timer can change
+  // the slots.
+  std::vector<Timer> due;
+  int64_t nowTick = nowUsec / tickUsec_;
+  // Late timers are in nextTick_'s slot, so it's always looked at.
+  int64_t ticks = std::max<int64_t>(
+    1, std::min<int64_t>(nowTick - nextTick_ + 1, slots_.size()));
+  for (int64_t i = 0; i < ticks; i++) {
+    std::vector<Timer>& slot = slots_[(nextTick_ + i) % slots_.size()];
+    for (size_t j = 0; j < slot.size();) {
+      if (slot[j].atUsec <= nowUsec) {
+        due.push_back(std::move(slot[j]));
+        slot[j] = std::move(slot.back());
+        slot.pop_back();
+      } else {
+        j++;
+      }
+    }
+  }
+  // The current tick's slot can still get timers due later in it.
+  nextTick_ = std::max(nextTick_, nowTick);
+
+  std::sort(due.begin(), due.end(), [](const Timer& a, const Timer& b) {
+    return a.atUsec < b.atUsec;
+  });
+  // A timer stays in where_ until it runs, so one cancelled by an
+  // earlier timer in this batch is skipped.
+  size_t ran = 0;
+  for (Timer& timer : due) {
+    if (where_.erase(timer.id) == 0) {
+      continue;
+    }
+    timer.done();
+    ran++;
+  }
+  return ran;
+}
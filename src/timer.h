@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Timers for a thread which should only wake up when something is
+// due.  Timers hash into a ring of slots by deadline, so adding and
+// cancelling them is cheap however many there are, and a timer due
+// after the ring comes round just waits in its slot.
+//
+// Each timer can run a little late, up to its slack, and the next
+// wakeup is put off as long as every timer's slack allows, so timers
+// due close together share one wakeup.
+
+class TimerWheel {
+public:
+  using Callback = std::function<void()>;
+
+  TimerWheel(int64_t nowUsec, int64_t tickUsec = 1000, size_t slots = 256);
+
+  // Runs done no sooner than atUsec, and no later than slackUsec after
+  // it, if expire() is called when nextWakeUsec() says.  Returns an id
+  // for cancel(), which is never 0.
+  uint64_t add(int64_t atUsec, int64_t slackUsec, Callback done);
+  // Returns false if the timer already ran or was cancelled.
+  bool cancel(uint64_t id);
+
+  // When expire() should be called next, or INT64_MAX if there are no
+  // timers.
+  int64_t nextWakeUsec();
+  // Runs every timer which is due, and returns how many.  Timers can
+  // add or cancel timers.
+  size_t expire(int64_t nowUsec);
+
+  size_t size() const { return where_.size(); }
+
+private:
+  struct Timer {
+    uint64_t id;
+    int64_t atUsec;
+    int64_t latestUsec;
+    Callback done;
+  };
+
+  int64_t tickUsec_;
+  std::vector<std::vector<Timer>> slots_;
+  // The slot each timer is in.
+  std::unordered_map<uint64_t, size_t> where_;
+  // The first tick expire() hasn't finished with.  Timers due before
+  // it go in its slot, so they aren't missed.
+  int64_t nextTick_;
+  uint64_t nextId_ = 1;
+  // Every timer's latestUsec and id, earliest first.  Timers which ran
+  // or were cancelled are only dropped once they reach the top, or when
+  // they outnumber the rest and it's rebuilt.
+  std::priority_queue<std::pair<int64_t, uint64_t>,
+                      std::vector<std::pair<int64_t, uint64_t>>,
+                      std::greater<std::pair<int64_t, uint64_t>>> wakes_;
+};
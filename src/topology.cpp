@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "topology.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+uint32_t usbController(uint32_t locationId) {
+  return locationId >> 24;
+}
+
+uint32_t usbHub(uint32_t locationId) {
+  // The camera's own port is the last one in the path.
+  for (int shift = 0; shift < 24; shift += 4) {
+    if (locationId & (0xfu << shift)) {
+      return locationId & ~(0xfu << shift);
+    }
+  }
+  return locationId;
+}
+
+std::string usbPath(uint32_t locationId) {
+  std::string path = std::to_string(usbController(locationId));
+  char separator = '-';
+  for (int shift = 20; shift >= 0; shift -= 4) {
+    uint32_t port = (locationId >> shift) & 0xf;
+    if (port == 0) {
+      break;
+    }
+    path += separator + std::to_string(port);
+    separator = '.';
+  }
+  return path;
+}
+
+bool parseUsbPath(const std::string& path, uint32_t* locationId) {
+  std::istringstream in(path);
+  in.unsetf(std::ios::skipws);
+  int bus, port;
+  char separator;
+  if (!(in >> bus) || bus < 1 || bus > 255) {
+    return false;
+  }
+  uint32_t location = static_cast<uint32_t>(bus) << 24;
+  int shift = 20;
+  for (char expected = '-'; in >> separator; expected = '.') {
+    if (separator != expected || shift < 0 || !(in >> port) || port < 1 ||
+        port > 15) {
+      return false;
+    }
+    location |= static_cast<uint32_t>(port) << shift;
+    shift -= 4;
+  }
+  if (shift == 20) {
+    return false;
+  }
+  *locationId = location;
+  return true;
+}
+
+bool parseLocation(const std::string& text, uint32_t* locationId) {
+  char* end;
+  unsigned long value = strtoul(text.c_str(), &end, 16);
+  if (text.empty() || *end != '\0' || value == 0 || value > 0xffffffff) {
+    return false;
+  }
+  *locationId = static_cast<uint32_t>(value);
+  return true;
+}
+
+std::vector<size_t> assignWorkers(const std::vector<uint32_t>& locations,
+                                  size_t* workers, size_t maxWorkers) {
+  bool byController = *workers == 0;
+  std::map<uint32_t, std::vector<size_t>> groups;
+  for (size_t i = 0; i < locations.size(); i++) {
+    uint32_t key = byController
+      ? usbController(locations[i]) : usbHub(locations[i]);
+    groups[key].push_back(i);
+  }
+  if (byController) {
+    *workers = std::min(groups.size(), maxWorkers);
+  }
+  *workers = std::max<size_t>(1, std::min(*workers, locations.size()));
+
+  std::vector<const std::vector<size_t>*> order;
+  for (const auto& group : groups) {
+    order.push_back(&group.second);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const std::vector<size_t>* a,
+                      const std::vector<size_t>* b) {
+                     return a->size() > b->size();
+                   });
+  std::vector<size_t> load(*workers);
+  std::vector<size_t> assigned(locations.size());
+  for (const std::vector<size_t>* group : order) {
+    size_t worker = std::min_element(load.begin(), load.end()) - load.begin();
+    load[worker] += group->size();
+    for (size_t camera : *group) {
+      assigned[camera] = worker;
+    }
+  }
+  return assigned;
+}
+
+size_t hubMotorBudget() {
+  const char* budget = getenv("ORBITCTL_HUB_MOTORS");
+  if (!budget || !*budget) {
+    return 0;
+  }
+  char* end;
+  long value = strtol(budget, &end, 10);
+  if (*end != '\0' || value < 0) {
+    throw std::runtime_error(std::string("bad ORBITCTL_HUB_MOTORS ") +
+                             budget);
+  }
+  return static_cast<size_t>(value);
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Where a camera is on the USB tree, from its location.  The top byte
+// is the controller, and each nibble after it is a port on the next
+// hub down, so 0xfa120000 is port 2 of the hub on port 1 of controller
+// 0xfa.  Linux names the same place "250-1.2", with the bus number and
+// the ports, as in sysfs.
+
+uint32_t usbController(uint32_t locationId);
+// The location of the hub the camera is plugged into, with the
+// controller's own root hub at 0xfa000000.
+uint32_t usbHub(uint32_t locationId);
+std::string usbPath(uint32_t locationId);
+// Returns false unless the path is a bus from 1 to 255 and one to six
+// ports from 1 to 15.
+bool parseUsbPath(const std::string& path, uint32_t* locationId);
+// Locations are written in hex, without 0x.  Returns false for
+// anything else, or 0.
+bool parseLocation(const std::string& text, uint32_t* locationId);
+
+// Splits cameras among workers so each hub's cameras share one, since
+// their transfers contend anyway, while other hubs and controllers go
+// in parallel.  Whole hubs are handed out biggest first, each to the
+// worker with the fewest cameras so far.  With 0 workers, each
+// controller gets its own, up to maxWorkers, and whole controllers are
+// handed out instead.  Returns each camera's worker, and sets *workers
+// to how many there are.
+std::vector<size_t> assignWorkers(const std::vector<uint32_t>& locations,
+                                  size_t* workers, size_t maxWorkers);
+
+// How many cameras on one hub can run their motors at once before
+// the hub browns out, from $ORBITCTL_HUB_MOTORS, or 0 for no limit.
+size_t hubMotorBudget();
@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Checks that emulated cameras sit on a real-looking USB tree, and that
+// the workers share them out.  Run by "make check".
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "emulator.h"
+#include "topology.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what, size_t count) {
+  if (!ok) {
+    printf("FAIL %s, with %zu cameras\n", what, count);
+    failures++;
+  }
+}
+
+void checkEmulated(size_t count, size_t maxWorkers) {
+  std::vector<uint32_t> locations;
+  std::set<uint32_t> hubs;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t locationId = OrbitEmulator::location(i);
+    uint32_t parsed = 0;
+    check(parseUsbPath(usbPath(locationId), &parsed) &&
+            parsed == locationId,
+          "emulated location is a USB path", count);
+    locations.push_back(locationId);
+    hubs.insert(usbHub(locationId));
+  }
+  check(std::set<uint32_t>(locations.begin(), locations.end()).size() ==
+          count,
+        "emulated locations differ", count);
+
+  size_t workers = maxWorkers;
+  std::vector<size_t> owners = assignWorkers(locations, &workers,
+                                             maxWorkers);
+  std::set<size_t> used(owners.begin(), owners.end());
+  size_t expected = std::min(hubs.size(), maxWorkers);
+  check(used.size() == expected, "cameras spread over the workers", count);
+  size_t hubsWanted = count / 225 * 15 + std::min<size_t>(count % 225, 15);
+  check(hubs.size() == hubsWanted, "cameras spread over the hubs", count);
+}
+
+}
+
+int main() {
+  for (size_t count : {1, 2, 8, 15, 16, 100, 225, 226, 1000}) {
+    checkEmulated(count, 8);
+  }
+  if (failures == 0) {
+    printf("ok\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
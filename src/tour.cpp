@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "tour.h"
+
+#include <algorithm>
+
+#include "position.h"
+
+namespace {
+
+// How long it takes to get from each stop to each other stop.  It's
+// the same both ways, which 2-opt relies on.
+using Costs = std::vector<std::vector<int64_t>>;
+
+int64_t lapUsec(const Costs& cost, const std::vector<size_t>& order) {
+  int64_t total = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    total += cost[order[i]][order[(i + 1) % order.size()]];
+  }
+  return total;
+}
+
+std::vector<size_t> nearestNeighbour(const Costs& cost) {
+  size_t n = cost.size();
+  std::vector<size_t> order{0};
+  std::vector<bool> visited(n);
+  visited[0] = true;
+  while (order.size() < n) {
+    size_t from = order.back();
+    size_t best = n;
+    for (size_t i = 0; i < n; i++) {
+      if (!visited[i] && (best == n || cost[from][i] < cost[from][best])) {
+        best = i;
+      }
+    }
+    visited[best] = true;
+    order.push_back(best);
+  }
+  return order;
+}
+
+// Replaces two edges, a-b and c-d, with a-c and b-d, by reversing
+// everything from b to c, if that's quicker.
+bool twoOpt(const Costs& cost, std::vector<size_t>& order) {
+  size_t n = order.size();
+  bool improved = false;
+  for (size_t i = 0; i + 2 < n; i++) {
+    for (size_t j = i + 2; j < n; j++) {
+      size_t a = order[i];
+      size_t b = order[i + 1];
+      size_t c = order[j];
+      size_t d = order[(j + 1) % n];
+      if (d != a && cost[a][c] + cost[b][d] < cost[a][b] + cost[c][d]) {
+        std::reverse(order.begin() + i + 1, order.begin() + j + 1);
+        improved = true;
+      }
+    }
+  }
+  return improved;
+}
+
+// Moves a run of up to three stops, either way round, to between two
+// other stops, if that's quicker.  The first stop never moves.
+bool orOpt(const Costs& cost, std::vector<size_t>& order) {
+  size_t n = order.size();
+  for (size_t length = 1; length <= 3; length++) {
+    for (size_t i = 1; i + length <= n; i++) {
+      size_t first = order[i];
+      size_t last = order[i + length - 1];
+      size_t before = order[i - 1];
+      size_t after = order[(i + length) % n];
+      int64_t saved = cost[before][first] + cost[last][after] -
+        cost[before][after];
+      for (size_t k = 0; k < n; k++) {
+        if (k + 1 >= i && k < i + length) {
+          continue;
+        }
+        size_t u = order[k];
+        size_t v = order[(k + 1) % n];
+        int64_t added = cost[u][first] + cost[last][v] - cost[u][v];
+        int64_t reversed = cost[u][last] + cost[first][v] - cost[u][v];
+        if (std::min(added, reversed) >= saved) {
+          continue;
+        }
+        std::vector<size_t> run(order.begin() + i, order.begin() + i + length);
+        if (reversed < added) {
+          std::reverse(run.begin(), run.end());
+        }
+        order.erase(order.begin() + i, order.begin() + i + length);
+        size_t at = std::find(order.begin(), order.end(), u) - order.begin();
+        order.insert(order.begin() + at + 1, run.begin(), run.end());
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}
+
+TourOrder optimiseTour(const std::vector<std::pair<int, int>>& stops) {
+  size_t n = stops.size();
+  Costs cost(n, std::vector<int64_t>(n));
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      cost[i][j] = travelTimeUsec(stops[j].first - stops[i].first,
+                                  stops[j].second - stops[i].second);
+    }
+  }
+
+  TourOrder result;
+  for (size_t i = 0; i < n; i++) {
+    result.order.push_back(i);
+  }
+  result.givenUsec = lapUsec(cost, result.order);
+  result.optimisedUsec = result.givenUsec;
+  if (n <= 3) {
+    // Any order of three is the same loop.
+    return result;
+  }
+
+  std::vector<size_t> order = nearestNeighbour(cost);
+  bool improved = true;
+  while (improved) {
+    improved = twoOpt(cost, order);
+    while (orOpt(cost, order)) {
+      improved = true;
+    }
+  }
+  int64_t usec = lapUsec(cost, order);
+  if (usec < result.givenUsec) {
+    result.order = order;
+    result.optimisedUsec = usec;
+  }
+  return result;
+}
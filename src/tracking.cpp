@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "tracking.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "mechanism.h"
+
+namespace {
+
+// Process noise, as the spectral density of the target's
+// acceleration, in pixels^2/s^3, and measurement noise, in pixels^2.
+// People walking around a room are fairly smooth, and detectors are
+// good to a few pixels.
+constexpr double kAccelerationNoise = 4000;
+constexpr double kMeasurementNoise = 9;
+constexpr double kInitialVelocityVariance = 10000;
+
+// Don't bother chasing a target this close to the middle.
+constexpr double kDeadbandSteps = 1;
+
+int clampSteps(double steps) {
+  return static_cast<int>(
+    std::max<double>(-kMaxStepsPerMove,
+                     std::min<double>(kMaxStepsPerMove, lround(steps))));
+}
+
+// The fraction of a command's move which is done at tUsec.
+double progress(int64_t startUsec, int64_t endUsec, int64_t tUsec) {
+  if (tUsec <= startUsec) {
+    return 0;
+  }
+  if (tUsec >= endUsec) {
+    return 1;
+  }
+  return static_cast<double>(tUsec - startUsec) / (endUsec - startUsec);
+}
+
+}
+
+void KalmanAxis::predict(double dt) {
+  if (!initialized_ || dt <= 0) {
+    return;
+  }
+  x_ += v_ * dt;
+  double q = kAccelerationNoise;
+  double p00 = p00_ + 2 * dt * p01_ + dt * dt * p11_ + q * dt * dt * dt / 3;
+  double p01 = p01_ + dt * p11_ + q * dt * dt / 2;
+  double p11 = p11_ + q * dt;
+  p00_ = p00;
+  p01_ = p01;
+  p11_ = p11;
+}
+
+void KalmanAxis::update(double z) {
+  if (!initialized_) {
+    x_ = z;
+    v_ = 0;
+    p00_ = kMeasurementNoise;
+    p01_ = 0;
+    p11_ = kInitialVelocityVariance;
+    initialized_ = true;
+    return;
+  }
+  double s = p00_ + kMeasurementNoise;
+  double k0 = p00_ / s;
+  double k1 = p01_ / s;
+  double y = z - x_;
+  x_ += k0 * y;
+  v_ += k1 * y;
+  double p00 = (1 - k0) * p00_;
+  double p01 = (1 - k0) * p01_;
+  double p11 = p11_ - k1 * p01_;
+  p00_ = p00;
+  p01_ = p01;
+  p11_ = p11;
+}
+
+MotionModel::MotionModel(double panPixelsPerStep, double tiltPixelsPerStep,
+                         const LatencyModel& latency)
+  : panPixelsPerStep_(panPixelsPerStep)
+  , tiltPixelsPerStep_(tiltPixelsPerStep)
+  , latency_(latency)
+{
+  if (panPixelsPerStep == 0 || tiltPixelsPerStep == 0) {
+    throw std::runtime_error("pixels per step must be measured first");
+  }
+}
+
+void MotionModel::add(int64_t nowUsec, const Move& move) {
+  commands_.push_back(
+    Command{nowUsec + latency_.commandUsec,
+            nowUsec + latency_.settledUsec(move),
+            move.left * panPixelsPerStep_, move.up * tiltPixelsPerStep_});
+}
+
+void MotionModel::offsetAt(int64_t tUsec, double* dx, double* dy) const {
+  *dx = baseDx_;
+  *dy = baseDy_;
+  for (const Command& c : commands_) {
+    double done = progress(c.startUsec, c.endUsec, tUsec);
+    *dx += done * c.dx;
+    *dy += done * c.dy;
+  }
+}
+
+void MotionModel::finalOffset(double* dx, double* dy) const {
+  *dx = baseDx_;
+  *dy = baseDy_;
+  for (const Command& c : commands_) {
+    *dx += c.dx;
+    *dy += c.dy;
+  }
+}
+
+bool MotionModel::isMoving(int64_t nowUsec) {
+  while (!commands_.empty() && commands_.front().endUsec <= nowUsec) {
+    baseDx_ += commands_.front().dx;
+    baseDy_ += commands_.front().dy;
+    commands_.erase(commands_.begin());
+  }
+  return !commands_.empty();
+}
+
+Tracker::Tracker(double panPixelsPerStep, double tiltPixelsPerStep,
+                 const LatencyModel& latency, bool predict)
+  : motion_(panPixelsPerStep, tiltPixelsPerStep, latency)
+  , predict_(predict)
+{}
+
+bool Tracker::update(int64_t tUsec, double dx, double dy, int64_t nowUsec,
+                     Move* move) {
+  // Filter where the target is in the frame of the camera at home,
+  // so the camera's own moves don't look like target motion.
+  double offsetX, offsetY;
+  motion_.offsetAt(tUsec, &offsetX, &offsetY);
+  double dt = x_.isInitialized() ? (tUsec - lastUsec_) / 1e6 : 0;
+  lastUsec_ = tUsec;
+  x_.predict(dt);
+  y_.predict(dt);
+  x_.update(dx - offsetX);
+  y_.update(dy - offsetY);
+
+  // Wait for the last move to finish before starting another, since
+  // the firmware won't abandon a move to start a better one.
+  if (motion_.isMoving(nowUsec)) {
+    return false;
+  }
+  double baseX, baseY;
+  motion_.finalOffset(&baseX, &baseY);
+
+  // Aim for where the target will be when the move is done.  That
+  // depends on how big the move is, so refine it once.
+  Move m{0, 0};
+  for (int pass = 0; pass < 2; pass++) {
+    double ahead = 0;
+    if (predict_) {
+      ahead = (nowUsec - tUsec + motion_.latency().settledUsec(m)) / 1e6;
+    }
+    double targetX = predict_ ? x_.positionAfter(ahead) : dx - offsetX;
+    double targetY = predict_ ? y_.positionAfter(ahead) : dy - offsetY;
+    // The target is centered when its offset cancels the camera's.
+    m.left = clampSteps((-targetX - baseX) / motion_.panPixelsPerStep());
+    m.up = clampSteps((-targetY - baseY) / motion_.tiltPixelsPerStep());
+  }
+  if (std::abs(m.left) < kDeadbandSteps && std::abs(m.up) < kDeadbandSteps) {
+    return false;
+  }
+
+  motion_.add(nowUsec, m);
+  *move = m;
+  return true;
+}
+
+std::vector<TargetSample> readSequence(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("opening " + path + " failed");
+  }
+  std::vector<TargetSample> samples;
+  std::string text;
+  int lineNumber = 0;
+  while (std::getline(in, text)) {
+    lineNumber++;
+    if (text.empty() || text[0] == '#') {
+      continue;
+    }
+    std::istringstream line(text);
+    double ms;
+    TargetSample sample;
+    if (!(line >> ms >> sample.x >> sample.y)) {
+      throw std::runtime_error(
+        path + ":" + std::to_string(lineNumber) + ": bad sample");
+    }
+    sample.tUsec = static_cast<int64_t>(ms * 1000);
+    samples.push_back(sample);
+  }
+  return samples;
+}
+
+TrackingStats evaluateTracking(const std::vector<TargetSample>& sequence,
+                               double pixelsPerStep,
+                               const LatencyModel& actual,
+                               const LatencyModel& model, bool predict) {
+  // The simulated camera is the mechanism model, with its own latency,
+  // so wherever the tracker's idea of a move is off, it shows.
+  Tracker tracker(pixelsPerStep, pixelsPerStep, model, predict);
+  MechanismModel physics;
+  physics.commandUsec = actual.commandUsec;
+  Mechanism camera(physics);
+
+  TrackingStats stats;
+  double sumSquares = 0;
+  for (const TargetSample& sample : sequence) {
+    camera.advance(sample.tUsec);
+    double seenX = sample.x + camera.pan(sample.tUsec) * pixelsPerStep;
+    double seenY = sample.y + camera.tilt(sample.tUsec) * pixelsPerStep;
+    double error = sqrt(seenX * seenX + seenY * seenY);
+    sumSquares += error * error;
+    stats.maxError = std::max(stats.maxError, error);
+
+    Move move;
+    if (tracker.update(sample.tUsec, seenX, seenY, sample.tUsec, &move)) {
+      camera.move(move, sample.tUsec);
+      stats.moves++;
+    }
+  }
+  if (!sequence.empty()) {
+    stats.rmsError = sqrt(sumSquares / sequence.size());
+  }
+  stats.dropped = static_cast<int>(camera.dropped());
+  return stats;
+}
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "position.h"
+
+// Tracking keeps a moving target in the middle of the frame.  A move
+// takes effect well after the frame which asked for it, so the
+// target's motion is filtered and the camera is aimed at where the
+// target will be when the move finishes.
+
+// A constant velocity Kalman filter for one image axis.
+class KalmanAxis {
+public:
+  bool isInitialized() const { return initialized_; }
+  double position() const { return x_; }
+  double velocity() const { return v_; }
+
+  // Positions are in pixels, and dt in seconds.
+  void predict(double dt);
+  void update(double z);
+  double positionAfter(double dt) const { return x_ + v_ * dt; }
+
+private:
+  bool initialized_ = false;
+  double x_ = 0;
+  double v_ = 0;
+  // Covariance
+  double p00_ = 0;
+  double p01_ = 0;
+  double p11_ = 0;
+};
+
+struct LatencyModel {
+  // From deciding to move to the mechanism starting to move.
+  int64_t commandUsec = 40000;
+
+  int64_t settledUsec(const Move& move) const {
+    return commandUsec + moveTimeUsec(move);
+  }
+};
+
+// Keeps track of the moves which have been sent, and estimates how
+// far they have shifted the image at a given time, assuming each move
+// runs at a constant speed once it starts.  Offsets are in pixels,
+// in the direction the image content moves.
+class MotionModel {
+public:
+  MotionModel(double panPixelsPerStep, double tiltPixelsPerStep,
+              const LatencyModel& latency);
+
+  void add(int64_t nowUsec, const Move& move);
+  void offsetAt(int64_t tUsec, double* dx, double* dy) const;
+  // Where the image will be once every move is done.
+  void finalOffset(double* dx, double* dy) const;
+  // This also forgets the details of finished moves.
+  bool isMoving(int64_t nowUsec);
+
+  double panPixelsPerStep() const { return panPixelsPerStep_; }
+  double tiltPixelsPerStep() const { return tiltPixelsPerStep_; }
+  const LatencyModel& latency() const { return latency_; }
+
+private:
+  struct Command {
+    int64_t startUsec;
+    int64_t endUsec;
+    double dx;
+    double dy;
+  };
+
+  double panPixelsPerStep_;
+  double tiltPixelsPerStep_;
+  LatencyModel latency_;
+  // The offset from moves which have finished, and the ones which
+  // might not have.
+  double baseDx_ = 0;
+  double baseDy_ = 0;
+  std::vector<Command> commands_;
+};
+
+class Tracker {
+public:
+  // pixelsPerStep is how far the image moves per step, as measured by
+  // odometry.  Without prediction, the tracker just centers the last
+  // detection, which is useful for comparison.
+  Tracker(double panPixelsPerStep, double tiltPixelsPerStep,
+          const LatencyModel& latency, bool predict);
+
+  // dx and dy are where the target was seen at tUsec, relative to the
+  // middle of the frame.  Returns true with *move set if a move should
+  // be sent at nowUsec.
+  bool update(int64_t tUsec, double dx, double dy, int64_t nowUsec,
+              Move* move);
+
+private:
+  MotionModel motion_;
+  bool predict_;
+  KalmanAxis x_;
+  KalmanAxis y_;
+  int64_t lastUsec_ = 0;
+};
+
+// A recorded target, in pixels from the middle of the frame of a
+// camera which isn't moving.  Sequence files have a line per frame,
+// "t_ms x y".
+struct TargetSample {
+  int64_t tUsec;
+  double x;
+  double y;
+};
+
+std::vector<TargetSample> readSequence(const std::string& path);
+
+struct TrackingStats {
+  // Distance of the target from the middle of the frame.
+  double rmsError = 0;
+  double maxError = 0;
+  int moves = 0;
+  // Moves the mechanism's command buffer had no room for.
+  int dropped = 0;
+};
+
+// Replays a sequence against the mechanism model, starting moves after
+// the actual latency, and measures how well the tracker keeps up.
+TrackingStats evaluateTracking(const std::vector<TargetSample>& sequence,
+                               double pixelsPerStep,
+                               const LatencyModel& actual,
+                               const LatencyModel& model, bool predict);
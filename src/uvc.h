@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // descriptor types
 
 constexpr int USB_ENDPOINT_DESCRIPTOR = 0x05;
@@ -49,6 +51,22 @@ constexpr int ITT_CAMERA = 0x0201;
 // requests
 
 constexpr int UVC_SET_CUR = 0x01;
+constexpr int UVC_GET_CUR = 0x81;
+constexpr int UVC_GET_INFO = 0x86;
+
+// extension unit GUIDs, in descriptor byte order
+
+constexpr uint8_t LXU_MOTOR_GUID[16] =
+  {
+   0x82, 0x06, 0x61, 0x63, 0x70, 0x50, 0xab, 0x49,
+   0xb8, 0xcc, 0xb3, 0x85, 0x5e, 0x8d, 0x22, 0x56
+  };
+
+constexpr uint8_t LXU_HW_CONTROL_GUID[16] =
+  {
+   0x82, 0x06, 0x61, 0x63, 0x70, 0x50, 0xab, 0x49,
+   0xb8, 0xcc, 0xb3, 0x85, 0x5e, 0x8d, 0x22, 0x1f
+  };
 
 // selectors and values
 
@@ -56,6 +74,8 @@ constexpr int LXU_MOTOR_PANTILT_RELATIVE_CONTROL = 0x01;
 constexpr int LXU_MOTOR_PANTILT_RELATIVE_CONTROL_ENABLE = 0x80;
 
 constexpr int LXU_MOTOR_PANTILT_RESET_CONTROL = 0x02;
+constexpr int LXU_MOTOR_PANTILT_RESET_CONTROL_PAN = 0x01;
+constexpr int LXU_MOTOR_PANTILT_RESET_CONTROL_TILT = 0x02;
 constexpr int LXU_MOTOR_PANTILT_RESET_CONTROL_VALUE = 0x03;
 
 constexpr int LXU_MOTOR_FOCUS_MOTOR_CONTROL = 0x03;
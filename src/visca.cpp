@@ -0,0 +1,492 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "visca.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "position.h"
+#include "socket.h"
+#include "uvc.h"
+
+namespace {
+
+// How often a drive sends another move.
+constexpr int64_t kDriveUsec = 100000;
+
+// VISCA over IP payload types.
+constexpr uint16_t kViscaCommand = 0x0100;
+constexpr uint16_t kViscaInquiry = 0x0110;
+constexpr uint16_t kViscaReply = 0x0111;
+constexpr uint16_t kViscaControl = 0x0200;
+constexpr uint16_t kViscaControlReply = 0x0201;
+constexpr size_t kViscaHeader = 8;
+constexpr size_t kMaxPacket = 16;
+
+sockaddr_in socketAddress(const std::string& address, uint16_t port) {
+  sockaddr_in in;
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &in.sin_addr) != 1) {
+    throw std::runtime_error(address + ": bad address");
+  }
+  return in;
+}
+
+int openSocket(int type, const sockaddr_in& address) {
+  int fd = socket(AF_INET, type, 0);
+  sysCheck(fd, "socket");
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) < 0) {
+    int error = errno;
+    close(fd);
+    throw std::runtime_error(
+      "binding port " + std::to_string(ntohs(address.sin_port)) + ": " +
+      strerror(error));
+  }
+  if (type == SOCK_STREAM) {
+    sysCheck(listen(fd, 16), "listen");
+  }
+  setNonBlocking(fd);
+  return fd;
+}
+
+// Positions are four nibbles, most significant first.
+int decodeNibbles(const uint8_t* p) {
+  return static_cast<int16_t>(
+    (p[0] & 0xf) << 12 | (p[1] & 0xf) << 8 | (p[2] & 0xf) << 4 |
+    (p[3] & 0xf));
+}
+
+void encodeNibbles(int value, uint8_t* p) {
+  uint16_t v = static_cast<uint16_t>(value);
+  p[0] = (v >> 12) & 0xf;
+  p[1] = (v >> 8) & 0xf;
+  p[2] = (v >> 4) & 0xf;
+  p[3] = v & 0xf;
+}
+
+int direction(uint8_t code, int positive) {
+  switch (code) {
+  case 1:
+    return positive;
+  case 2:
+    return -positive;
+  default:
+    return 0;
+  }
+}
+
+}
+
+ViscaCommand decodeVisca(const uint8_t* p, size_t length) {
+  ViscaCommand command{ViscaCommand::kInvalid, 0, 0, 0, 0, 0};
+  if (length < 3 || (p[0] & 0xf0) != 0x80 || p[length - 1] != 0xff) {
+    return command;
+  }
+  command.address = p[0] & 0x0f;
+  const uint8_t* body = p + 1;
+  size_t n = length - 2;
+
+  if (n == 3 && body[0] == 0x01 && body[1] == 0x00 && body[2] == 0x01) {
+    command.kind = ViscaCommand::kClear;
+  } else if (n == 7 && body[0] == 0x01 && body[1] == 0x06 &&
+             body[2] == 0x01) {
+    command.kind = ViscaCommand::kDrive;
+    command.panSpeed = body[3];
+    command.tiltSpeed = body[4];
+    // 1 is left and up.
+    command.pan = direction(body[5], 1);
+    command.tilt = direction(body[6], 1);
+  } else if (n == 13 && body[0] == 0x01 && body[1] == 0x06 &&
+             (body[2] == 0x02 || body[2] == 0x03)) {
+    command.kind = body[2] == 0x02
+      ? ViscaCommand::kAbsolute : ViscaCommand::kRelative;
+    command.panSpeed = body[3];
+    command.tiltSpeed = body[4];
+    command.pan = decodeNibbles(body + 5);
+    command.tilt = decodeNibbles(body + 9);
+  } else if (n == 3 && body[0] == 0x01 && body[1] == 0x06 &&
+             (body[2] == 0x04 || body[2] == 0x05)) {
+    command.kind = body[2] == 0x04
+      ? ViscaCommand::kHome : ViscaCommand::kReset;
+  } else if (n == 5 && body[0] == 0x01 && body[1] == 0x04 &&
+             body[2] == 0x3f && body[3] <= 2) {
+    static const ViscaCommand::Kind kinds[] = {
+      ViscaCommand::kPresetClear, ViscaCommand::kPresetSave,
+      ViscaCommand::kPresetRecall,
+    };
+    command.kind = kinds[body[3]];
+    command.pan = body[4];
+  } else if (n == 3 && body[0] == 0x09 && body[1] == 0x06 &&
+             body[2] == 0x12) {
+    command.kind = ViscaCommand::kPositionInquiry;
+  }
+  return command;
+}
+
+// A client connected over TCP.  Replies come from the controller's
+// workers as well as the gateway, so writes are locked.
+struct ViscaGateway::Connection {
+  Connection(int fd, size_t camera) : fd(fd), camera(camera) {}
+
+  int fd;
+  size_t camera;
+  std::mutex mutex;
+  bool closed = false;
+  uint8_t in[kMaxPacket];
+  size_t inLength = 0;
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ::close(fd);
+    closed = true;
+  }
+};
+
+// Where replies to a packet go, from any thread.
+struct ViscaGateway::Peer {
+  // Over UDP, replies carry the request's sequence number.
+  int udpFd = -1;
+  sockaddr_storage address;
+  socklen_t addressLength = 0;
+  uint32_t sequence = 0;
+  std::shared_ptr<Connection> connection;
+  uint8_t replyAddress = 0x90;
+
+  void send(const uint8_t* data, size_t length,
+            uint16_t type = kViscaReply) const {
+    if (connection) {
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      if (!connection->closed) {
+        // A client which isn't reading its replies loses some.
+        ::send(connection->fd, data, length, kSendFlags);
+      }
+      return;
+    }
+    uint8_t packet[kViscaHeader + kMaxPacket];
+    packet[0] = type >> 8;
+    packet[1] = type & 0xff;
+    packet[2] = length >> 8;
+    packet[3] = length & 0xff;
+    packet[4] = sequence >> 24;
+    packet[5] = (sequence >> 16) & 0xff;
+    packet[6] = (sequence >> 8) & 0xff;
+    packet[7] = sequence & 0xff;
+    memcpy(packet + kViscaHeader, data, length);
+    sendto(udpFd, packet, kViscaHeader + length, 0,
+           reinterpret_cast<const sockaddr*>(&address), addressLength);
+  }
+
+  void reply(uint8_t code) const {
+    uint8_t packet[] = {replyAddress, code, 0xff};
+    send(packet, sizeof(packet));
+  }
+
+  void error(uint8_t code) const {
+    uint8_t packet[] = {replyAddress, 0x60, code, 0xff};
+    send(packet, sizeof(packet));
+  }
+};
+
+ViscaGateway::ViscaGateway(Controller& controller,
+                           const std::vector<uint32_t>& cameras,
+                           const std::string& address, uint16_t port)
+  : controller_(controller)
+  , cameras_(cameras.size())
+  , timers_(wallClockUsec())
+{
+  sysCheck(pipe(wakeFds_), "pipe");
+  setNonBlocking(wakeFds_[0]);
+  setNonBlocking(wakeFds_[1]);
+  for (size_t i = 0; i < cameras.size(); i++) {
+    sockaddr_in in = socketAddress(address, port + i);
+    cameras_[i].locationId = cameras[i];
+    cameras_[i].udpFd = openSocket(SOCK_DGRAM, in);
+    cameras_[i].listenFd = openSocket(SOCK_STREAM, in);
+  }
+}
+
+ViscaGateway::~ViscaGateway() {
+  for (std::shared_ptr<Connection>& connection : connections_) {
+    connection->close();
+  }
+  for (Camera& camera : cameras_) {
+    close(camera.udpFd);
+    close(camera.listenFd);
+  }
+  close(wakeFds_[0]);
+  close(wakeFds_[1]);
+}
+
+void ViscaGateway::stop() {
+  stopping_ = true;
+  char c = 0;
+  ::write(wakeFds_[1], &c, 1);
+}
+
+void ViscaGateway::run() {
+  std::vector<pollfd> fds;
+  while (!stopping_) {
+    fds.clear();
+    fds.push_back(pollfd{wakeFds_[0], POLLIN, 0});
+    for (Camera& camera : cameras_) {
+      fds.push_back(pollfd{camera.udpFd, POLLIN, 0});
+      fds.push_back(pollfd{camera.listenFd, POLLIN, 0});
+    }
+    for (std::shared_ptr<Connection>& connection : connections_) {
+      fds.push_back(pollfd{connection->fd, POLLIN, 0});
+    }
+
+    // Only drives need a timeout.
+    int timeoutMs = -1;
+    int64_t next = timers_.nextWakeUsec();
+    if (next != INT64_MAX) {
+      timeoutMs = static_cast<int>(
+        std::max<int64_t>(0, next - wallClockUsec() + 999) / 1000);
+    }
+    if (poll(fds.data(), fds.size(), timeoutMs) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sysCheck(-1, "poll");
+    }
+    timers_.expire(wallClockUsec());
+
+    size_t base = 1 + 2 * cameras_.size();
+    for (size_t i = connections_.size(); i-- > 0;) {
+      if ((fds[base + i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+          !read(connections_[i])) {
+        connections_[i]->close();
+        connections_.erase(connections_.begin() + i);
+      }
+    }
+    for (size_t i = 0; i < cameras_.size(); i++) {
+      if (fds[1 + 2 * i].revents & POLLIN) {
+        receive(i);
+      }
+      if (fds[2 + 2 * i].revents & POLLIN) {
+        accept(i);
+      }
+    }
+    if (fds[0].revents) {
+      char buf[64];
+      while (::read(wakeFds_[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+  }
+}
+
+void ViscaGateway::receive(size_t camera) {
+  for (;;) {
+    auto peer = std::make_shared<Peer>();
+    uint8_t packet[kViscaHeader + kMaxPacket];
+    peer->udpFd = cameras_[camera].udpFd;
+    peer->addressLength = sizeof(peer->address);
+    ssize_t n = recvfrom(peer->udpFd, packet, sizeof(packet), 0,
+                         reinterpret_cast<sockaddr*>(&peer->address),
+                         &peer->addressLength);
+    if (n < 0) {
+      return;
+    }
+    if (n < static_cast<ssize_t>(kViscaHeader)) {
+      continue;
+    }
+    uint16_t type = packet[0] << 8 | packet[1];
+    size_t length = packet[2] << 8 | packet[3];
+    peer->sequence = static_cast<uint32_t>(packet[4]) << 24 |
+      packet[5] << 16 | packet[6] << 8 | packet[7];
+    if (length != n - kViscaHeader) {
+      continue;
+    }
+    if (type == kViscaControl) {
+      // Resetting the sequence number needs nothing from us.
+      uint8_t ack = 0x01;
+      peer->send(&ack, 1, kViscaControlReply);
+    } else if (type == kViscaCommand || type == kViscaInquiry) {
+      handle(camera, packet + kViscaHeader, length, peer);
+    }
+  }
+}
+
+void ViscaGateway::accept(size_t camera) {
+  for (;;) {
+    int fd = ::accept(cameras_[camera].listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    setNonBlocking(fd);
+    noSigPipe(fd);
+    connections_.push_back(std::make_shared<Connection>(fd, camera));
+  }
+}
+
+bool ViscaGateway::read(const std::shared_ptr<Connection>& connection) {
+  Connection& c = *connection;
+  uint8_t buf[256];
+  ssize_t n = ::read(c.fd, buf, sizeof(buf));
+  if (n == 0) {
+    return false;
+  }
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR;
+  }
+  for (ssize_t i = 0; i < n; i++) {
+    if (c.inLength == sizeof(c.in)) {
+      // Too long to be a packet, so skip to the next one.
+      c.inLength = 0;
+    }
+    c.in[c.inLength++] = buf[i];
+    if (buf[i] == 0xff) {
+      auto peer = std::make_shared<Peer>();
+      peer->connection = connection;
+      handle(c.camera, c.in, c.inLength, peer);
+      c.inLength = 0;
+    }
+  }
+  return true;
+}
+
+void ViscaGateway::handle(size_t camera, const uint8_t* packet,
+                          size_t length, const std::shared_ptr<Peer>& peer) {
+  ViscaCommand visca = decodeVisca(packet, length);
+  peer->replyAddress = 0x80 | ((visca.address & 0x7) << 4);
+  ControlCommand command{ControlCommand::kPosition,
+                         cameras_[camera].locationId, 0, 0};
+  switch (visca.kind) {
+  case ViscaCommand::kInvalid:
+    // A syntax error.
+    peer->error(0x02);
+    return;
+  case ViscaCommand::kClear:
+    peer->reply(0x51);
+    return;
+  case ViscaCommand::kDrive: {
+    peer->reply(0x41);
+    Drive& d = cameras_[camera].drive;
+    d.pan = visca.pan;
+    d.tilt = visca.tilt;
+    d.panSpeed = std::max(1, std::min(kMaxStepsPerMove, visca.panSpeed));
+    d.tiltSpeed = std::max(1, std::min(kMaxStepsPerMove, visca.tiltSpeed));
+    if ((d.pan || d.tilt) && d.timer == 0) {
+      drive(camera);
+    }
+    peer->reply(0x51);
+    return; }
+  case ViscaCommand::kAbsolute:
+    command.kind = ControlCommand::kGoto;
+    command.a = -visca.pan;
+    command.b = visca.tilt;
+    break;
+  case ViscaCommand::kRelative:
+    command.kind = ControlCommand::kMove;
+    command.a = -visca.pan;
+    command.b = visca.tilt;
+    break;
+  case ViscaCommand::kHome:
+    command.kind = ControlCommand::kGoto;
+    break;
+  case ViscaCommand::kReset:
+    command.kind = ControlCommand::kReset;
+    command.a = LXU_MOTOR_PANTILT_RESET_CONTROL_PAN |
+      LXU_MOTOR_PANTILT_RESET_CONTROL_TILT;
+    break;
+  case ViscaCommand::kPresetSave:
+    command.kind = ControlCommand::kSavePreset;
+    command.a = visca.pan;
+    break;
+  case ViscaCommand::kPresetRecall:
+    command.kind = ControlCommand::kRecallPreset;
+    command.a = visca.pan;
+    break;
+  case ViscaCommand::kPresetClear:
+    command.kind = ControlCommand::kClearPreset;
+    command.a = visca.pan;
+    break;
+  case ViscaCommand::kPositionInquiry:
+    submit(command, peer, true);
+    return;
+  }
+
+  // A move stops any drive.
+  Drive& d = cameras_[camera].drive;
+  d.pan = d.tilt = 0;
+  peer->reply(0x41);
+  submit(command, peer, false);
+}
+
+void ViscaGateway::submit(const ControlCommand& command,
+                          const std::shared_ptr<Peer>& peer, bool inquiry) {
+  bool ok = controller_.submit(command, [peer, inquiry](const ControlReply& r) {
+    if (!r.ok) {
+      // Not executable.
+      peer->error(0x41);
+    } else if (inquiry) {
+      uint8_t packet[11] = {peer->replyAddress, 0x50};
+      encodeNibbles(-r.pan, packet + 2);
+      encodeNibbles(r.tilt, packet + 6);
+      packet[10] = 0xff;
+      peer->send(packet, sizeof(packet));
+    } else {
+      peer->reply(0x51);
+    }
+  });
+  if (!ok) {
+    peer->error(0x41);
+  }
+}
+
+// Each turn of a drive sends a move as big as the speed, unless the
+// last one is still waiting to go.
+void ViscaGateway::drive(size_t camera) {
+  Drive& d = cameras_[camera].drive;
+  d.timer = 0;
+  if (d.pan == 0 && d.tilt == 0) {
+    return;
+  }
+  if (!d.moving->exchange(true)) {
+    std::shared_ptr<std::atomic<bool>> moving = d.moving;
+    ControlCommand command{ControlCommand::kMove, cameras_[camera].locationId,
+                           d.pan * d.panSpeed, d.tilt * d.tiltSpeed};
+    if (!controller_.submit(command, [moving](const ControlReply&) {
+          *moving = false;
+        })) {
+      *moving = false;
+    }
+  }
+  ViscaGateway* gateway = this;
+  d.timer = timers_.add(wallClockUsec() + kDriveUsec, kDriveUsec / 10,
+                        [gateway, camera]() { gateway->drive(camera); });
+}
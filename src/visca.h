@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "controller.h"
+#include "timer.h"
+
+// A gateway from VISCA, which is what most PTZ camera controllers
+// speak, to a Controller.  Each camera gets its own port, as if it
+// were its own VISCA over IP camera: UDP with Sony's 8 byte header,
+// or plain VISCA packets over TCP.
+//
+// VISCA pans right for positive positions, so pan positions are the
+// opposite of ours.  Home is the middle, where a reset leaves the
+// camera.  The Orbit can't move continuously, so drives are turned
+// into a stream of small relative moves until a stop.
+
+constexpr uint16_t kViscaPort = 52381;
+
+struct ViscaCommand {
+  enum Kind {
+    kInvalid,
+    // Pan and tilt are directions, 1, -1 or 0, positive left and up.
+    kDrive,
+    // Pan and tilt are a position or steps, in VISCA's directions.
+    kAbsolute,
+    kRelative,
+    kHome,
+    kReset,
+    // Pan is the preset number.
+    kPresetSave,
+    kPresetRecall,
+    kPresetClear,
+    kPositionInquiry,
+    kClear,
+  };
+
+  Kind kind;
+  // The camera's address, from the first byte.
+  int address;
+  int pan;
+  int tilt;
+  int panSpeed;
+  int tiltSpeed;
+};
+
+// Decodes one packet, from the address byte to the 0xff at the end.
+ViscaCommand decodeVisca(const uint8_t* packet, size_t length);
+
+// Runs on one thread.  Replies go straight back from the controller's
+// workers, so the controller has to be destroyed first.
+class ViscaGateway {
+public:
+  // Camera i is on port + i, on the given local address.
+  ViscaGateway(Controller& controller, const std::vector<uint32_t>& cameras,
+               const std::string& address, uint16_t port);
+  ~ViscaGateway();
+
+  // Serves until stop() is called.
+  void run();
+  void stop();
+
+private:
+  struct Connection;
+  struct Peer;
+
+  struct Drive {
+    int pan = 0;
+    int tilt = 0;
+    int panSpeed = 0;
+    int tiltSpeed = 0;
+    uint64_t timer = 0;
+    // Set while a move is waiting to be sent, so drives don't pile up
+    // moves faster than the camera can make them.
+    std::shared_ptr<std::atomic<bool>> moving =
+      std::make_shared<std::atomic<bool>>(false);
+  };
+
+  struct Camera {
+    uint32_t locationId;
+    int udpFd = -1;
+    int listenFd = -1;
+    Drive drive;
+  };
+
+  void receive(size_t camera);
+  void accept(size_t camera);
+  // Returns false if the connection should be closed.
+  bool read(const std::shared_ptr<Connection>& connection);
+  void handle(size_t camera, const uint8_t* packet, size_t length,
+              const std::shared_ptr<Peer>& peer);
+  void submit(const ControlCommand& command, const std::shared_ptr<Peer>& peer,
+              bool inquiry);
+  void drive(size_t camera);
+
+  Controller& controller_;
+  std::vector<Camera> cameras_;
+  std::vector<std::shared_ptr<Connection>> connections_;
+  TimerWheel timers_;
+  int wakeFds_[2] = {-1, -1};
+  std::atomic<bool> stopping_{false};
+};
@@ -0,0 +1,613 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "wire.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "socket.h"
+#include "uvc.h"
+
+namespace {
+
+sockaddr_un socketAddress(const std::string& path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error(path + ": socket path is too long");
+  }
+  strcpy(address.sun_path, path.c_str());
+  return address;
+}
+
+WireFrame makeFrame(uint8_t type, uint32_t camera, uint32_t sequence) {
+  WireFrame frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.version = kWireVersion;
+  frame.type = type;
+  frame.camera = camera;
+  frame.sequence = sequence;
+  return frame;
+}
+
+void putPosition(WireFrame& frame, int32_t pan, int32_t tilt) {
+  memcpy(frame.data, &pan, sizeof(pan));
+  memcpy(frame.data + sizeof(pan), &tilt, sizeof(tilt));
+}
+
+WireFrame makeAck(const WireFrame& frame, uint8_t status,
+                  const ControlReply* reply) {
+  WireFrame ack = makeFrame(kWireAck, frame.camera, frame.sequence);
+  ack.status = status;
+  if (reply) {
+    putPosition(ack, reply->pan, reply->tilt);
+    ack.data[8] = reply->homed;
+  }
+  return ack;
+}
+
+}
+
+WireFrame wireControl(uint32_t camera, uint32_t sequence, const Request& req) {
+  WireFrame frame = makeFrame(kWireControl, camera, sequence);
+  if (req.length() > sizeof(frame.data)) {
+    throw std::runtime_error("request is too long for a frame");
+  }
+  frame.unit = req.unit();
+  frame.selector = req.selector();
+  frame.request = req.request();
+  frame.length = req.length();
+  memcpy(frame.data, req.data(), req.length());
+  return frame;
+}
+
+WireFrame wireGoto(uint32_t camera, uint32_t sequence, int pan, int tilt) {
+  WireFrame frame = makeFrame(kWireGoto, camera, sequence);
+  putPosition(frame, pan, tilt);
+  return frame;
+}
+
+WireFrame wirePosition(uint32_t camera, uint32_t sequence) {
+  return makeFrame(kWirePosition, camera, sequence);
+}
+
+WireFrame wireInventory(uint32_t sequence) {
+  return makeFrame(kWireInventory, 0, sequence);
+}
+
+bool encodeWireFrame(const ControlCommand& command, uint32_t sequence,
+                     WireFrame* frame) {
+  Request req;
+  switch (command.kind) {
+  case ControlCommand::kGoto:
+    *frame = wireGoto(command.locationId, sequence, command.a, command.b);
+    return true;
+  case ControlCommand::kPosition:
+    *frame = wirePosition(command.locationId, sequence);
+    return true;
+  case ControlCommand::kMove:
+    // A relative move only has a byte for each axis.
+    if (command.a < -128 || command.a > 127 || command.b < -128 ||
+        command.b > 127) {
+      return false;
+    }
+    req.panTiltRelative(command.a, command.b);
+    break;
+  case ControlCommand::kProbe:
+    req.probe();
+    break;
+  case ControlCommand::kReset:
+    // Deciding which axes need it happens on the far end, so it can't
+    // be asked for.
+    if (command.a == 0) {
+      return false;
+    }
+    req.panTiltReset(command.a & LXU_MOTOR_PANTILT_RESET_CONTROL_PAN,
+                     command.a & LXU_MOTOR_PANTILT_RESET_CONTROL_TILT);
+    break;
+  case ControlCommand::kLed:
+    req.ledControl(command.a, command.b);
+    break;
+  default:
+    return false;
+  }
+  *frame = wireControl(command.locationId, sequence, req);
+  return true;
+}
+
+bool decodeWireFrame(const WireFrame& frame, ControlCommand* command) {
+  if (frame.version != kWireVersion) {
+    return false;
+  }
+  command->locationId = frame.camera;
+  command->a = 0;
+  command->b = 0;
+
+  switch (frame.type) {
+  case kWireGoto: {
+    int32_t pan, tilt;
+    memcpy(&pan, frame.data, sizeof(pan));
+    memcpy(&tilt, frame.data + sizeof(pan), sizeof(tilt));
+    command->kind = ControlCommand::kGoto;
+    command->a = pan;
+    command->b = tilt;
+    return true; }
+  case kWirePosition:
+    command->kind = ControlCommand::kPosition;
+    return true;
+  case kWireControl:
+    break;
+  default:
+    return false;
+  }
+
+  // Requests go through the controller, rather than straight to the
+  // camera, so it can keep track of the position.
+  if (frame.unit == Request::kMotorUnit &&
+      frame.selector == LXU_MOTOR_PANTILT_RELATIVE_CONTROL) {
+    if (frame.request == UVC_SET_CUR &&
+        frame.length == sizeof(LogitechMotorRequest)) {
+      command->kind = ControlCommand::kMove;
+      decodePanTiltRelative(frame.data, &command->a, &command->b);
+      return true;
+    }
+    if (frame.request == UVC_GET_INFO && frame.length == 1) {
+      command->kind = ControlCommand::kProbe;
+      return true;
+    }
+  } else if (frame.unit == Request::kMotorUnit &&
+             frame.selector == LXU_MOTOR_PANTILT_RESET_CONTROL &&
+             frame.request == UVC_SET_CUR && frame.length == 1 &&
+             frame.data[0] != 0) {
+    command->kind = ControlCommand::kReset;
+    command->a = frame.data[0];
+    return true;
+  } else if (frame.unit == Request::kHwControlUnit &&
+             frame.selector == LXU_HW_CONTROL_LED1 &&
+             frame.request == UVC_SET_CUR &&
+             frame.length == sizeof(LogitechLedRequest)) {
+    command->kind = ControlCommand::kLed;
+    command->a = frame.data[0];
+    command->b = (frame.data[1] << 8) | frame.data[2];
+    return true;
+  }
+  return false;
+}
+
+void decodeWireAck(const WireFrame& ack, int* pan, int* tilt, bool* homed) {
+  int32_t p, t;
+  memcpy(&p, ack.data, sizeof(p));
+  memcpy(&t, ack.data + sizeof(p), sizeof(t));
+  *pan = p;
+  *tilt = t;
+  *homed = ack.data[8];
+}
+
+std::string defaultSocketPath() {
+  if (const char* path = getenv("ORBITCTL_SOCKET")) {
+    return path;
+  }
+  if (const char* home = getenv("HOME")) {
+    return std::string(home) + "/.orbitctl.sock";
+  }
+  return ".orbitctl.sock";
+}
+
+int listenWireTcp(const std::string& address, uint16_t port) {
+  sockaddr_in in;
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &in.sin_addr) != 1) {
+    throw std::runtime_error(address + ": bad address");
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sysCheck(fd, "socket");
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, reinterpret_cast<sockaddr*>(&in), sizeof(in)) < 0) {
+    int error = errno;
+    close(fd);
+    throw std::runtime_error("binding port " + std::to_string(port) + ": " +
+                             strerror(error));
+  }
+  sysCheck(listen(fd, 64), "listen");
+  return fd;
+}
+
+constexpr size_t WireServer::kBatchFrames;
+constexpr size_t WireServer::kAckHighWater;
+
+WireServer::WireServer(Controller& controller, const std::string& path)
+  : controller_(controller)
+  , ackQueue_(kAckHighWater +
+              std::max<size_t>(1, controller.locations().size()))
+  , path_(path)
+{
+  sockaddr_un address = socketAddress(path);
+  listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  sysCheck(listenFd_, "socket");
+  // A socket left behind by an earlier run would stop the bind.
+  unlink(path.c_str());
+  sysCheck(bind(listenFd_, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)), "bind");
+  sysCheck(listen(listenFd_, 64), "listen");
+  setNonBlocking(listenFd_);
+  sysCheck(pipe(wakeFds_), "pipe");
+  setNonBlocking(wakeFds_[0]);
+  setNonBlocking(wakeFds_[1]);
+}
+
+WireServer::WireServer(Controller& controller, const std::string& path,
+                       int listenFd)
+  : controller_(controller)
+  , ackQueue_(kAckHighWater +
+              std::max<size_t>(1, controller.locations().size()))
+  , path_(path)
+  , listenFd_(listenFd)
+{
+  setNonBlocking(listenFd_);
+  sysCheck(pipe(wakeFds_), "pipe");
+  setNonBlocking(wakeFds_[0]);
+  setNonBlocking(wakeFds_[1]);
+}
+
+WireServer::~WireServer() {
+  for (std::shared_ptr<Connection>& connection : connections_) {
+    close(connection->fd);
+  }
+  close(wakeFds_[0]);
+  close(wakeFds_[1]);
+  if (listenFd_ >= 0) {
+    close(listenFd_);
+    if (!path_.empty()) {
+      unlink(path_.c_str());
+    }
+  }
+}
+
+void WireServer::adopt(int fd, const std::string& partial) {
+  setNonBlocking(fd);
+  noSigPipe(fd);
+  auto connection = std::make_shared<Connection>(fd, ackQueue_);
+  if (partial.size() > sizeof(connection->in)) {
+    throw std::runtime_error("adopted connection has too much unread");
+  }
+  memcpy(connection->in, partial.data(), partial.size());
+  connection->inLength = partial.size();
+  connections_.push_back(connection);
+}
+
+void WireServer::release(
+  int* listenFd, std::vector<std::pair<int, std::string>>* connections) {
+  for (std::shared_ptr<Connection>& connection : connections_) {
+    Connection& c = *connection;
+    // Each write starts by refilling the buffer, so it's all out once
+    // there's nothing left to refill it with.
+    bool ok;
+    do {
+      ok = write(c);
+      if (ok && c.outLength > c.outStart) {
+        pollfd fd{c.fd, POLLOUT, 0};
+        poll(&fd, 1, -1);
+      }
+    } while (ok && c.outLength > 0);
+    if (!ok) {
+      close(c.fd);
+      continue;
+    }
+    connections->emplace_back(
+      c.fd, std::string(reinterpret_cast<char*>(c.in), c.inLength));
+  }
+  connections_.clear();
+  *listenFd = listenFd_;
+  listenFd_ = -1;
+}
+
+void WireServer::stop() {
+  stopping_ = true;
+  wake();
+}
+
+void WireServer::wake() {
+  if (!wakePending_.exchange(true)) {
+    char c = 0;
+    ::write(wakeFds_[1], &c, 1);
+  }
+}
+
+void WireServer::run() {
+  std::vector<pollfd> fds;
+  while (!stopping_) {
+    fds.clear();
+    fds.push_back(pollfd{listenFd_, POLLIN, 0});
+    fds.push_back(pollfd{wakeFds_[0], POLLIN, 0});
+    // Frames read but held back, like ones adopted from an older
+    // server, are handled without waiting for anything new.
+    int timeout = -1;
+    for (std::shared_ptr<Connection>& connection : connections_) {
+      if (connection->inLength >= sizeof(WireFrame) &&
+          connection->backlog < kAckHighWater) {
+        timeout = 0;
+      }
+      // A client with too many acks coming isn't read from until it
+      // takes some, so it can't fill up memory or hold up the workers.
+      short events = 0;
+      if (connection->backlog < kAckHighWater &&
+          connection->inLength < sizeof(connection->in)) {
+        events |= POLLIN;
+      }
+      if (connection->outLength > connection->outStart) {
+        events |= POLLOUT;
+      }
+      fds.push_back(pollfd{connection->fd, events, 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sysCheck(-1, "poll");
+    }
+
+    if (fds[1].revents) {
+      char buf[64];
+      while (::read(wakeFds_[0], buf, sizeof(buf)) > 0) {
+      }
+      // Cleared before flushing, so replies queued after this wake
+      // the loop again.
+      wakePending_ = false;
+    }
+
+    // Going backwards, so closed connections can be dropped in place.
+    for (size_t i = connections_.size(); i-- > 0;) {
+      std::shared_ptr<Connection> connection = connections_[i];
+      bool ok = true;
+      if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ok = read(*connection);
+      }
+      // Writing first makes room in the backlog for held back frames.
+      if (ok) {
+        ok = write(*connection);
+      }
+      if (ok) {
+        process(connection);
+        ok = write(*connection) && !connection->overflowed;
+      }
+      if (!ok) {
+        close(connection->fd);
+        connections_.erase(connections_.begin() + i);
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      accept();
+    }
+  }
+}
+
+void WireServer::accept() {
+  for (;;) {
+    int fd = ::accept(listenFd_, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    setNonBlocking(fd);
+    noSigPipe(fd);
+    noDelay(fd);
+    connections_.push_back(std::make_shared<Connection>(fd, ackQueue_));
+  }
+}
+
+bool WireServer::read(Connection& c) {
+  if (c.inLength == sizeof(c.in)) {
+    return true;
+  }
+  ssize_t n = ::read(c.fd, c.in + c.inLength, sizeof(c.in) - c.inLength);
+  if (n == 0) {
+    return false;
+  }
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR;
+  }
+  c.inLength += n;
+  return true;
+}
+
+void WireServer::process(const std::shared_ptr<Connection>& connection) {
+  Connection& c = *connection;
+  size_t used = 0;
+  while (c.inLength - used >= sizeof(WireFrame) &&
+         c.backlog < kAckHighWater) {
+    WireFrame frame;
+    memcpy(&frame, c.in + used, sizeof(frame));
+    handle(connection, frame);
+    used += sizeof(frame);
+  }
+  memmove(c.in, c.in + used, c.inLength - used);
+  c.inLength -= used;
+}
+
+bool WireServer::write(Connection& c) {
+  // Keeps going until the socket is full, since acks left in the queue
+  // after the buffer empties wouldn't wake the loop again.
+  for (;;) {
+    if (c.outStart == c.outLength) {
+      c.outStart = c.outLength = 0;
+    }
+    WireFrame ack;
+    while (c.outLength + sizeof(ack) <= sizeof(c.out) && c.acks.pop(&ack)) {
+      memcpy(c.out + c.outLength, &ack, sizeof(ack));
+      c.outLength += sizeof(ack);
+      c.backlog--;
+    }
+    if (c.outStart == c.outLength) {
+      return true;
+    }
+    ssize_t n = ::send(c.fd, c.out + c.outStart, c.outLength - c.outStart,
+                       kSendFlags);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    c.outStart += n;
+  }
+}
+
+void WireServer::handle(const std::shared_ptr<Connection>& connection,
+                        const WireFrame& frame) {
+  if (frame.version == kWireVersion && frame.type == kWireInventory) {
+    std::vector<uint32_t> locations = controller_.locations();
+    connection->backlog += std::max<size_t>(1, locations.size());
+    if (locations.empty()) {
+      reply(*connection, makeAck(frame, kWireUnknownCamera, nullptr));
+    }
+    for (size_t i = 0; i < locations.size(); i++) {
+      WireFrame ack = makeAck(frame, kWireOk, nullptr);
+      ack.camera = locations[i];
+      ack.data[0] = i + 1 < locations.size();
+      reply(*connection, ack);
+    }
+    return;
+  }
+
+  // Every other frame gets one ack.
+  connection->backlog++;
+  ControlCommand command;
+  if (!decodeWireFrame(frame, &command)) {
+    reply(*connection, makeAck(frame, kWireBadFrame, nullptr));
+    return;
+  }
+  WireServer* server = this;
+  bool ok = controller_.submit(
+    command, [server, connection, frame](const ControlReply& r) {
+      server->reply(*connection,
+                    makeAck(frame, r.ok ? kWireOk : kWireFailed, &r));
+    });
+  if (!ok) {
+    reply(*connection, makeAck(frame, controller_.owns(frame.camera)
+                               ? kWireBusy : kWireUnknownCamera, nullptr));
+  }
+}
+
+void WireServer::reply(Connection& connection, const WireFrame& ack) {
+  // The backlog keeps the queue from filling, so this never waits.  If
+  // it fills anyway, the client can't be given a consistent stream, so
+  // it's dropped.
+  if (!connection.acks.push(ack)) {
+    connection.overflowed = true;
+  }
+  wake();
+}
+
+WireClient::WireClient(const std::string& path) {
+  sockaddr_un address = socketAddress(path);
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  sysCheck(fd_, "socket");
+  noSigPipe(fd_);
+  if (connect(fd_, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) < 0) {
+    int error = errno;
+    close(fd_);
+    throw std::runtime_error(path + ": " + strerror(error));
+  }
+}
+
+WireClient::WireClient(const std::string& host, uint16_t port) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found;
+  int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(),
+                          &hints, &found);
+  if (error != 0) {
+    throw std::runtime_error(host + ": " + gai_strerror(error));
+  }
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ < 0 || connect(fd_, found->ai_addr, found->ai_addrlen) < 0) {
+    error = errno;
+    freeaddrinfo(found);
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    throw std::runtime_error(host + ":" + std::to_string(port) + ": " +
+                             strerror(error));
+  }
+  freeaddrinfo(found);
+  noSigPipe(fd_);
+  noDelay(fd_);
+}
+
+WireClient::~WireClient() {
+  close(fd_);
+}
+
+void WireClient::send(const WireFrame* frames, size_t count) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(frames);
+  size_t left = count * sizeof(WireFrame);
+  while (left > 0) {
+    ssize_t n = ::send(fd_, data, left, kSendFlags);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    sysCheck(n, "send");
+    data += n;
+    left -= n;
+  }
+}
+
+size_t WireClient::receive(WireFrame* acks, size_t max) {
+  uint8_t* data = reinterpret_cast<uint8_t*>(acks);
+  size_t have = partialLength_;
+  memcpy(data, partial_, have);
+  while (have < sizeof(WireFrame)) {
+    ssize_t n = ::read(fd_, data + have, max * sizeof(WireFrame) - have);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    sysCheck(n, "read");
+    if (n == 0) {
+      throw std::runtime_error("server closed the connection");
+    }
+    have += n;
+  }
+  size_t count = have / sizeof(WireFrame);
+  partialLength_ = have % sizeof(WireFrame);
+  memcpy(partial_, data + count * sizeof(WireFrame), partialLength_);
+  return count;
+}
+
+void WireClient::shutdown() {
+  ::shutdown(fd_, SHUT_RDWR);
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) 2021 Marc Horowitz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "controller.h"
+#include "queue.h"
+#include "request.h"
+
+// A binary protocol for driving a Controller from other processes on
+// the same machine, or from a cluster coordinator on another.
+// Everything is a fixed size frame, so there's nothing to parse, and a
+// client can write many frames at once and read the acknowledgements
+// as they come, matching them up by sequence number.  Fields are in
+// host byte order, since every Mac is little endian.
+
+constexpr uint8_t kWireVersion = 1;
+// Where an agent listens, when it's on TCP.
+constexpr uint16_t kWirePort = 7450;
+
+enum WireType : uint8_t {
+  // A Request: unit, selector, request, length and data are Request's.
+  kWireControl = 1,
+  // Moves to the position in data, as two int32s.
+  kWireGoto = 2,
+  kWirePosition = 3,
+  // Lists the cameras, with an ack for each, its location as the
+  // camera, and data[0] set on all but the last.  With no cameras, the
+  // one ack is kWireUnknownCamera.
+  kWireInventory = 4,
+  // The reply to any of those, with the status, and the position as
+  // two int32s followed by a homed flag in data.
+  kWireAck = 0x80,
+};
+
+enum WireStatus : uint8_t {
+  kWireOk = 0,
+  kWireFailed = 1,
+  kWireBusy = 2,
+  kWireUnknownCamera = 3,
+  kWireBadFrame = 4,
+};
+
+struct WireFrame {
+  uint8_t version;
+  uint8_t type;
+  uint8_t unit;
+  uint8_t selector;
+  uint8_t request;
+  uint8_t length;
+  uint8_t status;
+  uint8_t reserved;
+  uint32_t camera;
+  uint32_t sequence;
+  uint8_t data[16];
+} __attribute__((packed));
+
+static_assert(sizeof(WireFrame) == 32, "WireFrame must be 32 bytes");
+
+WireFrame wireControl(uint32_t camera, uint32_t sequence, const Request& req);
+WireFrame wireGoto(uint32_t camera, uint32_t sequence, int pan, int tilt);
+WireFrame wirePosition(uint32_t camera, uint32_t sequence);
+WireFrame wireInventory(uint32_t sequence);
+// The frame for a command, returning false for those the protocol
+// can't carry, like presets.
+bool encodeWireFrame(const ControlCommand& command, uint32_t sequence,
+                     WireFrame* frame);
+// Turns a frame into a command, returning false if it doesn't make
+// sense.
+bool decodeWireFrame(const WireFrame& frame, ControlCommand* command);
+void decodeWireAck(const WireFrame& ack, int* pan, int* tilt, bool* homed);
+
+// $ORBITCTL_SOCKET, or ~/.orbitctl.sock.
+std::string defaultSocketPath();
+// A TCP socket listening on the address and port, for a WireServer
+// with no path.
+int listenWireTcp(const std::string& address, uint16_t port);
+
+// Serves the protocol on a unix domain socket, with one thread doing
+// all the I/O.  Replies from the controller's workers are queued for
+// it without locking.  Replies can keep coming until the controller is
+// destroyed, so it has to go first.
+class WireServer {
+public:
+  WireServer(Controller& controller, const std::string& path);
+  // Serves on a socket which is already listening at path, like one
+  // handed over by an older process, or on TCP, if path is empty.
+  WireServer(Controller& controller, const std::string& path, int listenFd);
+  ~WireServer();
+
+  // Takes on a client connection, with anything already read from it
+  // but not yet handled.
+  void adopt(int fd, const std::string& partial);
+
+  // Serves until stop() is called.  stop() is safe in a signal handler.
+  void run();
+  void stop();
+
+  // After run() returns, and the controller has no more replies to
+  // send, writes out every queued ack and gives up the listening
+  // socket and the connections, without closing them, so another
+  // server can adopt them.
+  void release(int* listenFd, std::vector<std::pair<int, std::string>>*
+               connections);
+
+private:
+  // How many frames are read or written at once.
+  static constexpr size_t kBatchFrames = 256;
+  // How many acks a client can have coming before its frames stop
+  // being read.  Each connection's queue holds this many, plus one
+  // inventory, so it never overflows.
+  static constexpr size_t kAckHighWater = 2048;
+
+  struct Connection {
+    Connection(int fd, size_t ackQueue) : fd(fd), acks(ackQueue) {}
+
+    int fd;
+    BoundedQueue<WireFrame> acks;
+    // Acks owed to the client, whether they're queued yet or not.
+    // Only the I/O thread changes this.
+    size_t backlog = 0;
+    std::atomic<bool> overflowed{false};
+    uint8_t in[kBatchFrames * sizeof(WireFrame)];
+    size_t inLength = 0;
+    uint8_t out[kBatchFrames * sizeof(WireFrame)];
+    size_t outStart = 0;
+    size_t outLength = 0;
+  };
+
+  void accept();
+  // These return false if the connection should be closed.
+  bool read(Connection& connection);
+  bool write(Connection& connection);
+  // Handles whole frames which have been read, until the backlog
+  // reaches the high water mark.
+  void process(const std::shared_ptr<Connection>& connection);
+  void handle(const std::shared_ptr<Connection>& connection,
+              const WireFrame& frame);
+  void reply(Connection& connection, const WireFrame& ack);
+  void wake();
+
+  Controller& controller_;
+  // The size of each connection's ack queue.
+  size_t ackQueue_;
+  std::string path_;
+  int listenFd_ = -1;
+  // Workers write to this to wake the I/O thread.
+  int wakeFds_[2] = {-1, -1};
+  std::atomic<bool> wakePending_{false};
+  std::atomic<bool> stopping_{false};
+  std::vector<std::shared_ptr<Connection>> connections_;
+};
+
+class WireClient {
+public:
+  explicit WireClient(const std::string& path);
+  // Connects over TCP instead.
+  WireClient(const std::string& host, uint16_t port);
+  ~WireClient();
+
+  WireClient(const WireClient&) = delete;
+  WireClient& operator=(const WireClient&) = delete;
+
+  // Sends the frames in as few writes as possible.
+  void send(const WireFrame* frames, size_t count);
+  // Waits for some acks, and returns how many were read, up to max.
+  size_t receive(WireFrame* acks, size_t max);
+  // Makes a receive() waiting on another thread give up, by throwing.
+  void shutdown();
+
+private:
+  int fd_;
+  uint8_t partial_[sizeof(WireFrame)];
+  size_t partialLength_ = 0;
+};